@@ -1,4 +1,14 @@
 
+SDL_Surface *
+setup_presentation(SDL_Surface *video, int smooth);
+void
+atris_flush_updates(void);
+Uint32
+atris_next_present(void);
+void
+atris_batch_updates(int on);
+int
+atris_wait_event(SDL_Event *ev, Uint32 ms);
 void
 poll_and_flame(SDL_Event *ev);
 void
@@ -13,6 +23,7 @@ setup_colors(SDL_Surface *screen);
 #define DRAW_HUGE	(1<<5)
 #define DRAW_LARGE	(1<<6)
 #define DRAW_GRID_0	(1<<7)
+#define DRAW_SMALL	(1<<8)
 int
 draw_string(char *text, SDL_Color sc, int x, int y, int flags);
 int
@@ -27,10 +38,16 @@ void
 draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 	int level[], int my_adj[], int their_adj[], char *name[]);
 void
+draw_pause_text(char *text);
+void
 draw_pause(int on);
 void
 draw_clock(int seconds);
 void
+draw_net_stats(void);
+void
+draw_profile_stats(void);
+void
 draw_score(SDL_Surface *screen, int i);
 void
 draw_next_piece(SDL_Surface *screen, piece_style *ps, color_style *cs,
@@ -4,11 +4,15 @@ cleanup_grid(Grid *g);
 Grid
 generate_board(int w, int h, int level);
 void
+grid_snapshot(Grid *copy, Grid *g);
+void
+grid_restore(Grid *g, Grid *copy);
+void
 add_garbage(Grid *g);
 void
 draw_grid(SDL_Surface *screen, color_style *cs, Grid *g, int draw);
 void
-draw_falling(SDL_Surface *screen, int blockWidth, Grid *g, int offset);
+draw_falling(SDL_Surface *screen, color_style *cs, Grid *g, int offset);
 void
 fall_down(Grid *g);
 int
@@ -4,6 +4,56 @@ Server_AwaitConnection(int port);
 int
 Client_Connect(char *hoststr, int lport);
 int
+Network_Send(int sock, const void *buf, int len);
+int
+Network_Recv(int sock, void *buf, int len);
+int
+Network_PutU32(unsigned char *buf, Uint32 v);
+Uint32
+Network_GetU32(const unsigned char *buf);
+int
+Network_PutU64(unsigned char *buf, Uint64 v);
+Uint64
+Network_GetU64(const unsigned char *buf);
+int
+Network_PutVarint(unsigned char *buf, Sint32 v);
+int
+Network_GetVarint(const unsigned char *buf, int len, Sint32 *v);
+int
+Network_SendU32(int sock, Uint32 v);
+int
+Network_RecvU32(int sock, Uint32 *v);
+int
+Network_SendU64(int sock, Uint64 v);
+int
+Network_RecvU64(int sock, Uint64 *v);
+int
+Network_SendInt(int sock, int v);
+int
+Network_RecvInt(int sock, int *v);
+void
+Network_StatsReset(void);
+void
+Network_NoteFrame(int ms);
+int
+Network_Ping(int sock);
+int
+Network_ReadPing(int sock, int answer);
+int
+Network_ReadPong(int sock);
+void
+Network_StatsDump(char *filespec, int match);
+void
+Network_SessionBegin(int sock, int server, char *host, int port, Uint32 token);
+int
+Network_SessionSocket(void);
+int
+Network_SessionIsServer(void);
+int
+Network_SessionReconnect(void);
+void
+Network_SessionEnd(void);
+int
 Network_Init(void);
 void
 Network_Quit(void);
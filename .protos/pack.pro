@@ -0,0 +1,22 @@
+
+int
+pack_open(const char *filename);
+FILE *
+pack_fopen(const char *name);
+SDL_RWops *
+pack_RWops(const char *name);
+SDL_Surface *
+pack_LoadBMP(const char *name);
+int
+pack_image_size(const char *name, int *w, int *h);
+int
+pack_LoadWAV(const char *name, SDL_AudioSpec *spec, Uint8 **audio_buf,
+	Uint32 *audio_len);
+const char *
+pack_locate(const char *name, int type, Uint32 *offset, Uint32 *len);
+pack_dir *
+pack_opendir(const char *dir);
+struct dirent *
+pack_readdir(pack_dir *d);
+void
+pack_closedir(pack_dir *d);
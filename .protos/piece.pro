@@ -1,6 +1,8 @@
 
 piece_styles
 load_piece_styles(void);
+void
+use_color_style(color_style *cs);
 color_styles 
 load_color_styles(SDL_Surface * screen);
 play_piece
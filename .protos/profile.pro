@@ -0,0 +1,15 @@
+
+void
+Profile_Start(void);
+void
+Profile_Begin(int s);
+void
+Profile_End(int s);
+Uint32
+Profile_Percentile(int pct);
+int
+Profile_Share(int s);
+void
+Profile_Frame(void);
+void
+Profile_Stop(void);
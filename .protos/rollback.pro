@@ -0,0 +1,12 @@
+
+void
+Rollback_Reset(Grid *g);
+int
+Rollback_Input(int sock, char tag, SDL_Surface *screen, piece_style *ps,
+	color_style *cs, Grid *g);
+void
+Rollback_Board(SDL_Surface *screen, color_style *cs, Grid *g);
+void
+Rollback_Resume(Uint32 ms);
+void
+Rollback_Advance(SDL_Surface *screen, color_style *cs, Grid *g);
@@ -4,10 +4,14 @@ play_sound_unless_already_playing(sound_style *ss, int which, int delay);
 void
 stop_playing_sound(sound_style *ss, int which);
 void
+play_sound_panned(sound_style *ss, int which, int delay, int volume, int pan);
+void
 play_sound(sound_style *ss, int which, int delay);
 void
 stop_all_playing(void);
 void
 play_all_sounds(sound_style *ss);
+void
+use_sound_style(sound_style *ss);
 sound_styles
 load_sound_styles(int sound_wanted);
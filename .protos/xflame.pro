@@ -1,4 +1,6 @@
 
+Uint32
+atris_flame_wait(void);
 void 
 atris_run_flame(void);
 void
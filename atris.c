@@ -32,6 +32,8 @@
 #include "sound.h"
 #include "identity.h"
 #include "options.h"
+#include "network.h"
+#include "pack.h"
 
 /* function prototypes */
 #include "ai.pro"
@@ -40,7 +42,6 @@
 #include "gamemenu.pro"
 #include "highscore.pro"
 #include "identity.pro"
-#include "network.pro"
 #include "xflame.pro"
 
 static color_style *event_cs[2];	/* pass these to event_loop */
@@ -88,8 +89,34 @@ usage(void)
 	   "\t-w --window\t\tWindowed display (default).\n"
 	   "\t-f --fullscreen\t\tFull-screen display.\n"
 	   "\t-d=X --depth=X\t\tSet color detph (bpp) to X.\n"
+	   "\t--resolution=WxH\tUse a W x H display, scaling the game up.\n"
+	   "\t--smooth\t\tScale smoothly (32 bpp) rather than by\n"
+	   "\t\t\t\twhole multiples.\n"
+	   "\t--refresh[=HZ]\t\tPresent at most once per display refresh\n"
+	   "\t\t\t\t(default 60 Hz).\n"
+	   "\t--flame-threads=N\tCompute the flame with N threads (default 1).\n"
+	   "\t--flame-fps=N\t\tRun the flame at most N times a second\n"
+	   "\t\t\t\t(default 30, 0 = as fast as possible).\n"
+	   "\t--pack=FILE\t\tRead the styles and graphics from the asset\n"
+	   "\t\t\t\tpack FILE (default atris.pack, made by atrispack).\n"
+	   "\t\t\t\tA pack older than styles/ or graphics/ is not used.\n"
+	   "\t--no-pack\t\tRead every style and graphic from its own file.\n"
 	   "\t-r=X --repeat=X\t\tSet the keyboard repeat delay to X.\n"
 	   "\t\t\t\t(1 = Slow Repeat, 16 = Fast Repeat)\n"
+	   "\t--netstats[=FILE]\tShow link statistics during network play\n"
+	   "\t\t\t\t(and append a summary of each match to FILE).\n"
+	   "\t--port=X\t\tUse TCP port X for network play (default 7741).\n"
+	   "\t--profile[=FILE]\tShow frame times and where they go\n"
+	   "\t\t\t\t(and append one CSV line per frame to FILE).\n"
+	   "\nUnattended network play (no menus; try --video=null):\n"
+	   "\t--net-server\t\tWait for a client and play it.\n"
+	   "\t--net-client=HOST\tConnect to the server on HOST and play it.\n"
+	   "\t--net-ai=X\t\tLet AI number X play for us (default 0).\n"
+	   "\t--matches=X\t\tServer: stop after X matches (default 3).\n"
+	   "\nHeadless runs:\n"
+	   "\t--video=X\t\tsdl (default), offscreen (draw into memory)\n"
+	   "\t\t\t\tor null (draw nothing at all).\n"
+	   "\t--batch=X\t\tPlay X AI vs. AI matches, report and quit.\n"
 	   );
     exit(1);
 }
@@ -154,6 +181,8 @@ load_options(char * filespec)
     Options.full_screen = FALSE;
     Options.sound_wanted = TRUE;
     Options.flame_wanted = TRUE;
+    Options.flame_fps = 30;
+    Options.pack_file = "atris.pack";
     Options.bpp_wanted = 0;
     Options.key_repeat_delay = 8;
     Options.special_wanted = FALSE;
@@ -164,6 +193,7 @@ load_options(char * filespec)
     Options.named_sound = -1;
     Options.named_piece = -1;
     Options.named_game = -1;
+    Options.net_port = 7741;
 
     if (!fin) return;
 
@@ -241,10 +271,65 @@ parse_options(int argc, char *argv[])
 	    Options.full_screen = TRUE;
 	else if (!strncmp(argv[i],"-d=", 3) || !strncmp(argv[i],"--depth=", 8)) {
 	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.bpp_wanted);
+	} else if (!strncmp(argv[i],"--resolution=", 13)) {
+	    if (sscanf(strchr(argv[i],'=')+1,"%dx%d",
+			&Options.display_w, &Options.display_h) != 2 ||
+		    Options.display_w <= 0 || Options.display_h <= 0)
+		Options.display_w = Options.display_h = 0;
+	} else if (!strcmp(argv[i],"--smooth")) {
+	    Options.smooth_scaling = TRUE;
+	} else if (!strcmp(argv[i],"--refresh")) {
+	    Options.refresh_hz = 60;
+	} else if (!strncmp(argv[i],"--refresh=", 10)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.refresh_hz);
+	    if (Options.refresh_hz < 0) Options.refresh_hz = 0;
+	    if (Options.refresh_hz > 1000) Options.refresh_hz = 1000;
+	} else if (!strncmp(argv[i],"--flame-threads=", 16)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.flame_threads);
+	    if (Options.flame_threads < 1) Options.flame_threads = 1;
+	    if (Options.flame_threads > 8) Options.flame_threads = 8;
+	} else if (!strncmp(argv[i],"--flame-fps=", 12)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.flame_fps);
+	    if (Options.flame_fps < 0) Options.flame_fps = 0;
+	    if (Options.flame_fps > 1000) Options.flame_fps = 1000;
+	} else if (!strncmp(argv[i],"--pack=", 7)) {
+	    Options.pack_file = strchr(argv[i],'=')+1;
+	} else if (!strcmp(argv[i],"--no-pack")) {
+	    Options.pack_file = NULL;
 	} else if (!strncmp(argv[i],"-r=", 3) || !strncmp(argv[i],"--repeat=", 8)) {
 	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.key_repeat_delay);
 	    if (Options.key_repeat_delay < 1) Options.key_repeat_delay = 1;
 	    if (Options.key_repeat_delay > 32) Options.key_repeat_delay = 32;
+	} else if (!strcmp(argv[i],"--netstats")) {
+	    Options.net_overlay = TRUE;
+	} else if (!strncmp(argv[i],"--netstats=", 11)) {
+	    Options.net_overlay = TRUE;
+	    Options.net_stats_file = strchr(argv[i],'=')+1;
+	} else if (!strcmp(argv[i],"--profile")) {
+	    Options.profile = TRUE;
+	} else if (!strncmp(argv[i],"--profile=", 10)) {
+	    Options.profile = TRUE;
+	    Options.profile_file = strchr(argv[i],'=')+1;
+	} else if (!strncmp(argv[i],"--port=", 7)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.net_port);
+	} else if (!strcmp(argv[i],"--net-server")) {
+	    Options.net_unattended = TRUE;
+	    Options.net_host = NULL;
+	} else if (!strncmp(argv[i],"--net-client=", 13)) {
+	    Options.net_unattended = TRUE;
+	    Options.net_host = strchr(argv[i],'=')+1;
+	} else if (!strncmp(argv[i],"--net-ai=", 9)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.net_ai);
+	} else if (!strncmp(argv[i],"--matches=", 10)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.net_matches);
+	} else if (!strcmp(argv[i],"--video=sdl")) {
+	    Options.video = VIDEO_SDL;
+	} else if (!strcmp(argv[i],"--video=offscreen")) {
+	    Options.video = VIDEO_OFFSCREEN;
+	} else if (!strcmp(argv[i],"--video=null")) {
+	    Options.video = VIDEO_NULL;
+	} else if (!strncmp(argv[i],"--batch=", 8)) {
+	    sscanf(strchr(argv[i],'=')+1,"%d",&Options.batch_matches);
 	} else {
 	    Debug("option not understood: [%s]\n",argv[i]);
 	    usage();
@@ -412,6 +497,8 @@ play_AI_VS_AI(color_styles cs, piece_styles ps, sound_styles ss,
     time_t our_time;
     int p1_results[3] = {0, 0, 0};
     int p2_results[3] = {0, 0, 0};
+    int games = 0;
+    Uint32 began;
 
     my_adj[0] = -1; my_adj[1] = -1; my_adj[2] = -1;
     their_adj[0] = -1; their_adj[1] = -1; their_adj[2] = -1; 
@@ -446,6 +533,7 @@ play_AI_VS_AI(color_styles cs, piece_styles ps, sound_styles ss,
 	event_ss[0] = event_ss[1] = ss.style[ss.choice];
 	event_ai[0] = p1; event_ai[1] = p2;
 
+	began = SDL_GetTicks();
 	if (event_loop(screen, ps.style[ps.choice], 
 		event_cs, event_ss, g,
 		level, 0, &curtimeleft, 0, adjustment, NULL,
@@ -458,6 +546,23 @@ play_AI_VS_AI(color_styles cs, piece_styles ps, sound_styles ss,
 	if (adjustment[1] != -1) 
 	    p2_results[ adjustment[1] ] ++;
 
+	if (Options.batch_matches > 0) {
+	    games++;
+	    Debug("match=%d level=%d %s=%d/%d %s=%d/%d ms=%u\n", games,
+		    level[0], p1->name, Score[0], adjustment[0],
+		    p2->name, Score[1], adjustment[1],
+		    (unsigned) (SDL_GetTicks() - began));
+	    if (games >= Options.batch_matches) {
+		Debug("results: %s up/same/down %d/%d/%d, "
+			"%s up/same/down %d/%d/%d\n",
+			p1->name, p1_results[ADJUST_UP],
+			p1_results[ADJUST_SAME], p1_results[ADJUST_DOWN],
+			p2->name, p2_results[ADJUST_UP],
+			p2_results[ADJUST_SAME], p2_results[ADJUST_DOWN]);
+		return;
+	    }
+	}
+
 	/* show them what's what! */
 	draw_background(screen, cs.style[0]->w, g, level,
 		p1_results, p2_results, event_name);
@@ -546,10 +651,12 @@ play_SINGLE_VS_AI(color_styles cs, piece_styles ps, sound_styles ss,
  *      play_NETWORK()
  * Play the NETWORK-style game. You and someone else both have two minutes
  * per level, but the limit isn't deadly. Complex adjustment rules. :-)
+ *
+ * If "aip" is given, that AI plays for you (see --net-server).
  ***************************************************************************/
 static int
 play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
-    Grid g[2], person *p, char *hostname) 
+    Grid g[2], person *p, char *hostname, AI_Player *aip) 
 {
     int curtimeleft;
     extern char *error_msg;
@@ -562,15 +669,21 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
     char message[1024];
     char *their_name;
     int done = 0;
+    int games = 0;
     int sock;
     int their_cs_choice;
     int their_data;
     time_t our_time;
+    Uint64 seed;			/* fixed 64 bits on the wire */
+    Uint32 token;			/* lets a dropped client back in */
 
     server = (hostname == NULL);
 
-#define SEND(msg,len) {if (send(sock,(const char *)msg,len,0) < (signed)len) goto error;}
-#define RECV(msg,len) {if (recv(sock,(char *)msg,len,0) < (signed)len) goto error;}
+#define SEND(msg,len) {if (Network_Send(sock,msg,len) < (signed)len) goto error;}
+#define RECV(msg,len) {if (Network_Recv(sock,msg,len) < (signed)len) goto error;}
+    /* integers go over the wire as varints, never as raw host memory */
+#define SEND_INT(v)	{if (Network_SendInt(sock,v)) goto error;}
+#define RECV_INT(v)	{if (Network_RecvInt(sock,v)) goto error;}
 
 #define SERVER_SYNC	0x12345678
 #define CLIENT_SYNC	0x98765432
@@ -589,7 +702,7 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 		color_blue, screen->w/2, screen->h/2, DRAW_CENTER|DRAW_UPDATE);
 
 	do {
-	    sock = Server_AwaitConnection(7741);
+	    sock = Server_AwaitConnection(Options.net_port);
 	    if (sock == -1 && SDL_PollEvent(&event) && event.type == SDL_KEYDOWN)
 		if (event.key.keysym.sym == SDLK_q)
 		    goto done;
@@ -599,7 +712,7 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 	SDL_Event event;
 	sock = -1;
 	for (i=0; i<5 && sock == -1; i++) {
-	    sock = Client_Connect(hostname,7741);
+	    sock = Client_Connect(hostname,Options.net_port);
 	    if (sock == -1 && SDL_PollEvent(&event) && event.type == SDL_KEYDOWN && 
 		 event.key.keysym.sym == SDLK_q)
 		goto done;
@@ -611,53 +724,67 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
     clear_screen_to_flame();
 
     /* consistency checks: same number of colors */
-    SEND(&cs.style[cs.choice]->num_color, sizeof(int));
-    RECV(&their_data, sizeof(int));
+    SEND_INT(cs.style[cs.choice]->num_color);
+    RECV_INT(&their_data);
     if (their_data != cs.style[cs.choice]->num_color) {
 	SPRINTF(message,"The # of colors in your styles are not equal. (%d/%d)",
 		cs.style[cs.choice]->num_color, their_data);
 	goto known_error;
     }
 
-    SEND(&ps.style[ps.choice]->num_piece, sizeof(int));
-    RECV(&their_data, sizeof(int));
+    SEND_INT(ps.style[ps.choice]->num_piece);
+    RECV_INT(&their_data);
     if (their_data != ps.style[ps.choice]->num_piece) {
 	SPRINTF(message,"The # of shapes in your styles are not equal. (%d/%d)",
 		ps.style[ps.choice]->num_piece, their_data);
 	goto known_error;
     }
 
-    SEND(&Options.special_wanted, sizeof(int));
-    RECV(&their_data, sizeof(int));
+    SEND_INT(Options.special_wanted);
+    RECV_INT(&their_data);
     if (their_data != Options.special_wanted) {
 	SPRINTF(message,"You must both agree on whether to use Power Pieces");
 	goto known_error;
     }
 
-    SEND(&Options.faster_levels, sizeof(int));
-    RECV(&their_data, sizeof(int));
-    if (their_data != Options.special_wanted) {
+    SEND_INT(Options.faster_levels);
+    RECV_INT(&their_data);
+    if (their_data != Options.faster_levels) {
 	SPRINTF(message,"You must both agree on Double Difficulty");
 	goto known_error;
     }
 
     /* initial levels */
-    SEND(&level[0],sizeof(level[0]));
-    SEND(&cs.choice,sizeof(cs.choice));
+    SEND_INT(level[0]);
+    SEND_INT(cs.choice);
     match = strlen(p->name);
-    SEND(&match, sizeof(match));
+    SEND_INT(match);
     SEND(p->name,strlen(p->name));
 
-    RECV(&level[1],sizeof(level[1]));
-    Assert(sizeof(their_cs_choice) == sizeof(cs.choice));
-    RECV(&their_cs_choice,sizeof(cs.choice));
+    RECV_INT(&level[1]);
+    RECV_INT(&their_cs_choice);
     if (their_cs_choice < 0 || their_cs_choice >= cs.num_style) {
 	their_cs_choice = cs.choice;
     }
-    RECV(&match,sizeof(match));
-    Calloc(their_name, char *, match);
+    RECV_INT(&match);
+    if (match < 0 || match > 1024) {
+	SPRINTF(message,"Network Error: bad name length (%d)", match);
+	goto known_error;
+    }
+    Calloc(their_name, char *, match + 1);
     RECV(their_name, match);
 
+    /* the server hands out a session token so that the client can get
+     * back into this match if the connection drops */
+    if (server) {
+	time(&our_time);
+	token = (Uint32) our_time ^ (SDL_GetTicks() << 16) ^ (Uint32) getpid();
+	if (Network_SendU32(sock, token)) goto error;
+    } else {
+	if (Network_RecvU32(sock, &token)) goto error;
+    }
+    Network_SessionBegin(sock, server, hostname, Options.net_port, token);
+
     my_adj[0] = my_adj[1] = my_adj[2] = -1;
     their_adj[0] = their_adj[1] = their_adj[2] = -1;
     match = 0;
@@ -667,16 +794,18 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 	/* pass the seed */
 	if (server) {
 	    time(&our_time);
-	    SEND(&our_time,sizeof(our_time));
+	    seed = (Sint64) our_time;
+	    if (Network_SendU64(sock, seed)) goto error;
 	} else {
-	    RECV(&our_time,sizeof(our_time));
+	    if (Network_RecvU64(sock, &seed)) goto error;
 	}
-	/* make the boards */
-	SeedRandom(our_time);
+	/* make the boards: only the low 32 bits matter, and they are the
+	 * same whatever size time_t is on either side */
+	SeedRandom((Uint32) seed);
 	g[0] = generate_board(10,20,level[0]);
-	SeedRandom(our_time);
+	SeedRandom((Uint32) seed);
 	g[1] = generate_board(10,20,level[1]);
-	SeedRandom(our_time);
+	SeedRandom((Uint32) seed);
 
 	event_name[0] = p->name;
 	event_name[1] = their_name;
@@ -691,13 +820,22 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 	event_cs[0] = cs.style[cs.choice];
 	event_cs[1] = cs.style[their_cs_choice];
 	event_ss[0] = event_ss[1] = ss.style[ss.choice];
+	event_ai[0] = aip;
 
 	event_loop(screen, ps.style[ps.choice], 
 		event_cs, event_ss, g,
 		level, sock, &curtimeleft, 0, adjustment, NULL,
-		our_time, HUMAN_PLAYER, NETWORK_PLAYER, NULL);
-	SEND(&Score[0],sizeof(Score[0]));
-	RECV(&Score[1],sizeof(Score[1]));
+		(Uint32) seed, aip ? AI_PLAYER : HUMAN_PLAYER, 
+		NETWORK_PLAYER, event_ai);
+	Network_StatsDump(Options.net_stats_file, games++);
+	/* we may have had to reconnect during the match */
+	sock = Network_SessionSocket();
+	if (!sock) {
+	    error_msg = "the other player has left";
+	    goto error;
+	}
+	SEND_INT(Score[0]);
+	RECV_INT(&Score[1]);
 	draw_background(screen, cs.style[0]->w,g,level,my_adj,their_adj,
 		event_name);
 	draw_score(screen,0);
@@ -709,22 +847,22 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 
 	/* verify that our hearts are in the right place */
 	if (server) {
-	    unsigned int msg = SERVER_SYNC;
-	    SEND(&msg,sizeof(msg));
-	    RECV(&msg,sizeof(msg));
+	    Uint32 msg = SERVER_SYNC;
+	    if (Network_SendU32(sock, msg)) goto error;
+	    if (Network_RecvU32(sock, &msg)) goto error;
 	    if (msg != CLIENT_SYNC) {
 		give_notice("Network Error: Syncronization Failed", 0);
 		goto done;
 	    }
 	} else {
-	    unsigned int msg;
-	    RECV(&msg,sizeof(msg));
+	    Uint32 msg;
+	    if (Network_RecvU32(sock, &msg)) goto error;
 	    if (msg != SERVER_SYNC) {
 		give_notice("Network Error: Syncronization Failed", 1);
 		goto done;
 	    }
 	    msg = CLIENT_SYNC;
-	    SEND(&msg,sizeof(msg));
+	    if (Network_SendU32(sock, msg)) goto error;
 	}
 	/* OK, we believe we are both dancing on the beat ... */
 	/* don't even talk to me about three-way handshakes ... */
@@ -735,20 +873,24 @@ play_NETWORK(color_styles cs, piece_styles ps, sound_styles ss,
 	draw_score(screen,0);
 	draw_score(screen,1);
 	if (server) {
-	    done = give_notice(NULL, 1);
-	    SEND(&done,sizeof(done));
+	    if (Options.net_matches > 0) 
+		done = (games >= Options.net_matches);
+	    else
+		done = give_notice(NULL, 1);
+	    SEND_INT(done);
 	} else {
 	    SDL_Event event;
 	    draw_string("Waiting for the", color_blue, 0, 0,
 		    DRAW_CENTER|DRAW_ABOVE |DRAW_UPDATE|DRAW_GRID_0);
 	    draw_string("Server to go on.", color_blue, 0, 0, DRAW_CENTER
 		    |DRAW_UPDATE|DRAW_GRID_0);
-	    RECV(&done,sizeof(done));
+	    RECV_INT(&done);
 	    while (SDL_PollEvent(&event))
 		/* do nothing */ ;
 	}
 	clear_screen_to_flame();
     } /* end: while !done */
+    Network_SessionEnd();
     close(sock);
     return level[0];
 
@@ -762,7 +904,9 @@ known_error:
     clear_screen_to_flame();
     give_notice(message, 0);
 done: 
-    close(sock);
+    Network_SessionEnd();
+    if (sock > 0) 
+	close(sock);
     return level[0];
 }
 
@@ -919,6 +1063,8 @@ main(int argc, char *argv[])
     Grid g[2];
     int renderstyle = TTF_STYLE_NORMAL;
     unsigned int flags;
+    int bpp, w, h;
+    char driver[32];
     Uint32 time_now;
     SDL_Event event;
 
@@ -937,6 +1083,10 @@ main(int argc, char *argv[])
 #endif
     parse_options(argc, argv);
 
+    /* SDL's "dummy" video driver gives us a plain memory surface */
+    if (Options.video != VIDEO_SDL)
+	SDL_putenv("SDL_VIDEODRIVER=dummy");
+
     if (SDL_Init(SDL_INIT_VIDEO)) 
 	PANIC("SDL_Init failed!");
 
@@ -946,7 +1096,8 @@ main(int argc, char *argv[])
     if ( TTF_Init() < 0 ) PANIC("TTF_Init failed!"); atexit(TTF_Quit);
     Debug("SDL initialized.\n");
 
-    /* Initialize the display in a 640x480 native-depth mode */
+    /* Initialize the display in a native-depth mode: 640x480 unless they
+     * asked for something else, in which case we scale up to it */
     flags = // SDL_HWSURFACE |  
             SDL_SWSURFACE | 
             // SDL_FULLSCREEN | 
@@ -954,8 +1105,15 @@ main(int argc, char *argv[])
             // SDL_ANYFORMAT |
             0; 
     if (Options.full_screen) flags |= SDL_FULLSCREEN;
-    screen = SDL_SetVideoMode(640, 480, Options.bpp_wanted, flags);
-    if ( screen == NULL ) PANIC("Could not set 640x480 video mode");
+    bpp = Options.bpp_wanted;
+    /* the dummy driver would default to 8 bpp, which we cannot use */
+    if (!bpp && SDL_VideoDriverName(driver, sizeof(driver)) &&
+	    !strcmp(driver, "dummy"))
+	bpp = 32;
+    w = Options.display_w ? Options.display_w : LOGICAL_W;
+    h = Options.display_h ? Options.display_h : LOGICAL_H;
+    screen = SDL_SetVideoMode(w, h, bpp, flags);
+    if ( screen == NULL ) PANIC("Could not set %dx%d video mode", w, h);
     Debug("Video Mode: %d x %d @ %d bpp\n",
 	    screen->w, screen->h, screen->format->BitsPerPixel);
 
@@ -968,8 +1126,17 @@ main(int argc, char *argv[])
 
     Network_Init();
 
+    screen = setup_presentation(screen, Options.smooth_scaling);
     setup_colors(screen);
     setup_layers(screen);
+
+    if (Options.video == VIDEO_NULL) {
+	/* every blit and fill is clipped away before SDL touches a pixel */
+	SDL_Rect nowhere = { 0, 0, 0, 0 };
+	SDL_SetClipRect(screen, &nowhere);
+	SDL_SetClipRect(widget_layer, &nowhere);
+	SDL_SetClipRect(flame_layer, &nowhere);
+    }
     
     if (chdir(ATRIS_LIBDIR)) {
 	Debug("WARNING: cannot change directory to [%s]\n", ATRIS_LIBDIR);
@@ -977,11 +1144,15 @@ main(int argc, char *argv[])
     } else 
 	Debug("Changing directory to [%s]\n",ATRIS_LIBDIR);
 
+    /* one file (if we have it) instead of dozens */
+    if (Options.pack_file)
+	pack_open(Options.pack_file);
+
     /* Set up the font */
-    sfont = TTF_OpenFont("graphics/SquarishSans.ttf",16);
-     font = TTF_OpenFont("graphics/SquarishSans.ttf",20);
-    lfont = TTF_OpenFont("graphics/SquarishSans.ttf",32);
-    hfont = TTF_OpenFont("graphics/SquarishSans.ttf",72);
+    sfont = TTF_OpenFontRW(pack_RWops("graphics/SquarishSans.ttf"),1,16);
+     font = TTF_OpenFontRW(pack_RWops("graphics/SquarishSans.ttf"),1,20);
+    lfont = TTF_OpenFontRW(pack_RWops("graphics/SquarishSans.ttf"),1,32);
+    hfont = TTF_OpenFontRW(pack_RWops("graphics/SquarishSans.ttf"),1,72);
     if ( font == NULL ) PANIC("Couldn't open [graphics/FreeSans.ttf].", ""); 
     TTF_SetFontStyle(font, renderstyle);
     TTF_SetFontStyle(sfont, renderstyle);
@@ -1009,6 +1180,32 @@ main(int argc, char *argv[])
 
     atris_xflame_setup();
 
+    if (Options.net_unattended) {
+	/* no menus, no splash screen: just play the network game and
+	 * leave the preference file alone */
+	person robot;
+
+	if (Options.net_ai < 0 || Options.net_ai >= ai->n)
+	    Options.net_ai = 0;
+	if (Options.net_matches <= 0)
+	    Options.net_matches = 3;
+	robot.name = ai->player[Options.net_ai].name;
+	robot.level = 2;
+	gametype = NETWORK;
+	play_NETWORK(cs,ps,ss,g,&robot,Options.net_host,
+		&ai->player[Options.net_ai]);
+	Network_Quit();
+	return 0;
+    }
+
+    if (Options.batch_matches > 0) {
+	/* the first two computer players fight it out, nobody watching */
+	gametype = AI_VS_AI;
+	play_AI_VS_AI(cs,ps,ss,g,&ai->player[0],&ai->player[ai->n > 1]);
+	Network_Quit();
+	return 0;
+    }
+
     /* our happy splash screen */
     { 
 	while (SDL_PollEvent(&event))
@@ -1103,7 +1300,8 @@ main(int argc, char *argv[])
 		if (p1 < 0) break;
 
 		id->p[p1].level = 
-		    play_NETWORK(cs,ps,ss,g,&id->p[p1],network_choice(screen));
+		    play_NETWORK(cs,ps,ss,g,&id->p[p1],network_choice(screen),
+			    NULL);
 		clear_screen_to_flame();
 		break;
 	    default:
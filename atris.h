@@ -87,6 +87,8 @@ void Panic(const char *func, const char *file, char *fmt, ...) __attribute__ ((n
 #define Calloc(ptr,cast,size) {if(!(ptr=(cast)calloc(size,1)))PANIC("Out of Memory:\n\tcannot callocate %d bytes for "#ptr,size);}
 #define Realloc(ptr,cast,size) {if(!(ptr=(cast)realloc(ptr,size)))PANIC("Out of Memory:\n\tcannot reallocate %d bytes for "#ptr,size);}
 #define Free(ptr)       {free(ptr);ptr=NULL;}
+/* strdup() is not in the C99/POSIX.2 headers we compile against */
+#define Strdup(ptr,str) {Malloc(ptr,char *,strlen(str)+1);strcpy(ptr,str);}
 #ifdef __STRING
 #define Assert(cond)    {if(!(cond))PANIC("Failed assertion \"%s\" on line %d",__STRING(cond),__LINE__);}
 #else
@@ -95,6 +97,15 @@ void Panic(const char *func, const char *file, char *fmt, ...) __attribute__ ((n
 
 extern void SeedRandom(Uint32 Seed);
 extern Uint16 FastRandom(Uint16 range);
+/* in display.c: SDL_UpdateRects(), or batched up during a match */
+extern void atris_update_rects(SDL_Surface *surface, int n, SDL_Rect *rects);
+/* in display.c: from where the mouse is on the display to the screen */
+extern void logical_position(Uint16 *x, Uint16 *y);
+
+/* The game is laid out for (and always draws into) a screen this big. If
+ * the display is bigger the screen is scaled up when it is presented. */
+#define LOGICAL_W	640
+#define LOGICAL_H	480
 
 
 /*
@@ -106,13 +117,13 @@ extern Uint16 FastRandom(Uint16 range);
     if (my_b) { \
 	if (my_b->x < 0) my_b->x = 0; \
 	if (my_b->y < 0) my_b->y = 0; \
-	if (my_b->x + my_b->w > 640) my_b->w = 640-my_b->x; \
-	if (my_b->y + my_b->h > 480) my_b->h = 480-my_b->y; \
+	if (my_b->x + my_b->w > LOGICAL_W) my_b->w = LOGICAL_W-my_b->x; \
+	if (my_b->y + my_b->h > LOGICAL_H) my_b->h = LOGICAL_H-my_b->y; \
     } if (my_d) { \
 	if (my_d->x < 0) my_d->x = 0; \
 	if (my_d->y < 0) my_d->y = 0; \
-	if (my_d->x + my_d->w > 640) my_d->w = 640-my_d->x; \
-	if (my_d->y + my_d->h > 480) my_d->h = 480-my_d->y; \
+	if (my_d->x + my_d->w > LOGICAL_W) my_d->w = LOGICAL_W-my_d->x; \
+	if (my_d->y + my_d->h > LOGICAL_H) my_d->h = LOGICAL_H-my_d->y; \
     } \
     Assert(SDL_BlitSurface(a,my_b,c,my_d) == 0); }
 #define SDL_UpdateSafe(a,b,c) { SDL_Rect *my_c = c; \
@@ -120,10 +131,10 @@ extern Uint16 FastRandom(Uint16 range);
     if (my_c) { \
 	if (my_c->x < 0) my_c->x = 0; \
 	if (my_c->y < 0) my_c->y = 0; \
-	if (my_c->x + my_c->w > 640) my_c->w = 640-my_c->x; \
-	if (my_c->y + my_c->h > 480) my_c->h = 480-my_c->y; \
+	if (my_c->x + my_c->w > LOGICAL_W) my_c->w = LOGICAL_W-my_c->x; \
+	if (my_c->y + my_c->h > LOGICAL_H) my_c->h = LOGICAL_H-my_c->y; \
     } \
-    SDL_UpdateRects(a,b,c); }
+    atris_update_rects(a,b,c); }
 
 #define ADJUST_UP	0
 #define ADJUST_SAME	1
@@ -0,0 +1,361 @@
+/*
+ *                               Alizarin Tetris
+ * The asset packer: compiles the styles/ and graphics/ trees (and sounds/,
+ * if you have atris-sounds) into one asset pack for atris to map at
+ * startup (see pack.h). BMPs are decoded to 32-bit pixels and WAVs to PCM
+ * in the format atris asks the sound card for, so that the game has
+ * nothing left to parse.
+ *
+ * Run it from the directory that holds styles/ and graphics/; the names
+ * in the pack are the ones atris uses ("graphics/A.bmp").
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+/* for strdup() */
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"	/* go autoconf! */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* configure magic for dirent */
+#if HAVE_DIRENT_H
+# include <dirent.h>
+#else
+# define dirent direct
+# if HAVE_SYS_NDIR_H
+#  include <sys/ndir.h>
+# endif
+# if HAVE_SYS_DIR_H
+#  include <sys/dir.h>
+# endif
+# if HAVE_NDIR_H
+#  include <ndir.h>
+# endif
+#endif
+
+#include <SDL/SDL.h>
+
+#include "sound.h"
+#include "pack.h"
+
+typedef struct item_struct {
+    char	*name;
+    pack_entry	e;		/* offsets are filled in at the end */
+    Uint8	*data;
+} item;
+
+static struct {
+    char	*output;
+    int		verbose;
+    item	*item;
+    int		count;
+    int		room;
+    long	raw;		/* bytes read from the files */
+} Pack;
+
+/***************************************************************************
+ *      usage()
+ ***************************************************************************/
+static void
+usage(void)
+{
+    printf("\n\t\tatrispack -- asset packer for atris\n"
+	   "Usage: atrispack [options] [DIR ...]\n"
+	   "\t--output=FILE\t\tWrite the pack here (default atris.pack).\n"
+	   "\t--verbose\t\tList everything as it goes in.\n"
+	   "\nThe directories default to styles, graphics and sounds (those\n"
+	   "that exist). Put the pack where atris looks for its styles.\n");
+    exit(1);
+}
+
+/***************************************************************************
+ *      fail()
+ * Gives up on the whole pack.
+ ***************************************************************************/
+static void
+fail(const char *what, const char *name, const char *why)
+{
+    fprintf(stderr, "atrispack: %s [%s]: %s\n", what, name, why);
+    exit(1);
+}
+
+/***************************************************************************
+ *      new_item()
+ * Makes room for one more thing in the pack.
+ ***************************************************************************/
+static item *
+new_item(const char *name, int type)
+{
+    item *it;
+
+    if (Pack.count == Pack.room) {
+	Pack.room = Pack.room ? Pack.room * 2 : 64;
+	Pack.item = realloc(Pack.item, Pack.room * sizeof(item));
+	if (!Pack.item) { perror("realloc"); exit(1); }
+    }
+    it = &Pack.item[Pack.count++];
+    memset(it, 0, sizeof(*it));
+    it->name = strdup(name);
+    it->e.type = type;
+    return it;
+}
+
+/***************************************************************************
+ *      add_file()
+ * Stores a file as it is.
+ ***************************************************************************/
+static void
+add_file(const char *name, long size)
+{
+    item *it = new_item(name, PACK_FILE);
+    FILE *fin = fopen(name, "rb");
+
+    if (!fin)
+	fail("cannot open", name, strerror(errno));
+    it->data = malloc(size ? size : 1);
+    if (!it->data) { perror("malloc"); exit(1); }
+    if ((long) fread(it->data, 1, size, fin) != size)
+	fail("cannot read", name, strerror(errno));
+    fclose(fin);
+    it->e.len = size;
+}
+
+/***************************************************************************
+ *      add_image()
+ * Decodes a BMP to 32-bit pixels, whatever it was on disk.
+ ***************************************************************************/
+static void
+add_image(const char *name)
+{
+    SDL_Surface *bmp = SDL_LoadBMP(name), *rgb;
+    item *it;
+    int y;
+
+    if (!bmp)
+	fail("cannot load", name, SDL_GetError());
+    rgb = SDL_CreateRGBSurface(SDL_SWSURFACE, bmp->w, bmp->h, 32,
+	    PACK_RMASK, PACK_GMASK, PACK_BMASK, 0);
+    if (!rgb || SDL_BlitSurface(bmp, NULL, rgb, NULL) < 0)
+	fail("cannot convert", name, SDL_GetError());
+
+    it = new_item(name, PACK_IMAGE);
+    it->e.u.image.w = rgb->w;
+    it->e.u.image.h = rgb->h;
+    it->e.u.image.pitch = rgb->w * 4;
+    it->e.len = it->e.u.image.pitch * rgb->h;
+    it->data = malloc(it->e.len);
+    if (!it->data) { perror("malloc"); exit(1); }
+    SDL_LockSurface(rgb);
+    for (y = 0; y < rgb->h; y++)
+	memcpy(it->data + y * it->e.u.image.pitch,
+		(Uint8 *) rgb->pixels + y * rgb->pitch,
+		it->e.u.image.pitch);
+    SDL_UnlockSurface(rgb);
+    SDL_FreeSurface(rgb);
+    SDL_FreeSurface(bmp);
+}
+
+/***************************************************************************
+ *      add_sound()
+ * Decodes a WAV to PCM in SOUND_FORMAT at SOUND_FREQ.
+ ***************************************************************************/
+static void
+add_sound(const char *name)
+{
+    SDL_AudioSpec spec;
+    SDL_AudioCVT cvt;
+    Uint8 *buf;
+    Uint32 len, frame = (SOUND_FORMAT & 0xff) / 8 * SOUND_CHANNELS;
+    item *it;
+
+    if (!SDL_LoadWAV(name, &spec, &buf, &len))
+	fail("cannot load", name, SDL_GetError());
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+		SOUND_FORMAT, SOUND_CHANNELS, SOUND_FREQ) < 0)
+	fail("cannot convert", name, SDL_GetError());
+
+    it = new_item(name, PACK_SOUND);
+    it->e.u.sound.freq = SOUND_FREQ;
+    it->e.u.sound.format = SOUND_FORMAT;
+    it->e.u.sound.channels = SOUND_CHANNELS;
+    cvt.len = len;
+    cvt.buf = malloc(len * (cvt.len_mult > 1 ? cvt.len_mult : 1) + 1);
+    if (!cvt.buf) { perror("malloc"); exit(1); }
+    memcpy(cvt.buf, buf, len);
+    SDL_FreeWAV(buf);
+    if (cvt.needed) {
+	if (SDL_ConvertAudio(&cvt) < 0)
+	    fail("cannot convert", name, SDL_GetError());
+	len = cvt.len_cvt;
+    }
+    it->data = cvt.buf;
+    it->e.len = len - len % frame;	/* whole sample frames only */
+}
+
+/***************************************************************************
+ *      add_dir()
+ * Adds everything under "dir" to the pack.
+ ***************************************************************************/
+static void
+add_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *f;
+
+    if (!d)
+	fail("cannot read directory", dir, strerror(errno));
+    while ((f = readdir(d))) {
+	char name[1024];
+	struct stat st;
+	const char *dot;
+
+	if (f->d_name[0] == '.' || !strncmp(f->d_name, "Makefile", 8))
+	    continue;
+	snprintf(name, sizeof(name), "%s/%s", dir, f->d_name);
+	if (stat(name, &st))
+	    fail("cannot stat", name, strerror(errno));
+	if (S_ISDIR(st.st_mode)) {
+	    add_dir(name);
+	    continue;
+	}
+	if (!S_ISREG(st.st_mode))
+	    continue;
+	Pack.raw += st.st_size;
+	dot = strrchr(f->d_name, '.');
+	if (dot && !strcasecmp(dot, ".bmp"))
+	    add_image(name);
+	else if (dot && !strcasecmp(dot, ".wav"))
+	    add_sound(name);
+	else
+	    add_file(name, st.st_size);
+	/* so that atris can tell if the file has changed since */
+	Pack.item[Pack.count-1].e.mtime = st.st_mtime;
+	Pack.item[Pack.count-1].e.src_len = st.st_size;
+	if (Pack.verbose)
+	    printf("%-40s %s, %d bytes\n", name,
+		    Pack.item[Pack.count-1].e.type == PACK_IMAGE ? "image" :
+		    Pack.item[Pack.count-1].e.type == PACK_SOUND ? "sound" :
+		    "file", (int) Pack.item[Pack.count-1].e.len);
+    }
+    closedir(d);
+}
+
+/***************************************************************************
+ *      by_name()
+ * For qsort(): the game finds things by a binary search on their names.
+ ***************************************************************************/
+static int
+by_name(const void *a, const void *b)
+{
+    return strcmp(((const item *) a)->name, ((const item *) b)->name);
+}
+
+/***************************************************************************
+ *      write_pack()
+ * Lays out and writes the pack: header, index, names, then the data, each
+ * piece PACK_ALIGN aligned.
+ ***************************************************************************/
+static void
+write_pack(void)
+{
+    static const Uint8 zero[PACK_ALIGN];
+    pack_header h;
+    Uint32 at;
+    char tmp[1024];
+    FILE *fout;
+    int i;
+
+#define ALIGN(x)	(((x) + PACK_ALIGN - 1) & ~(Uint32) (PACK_ALIGN - 1))
+    qsort(Pack.item, Pack.count, sizeof(item), by_name);
+    for (i = 1; i < Pack.count; i++)
+	if (!strcmp(Pack.item[i-1].name, Pack.item[i].name))
+	    fail("packed twice", Pack.item[i].name, "list each directory once");
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, PACK_MAGIC, 8);
+    h.version = PACK_VERSION;
+    h.byte_order = PACK_BYTE_ORDER;
+    h.count = Pack.count;
+    h.index = ALIGN(sizeof(h));
+    at = h.index + Pack.count * sizeof(pack_entry);
+    for (i = 0; i < Pack.count; i++) {
+	Pack.item[i].e.name = at;
+	at += strlen(Pack.item[i].name) + 1;
+    }
+    for (i = 0; i < Pack.count; i++) {
+	at = ALIGN(at);
+	Pack.item[i].e.data = at;
+	at += Pack.item[i].e.len;
+    }
+    h.size = at;
+
+    /* never leave half a pack where atris would find it */
+    snprintf(tmp, sizeof(tmp), "%s.tmp", Pack.output);
+    fout = fopen(tmp, "wb");
+    if (!fout)
+	fail("cannot write", tmp, strerror(errno));
+    fwrite(&h, sizeof(h), 1, fout);
+    fwrite(zero, h.index - sizeof(h), 1, fout);
+    for (i = 0; i < Pack.count; i++)
+	fwrite(&Pack.item[i].e, sizeof(pack_entry), 1, fout);
+    for (i = 0; i < Pack.count; i++)
+	fwrite(Pack.item[i].name, strlen(Pack.item[i].name) + 1, 1, fout);
+    for (i = 0; i < Pack.count; i++) {
+	long pad = Pack.item[i].e.data - ftell(fout);
+	fwrite(zero, pad, 1, fout);
+	fwrite(Pack.item[i].data, Pack.item[i].e.len, 1, fout);
+    }
+    if (ferror(fout) | fclose(fout))
+	fail("cannot write", tmp, strerror(errno));
+    if (rename(tmp, Pack.output))
+	fail("cannot rename to", Pack.output, strerror(errno));
+#undef ALIGN
+}
+
+/***************************************************************************
+ *      main()
+ ***************************************************************************/
+int
+main(int argc, char *argv[])
+{
+    struct stat st;
+    int i, dirs = 0;
+
+    Pack.output = "atris.pack";
+    for (i=1; i<argc; i++) {
+	if (!strncmp(argv[i], "--output=", 9))
+	    Pack.output = argv[i] + 9;
+	else if (!strcmp(argv[i], "--verbose"))
+	    Pack.verbose = 1;
+	else if (argv[i][0] == '-')
+	    usage();
+	else {
+	    add_dir(argv[i]);
+	    dirs++;
+	}
+    }
+    if (!dirs) {
+	static char *fallback[] = { "styles", "graphics", "sounds" };
+	for (i = 0; i < 3; i++)
+	    if (!stat(fallback[i], &st) && S_ISDIR(st.st_mode))
+		add_dir(fallback[i]);
+    }
+    if (!Pack.count) {
+	fprintf(stderr, "atrispack: nothing to pack\n");
+	usage();
+    }
+    write_pack();
+    stat(Pack.output, &st);
+    printf("atrispack: %d files (%ld bytes) in [%s], %ld bytes\n",
+	    Pack.count, Pack.raw, Pack.output, (long) st.st_size);
+    return 0;
+}
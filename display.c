@@ -11,6 +11,10 @@
 #include "display.h"
 #include "grid.h"
 #include "piece.h"
+#include "network.h"
+#include "options.h"
+#include "profile.h"
+#include "pack.h"
 
 #include "xflame.pro"
 
@@ -34,6 +38,9 @@ struct layout_struct {
     SDL_Rect next_piece[2];
 
     SDL_Rect 	  pause;
+
+    SDL_Rect	  net_stats;
+    SDL_Rect	  profile;
 } layout;
 
 /* The background image, global so we can do updates */
@@ -42,14 +49,477 @@ SDL_Surface *adjust_symbol[3] = { NULL, NULL, NULL };
 
 int Score[2];
 
+/* While we are batching, screen updates are only noted here and then
+ * presented all at once by atris_flush_updates(). Rectangles that touch
+ * are merged as they come in. With --refresh, presents are also held to
+ * a fixed grid of display refreshes: the first present sets the grid
+ * going and after that we wait for the next slot. */
+#define DAMAGE_MAX	64
+static struct damage_struct {
+    int		batching;
+    int		n;
+    SDL_Rect	rect[DAMAGE_MAX];
+    Uint32	epoch;		/* SDL_GetTicks() of refresh 0 */
+    Uint32	refresh;	/* the refresh we presented last */
+    Uint32	next_present;	/* SDL_GetTicks() of the one after that */
+} Damage;
+
+/***************************************************************************
+ *      touches()
+ * Returns 1 if the two rectangles overlap or share part of an edge.
+ ***************************************************************************/
+static int
+touches(SDL_Rect *a, SDL_Rect *b)
+{
+    int x_touch = a->x <= b->x + b->w && b->x <= a->x + a->w;
+    int y_touch = a->y <= b->y + b->h && b->y <= a->y + a->h;
+    int x_overlap = a->x < b->x + b->w && b->x < a->x + a->w;
+    int y_overlap = a->y < b->y + b->h && b->y < a->y + a->h;
+
+    /* corners alone don't count: their union would be mostly waste */
+    return x_touch && y_touch && (x_overlap || y_overlap);
+}
+
+/***************************************************************************
+ *      unite()
+ * Grows "a" to cover "b" as well.
+ ***************************************************************************/
+static void
+unite(SDL_Rect *a, SDL_Rect *b)
+{
+    int x2 = max(a->x + a->w, b->x + b->w);
+    int y2 = max(a->y + a->h, b->y + b->h);
+
+    a->x = min(a->x, b->x);
+    a->y = min(a->y, b->y);
+    a->w = x2 - a->x;
+    a->h = y2 - a->y;
+}
+
+/***************************************************************************
+ *      add_damage()
+ * Notes that part of the screen needs to be presented, merging it with
+ * anything it touches.
+ ***************************************************************************/
+static void
+add_damage(SDL_Rect *r)
+{
+    SDL_Rect u = *r;
+    int i = 0;
+
+    if (u.w == 0 || u.h == 0)
+	return;
+    /* what it grows into may touch rectangles we have already passed */
+    while (i < Damage.n) {
+	if (touches(&u, &Damage.rect[i])) {
+	    unite(&u, &Damage.rect[i]);
+	    Damage.rect[i] = Damage.rect[--Damage.n];
+	    i = 0;
+	} else
+	    i++;
+    }
+    if (Damage.n == DAMAGE_MAX) {
+	for (i=0; i<Damage.n; i++)
+	    unite(&u, &Damage.rect[i]);
+	Damage.n = 0;
+    }
+    Damage.rect[Damage.n++] = u;
+}
+
+/* The game always draws into a LOGICAL_W x LOGICAL_H "screen". If the real
+ * display is some other size, that screen is a back buffer and each
+ * update is scaled onto the display (see setup_presentation()). The
+ * mapping from display columns and rows back to the logical screen is
+ * worked out once, so presenting is a table walk per pixel. */
+static struct present_struct {
+    SDL_Surface	*video;		/* the real display, or "screen" itself */
+    SDL_Rect	area;		/* where the logical screen ends up on it */
+    int		smooth;		/* bilinear rather than nearest pixel */
+    int		*col;		/* logical column for each area column */
+    int		*row;		/* logical row for each area row */
+    Uint8	*col_frac;	/* bilinear weight of the next column */
+    Uint8	*row_frac;	/* bilinear weight of the next row */
+} Present;
+
+/***************************************************************************
+ *      area_span()
+ * Which area columns (or rows) [*from,*to) show logical pixels
+ * [lo,hi)? "size" is the area's width (or height), "logical" the
+ * screen's. Bilinear pixels also borrow from their neighbours.
+ ***************************************************************************/
+static void
+area_span(int lo, int hi, int size, int logical, int *from, int *to)
+{
+    if (Present.smooth) {
+	lo--;
+	hi++;
+    }
+    *from = max(0, lo * size / logical);
+    *to = min(size, (hi * size + logical - 1) / logical);
+}
+
+/***************************************************************************
+ *      scale_nearest()
+ * Presents part of the area by copying the nearest logical pixel. Area
+ * rows that show the same logical row as the one above are copied
+ * whole, so an integer scale costs one pass over each logical row.
+ ***************************************************************************/
+static void
+scale_nearest(SDL_Rect *d)
+{
+    SDL_Surface *v = Present.video;
+    int bpp = screen->format->BytesPerPixel;
+    int x, y;
+
+    for (y = d->y; y < d->y + d->h; y++) {
+	Uint8 *dst = (Uint8 *)v->pixels +
+	    (Present.area.y + y) * v->pitch + (Present.area.x + d->x) * bpp;
+	Uint8 *src = (Uint8 *)screen->pixels + Present.row[y] * screen->pitch;
+
+	if (y > d->y && Present.row[y] == Present.row[y-1]) {
+	    memcpy(dst, dst - v->pitch, d->w * bpp);
+	    continue;
+	}
+	switch (bpp) {
+	    case 2:
+		for (x = d->x; x < d->x + d->w; x++, dst += 2)
+		    *(Uint16 *)dst = ((Uint16 *)src)[Present.col[x]];
+		break;
+	    case 4:
+		for (x = d->x; x < d->x + d->w; x++, dst += 4)
+		    *(Uint32 *)dst = ((Uint32 *)src)[Present.col[x]];
+		break;
+	    default:
+		for (x = d->x; x < d->x + d->w; x++, dst += bpp)
+		    memcpy(dst, src + Present.col[x] * bpp, bpp);
+		break;
+	}
+    }
+}
+
+/***************************************************************************
+ *      blend()
+ * Mixes two 32-bit pixels, "f" 256ths of the way from "a" to "b". The
+ * four 8-bit channels are done two at a time.
+ ***************************************************************************/
+static Uint32
+blend(Uint32 a, Uint32 b, int f)
+{
+    Uint32 rb = a & 0x00ff00ff, ga = (a >> 8) & 0x00ff00ff;
+
+    rb = (rb + ((((b & 0x00ff00ff) - rb) * f) >> 8)) & 0x00ff00ff;
+    ga = (ga + (((((b >> 8) & 0x00ff00ff) - ga) * f) >> 8)) & 0x00ff00ff;
+    return rb | (ga << 8);
+}
+
+/***************************************************************************
+ *      scale_smooth()
+ * Presents part of the area by bilinear filtering. 32 bpp only.
+ ***************************************************************************/
+static void
+scale_smooth(SDL_Rect *d)
+{
+    SDL_Surface *v = Present.video;
+    int x, y;
+
+    for (y = d->y; y < d->y + d->h; y++) {
+	Uint32 *dst = (Uint32 *)((Uint8 *)v->pixels +
+	    (Present.area.y + y) * v->pitch) + Present.area.x + d->x;
+	Uint32 *top = (Uint32 *)((Uint8 *)screen->pixels +
+		Present.row[y] * screen->pitch);
+	Uint32 *bot = (Uint32 *)((Uint8 *)top +
+		(Present.row[y] < screen->h - 1 ? screen->pitch : 0));
+	int fy = Present.row_frac[y];
+
+	for (x = d->x; x < d->x + d->w; x++) {
+	    int c = Present.col[x];
+	    int c1 = c < screen->w - 1 ? c + 1 : c;
+	    int fx = Present.col_frac[x];
+
+	    *dst++ = blend(blend(top[c], top[c1], fx),
+		    blend(bot[c], bot[c1], fx), fy);
+	}
+    }
+}
+
+/***************************************************************************
+ *      present()
+ * Scales the given parts of the logical screen onto the display and
+ * updates them there.
+ ***************************************************************************/
+static void
+present(int n, SDL_Rect *rects)
+{
+    SDL_Rect out[DAMAGE_MAX];
+    int i, m = 0, x0, x1, y0, y1;
+
+    if (SDL_MUSTLOCK(Present.video) && SDL_LockSurface(Present.video) < 0)
+	return;
+    for (i=0; i<n; i++) {
+	area_span(rects[i].x, rects[i].x + rects[i].w,
+		Present.area.w, screen->w, &x0, &x1);
+	area_span(rects[i].y, rects[i].y + rects[i].h,
+		Present.area.h, screen->h, &y0, &y1);
+	if (x1 <= x0 || y1 <= y0)
+	    continue;
+	out[m].x = x0; out[m].y = y0;
+	out[m].w = x1 - x0; out[m].h = y1 - y0;
+	if (Present.smooth)
+	    scale_smooth(&out[m]);
+	else
+	    scale_nearest(&out[m]);
+	out[m].x += Present.area.x;
+	out[m].y += Present.area.y;
+	if (++m == DAMAGE_MAX) {
+	    SDL_UpdateRects(Present.video, m, out);
+	    m = 0;
+	}
+    }
+    if (SDL_MUSTLOCK(Present.video))
+	SDL_UnlockSurface(Present.video);
+    if (m)
+	SDL_UpdateRects(Present.video, m, out);
+}
+
+/***************************************************************************
+ *      show()
+ * Updates the given parts of the screen on the real display.
+ ***************************************************************************/
+static void
+show(int n, SDL_Rect *rects)
+{
+    if (Present.video && Present.video != screen)
+	present(n, rects);
+    else
+	SDL_UpdateRects(screen, n, rects);
+}
+
+/***************************************************************************
+ *      make_map()
+ * Fills in the logical position (and bilinear weight) for each of the
+ * "size" area columns or rows.
+ ***************************************************************************/
+static void
+make_map(int size, int logical, int **map, Uint8 **frac)
+{
+    int i;
+
+    Malloc(*map, int *, size * sizeof(**map));
+    Malloc(*frac, Uint8 *, size);
+    for (i=0; i<size; i++) {
+	if (Present.smooth) {
+	    /* sample at the centre of the area pixel, in 24.8 fixed point */
+	    int at = ((2 * i + 1) * logical * 256 / size - 256) / 2;
+
+	    if (at < 0) at = 0;
+	    (*map)[i] = at >> 8;
+	    (*frac)[i] = at & 0xff;
+	} else {
+	    (*map)[i] = i * logical / size;
+	    (*frac)[i] = 0;
+	}
+    }
+}
+
+/***************************************************************************
+ *      setup_presentation()
+ * Given the real display, returns the surface the game should draw on:
+ * the display itself if it is LOGICAL_W x LOGICAL_H, otherwise a back
+ * buffer of that size in the display's format. Nearest-pixel scaling
+ * uses the largest whole multiple that fits (if there is one); smooth
+ * scaling fills as much of the display as the aspect ratio allows.
+ *********************************************************************PROTO*/
+SDL_Surface *
+setup_presentation(SDL_Surface *video, int smooth)
+{
+    SDL_Surface *back;
+    int k;
+
+    Present.video = video;
+    if (video->w == LOGICAL_W && video->h == LOGICAL_H)
+	return video;
+
+    back = SDL_CreateRGBSurface(SDL_SWSURFACE, LOGICAL_W, LOGICAL_H,
+	    video->format->BitsPerPixel, video->format->Rmask,
+	    video->format->Gmask, video->format->Bmask, video->format->Amask);
+    if (!back)
+	PANIC("Could not create the %d x %d back buffer", LOGICAL_W, LOGICAL_H);
+
+    Present.smooth = smooth && video->format->BytesPerPixel == 4;
+    k = min(video->w / LOGICAL_W, video->h / LOGICAL_H);
+    if (!Present.smooth && k >= 1) {
+	Present.area.w = k * LOGICAL_W;
+	Present.area.h = k * LOGICAL_H;
+    } else if (video->w * LOGICAL_H > video->h * LOGICAL_W) {
+	Present.area.h = video->h;
+	Present.area.w = video->h * LOGICAL_W / LOGICAL_H;
+    } else {
+	Present.area.w = video->w;
+	Present.area.h = video->w * LOGICAL_H / LOGICAL_W;
+    }
+    Present.area.x = (video->w - Present.area.w) / 2;
+    Present.area.y = (video->h - Present.area.h) / 2;
+    make_map(Present.area.w, LOGICAL_W, &Present.col, &Present.col_frac);
+    make_map(Present.area.h, LOGICAL_H, &Present.row, &Present.row_frac);
+
+    Debug("Presenting %d x %d as %d x %d at (%d,%d)%s.\n",
+	    LOGICAL_W, LOGICAL_H, Present.area.w, Present.area.h,
+	    Present.area.x, Present.area.y, Present.smooth ? ", smoothly" : "");
+
+    /* the letterbox borders never change */
+    SDL_FillRect(video, NULL, SDL_MapRGB(video->format, 0, 0, 0));
+    SDL_UpdateRect(video, 0, 0, 0, 0);
+    return back;
+}
+
+/***************************************************************************
+ *      logical_position()
+ * Converts a position on the real display (e.g., a mouse click) to one
+ * on the logical screen.
+ ***************************************************************************/
+void
+logical_position(Uint16 *x, Uint16 *y)
+{
+    int lx, ly;
+
+    if (!Present.video || Present.video == screen)
+	return;
+    lx = ((int) *x - Present.area.x) * LOGICAL_W / Present.area.w;
+    ly = ((int) *y - Present.area.y) * LOGICAL_H / Present.area.h;
+    *x = max(0, min(LOGICAL_W - 1, lx));
+    *y = max(0, min(LOGICAL_H - 1, ly));
+}
+
+/***************************************************************************
+ *      atris_update_rects()
+ * What SDL_UpdateSafe() ends up calling: presents the rectangles right
+ * away, or saves them for atris_flush_updates() if we are batching.
+ ***************************************************************************/
+void
+atris_update_rects(SDL_Surface *surface, int n, SDL_Rect *rects)
+{
+    int i;
+
+    if (Options.video == VIDEO_NULL)
+	return;		/* nothing was drawn, nobody is looking */
+    if (surface != screen) {
+	SDL_UpdateRects(surface, n, rects);
+	return;
+    }
+    if (!Damage.batching) {
+	show(n, rects);
+	return;
+    }
+    for (i=0; i<n; i++)
+	add_damage(&rects[i]);
+}
+
+/***************************************************************************
+ *      next_refresh()
+ * Moves the refresh grid along past "now" and notes when the next
+ * present may happen. Refresh k is at epoch + k * 1000 / Hz.
+ ***************************************************************************/
+static void
+next_refresh(Uint32 now)
+{
+    int hz = Options.refresh_hz;
+
+    if (!Damage.next_present || now - Damage.epoch > 1000000) {
+	/* first time, or long enough that the arithmetic could wrap */
+	Damage.epoch = now;
+	Damage.refresh = 0;
+    } else
+	Damage.refresh = (Uint32) ((now - Damage.epoch) * hz / 1000);
+    Damage.next_present = Damage.epoch + 
+	(Uint32) ((Damage.refresh + 1) * 1000 + hz - 1) / hz;
+}
+
+/***************************************************************************
+ *      atris_flush_updates()
+ * Presents everything drawn since the last flush in one call. With
+ * --refresh that waits (and keeps collecting) until the next refresh is
+ * due; see atris_next_present().
+ *********************************************************************PROTO*/
+void
+atris_flush_updates(void)
+{
+    Uint32 now;
+
+    if (!Damage.n)
+	return;
+    if (Options.refresh_hz > 0) {
+	now = SDL_GetTicks();
+	if (Damage.batching && Damage.next_present &&
+		(Sint32) (now - Damage.next_present) < 0)
+	    return;	/* it will keep until the next refresh */
+	next_refresh(now);
+    }
+    PROFILE_BEGIN(PROF_PRESENT);
+    show(Damage.n, Damage.rect);
+    PROFILE_END(PROF_PRESENT);
+    Damage.n = 0;
+}
+
+/***************************************************************************
+ *      atris_next_present()
+ * When will atris_flush_updates() next present something? Returns 0 if
+ * it would do so right away or has nothing waiting.
+ *********************************************************************PROTO*/
+Uint32
+atris_next_present(void)
+{
+    if (!Damage.n || Options.refresh_hz <= 0 || !Damage.batching)
+	return 0;
+    return Damage.next_present;
+}
+
+/***************************************************************************
+ *      atris_batch_updates()
+ * Turns batching of screen updates on or off. Turning it off presents
+ * whatever is still waiting.
+ *********************************************************************PROTO*/
+void
+atris_batch_updates(int on)
+{
+    if (!on) {
+	/* whatever is waiting goes out now, refresh or no refresh */
+	Damage.batching = 0;
+	atris_flush_updates();
+    }
+    Damage.batching = on;
+}
+
+/***************************************************************************
+ *      atris_wait_event()
+ * Waits up to "ms" milliseconds for an event. Returns 1 (and the event in
+ * "ev") if one came. SDL 1.2 has no SDL_WaitEventTimeout(), so we sleep
+ * in short slices between polls, as SDL_WaitEvent() itself does.
+ *********************************************************************PROTO*/
+int
+atris_wait_event(SDL_Event *ev, Uint32 ms)
+{
+    Uint32 until = SDL_GetTicks() + ms;
+    Sint32 left;
+
+    while (!SDL_PollEvent(ev)) {
+	left = (Sint32) (until - SDL_GetTicks());
+	if (left <= 0)
+	    return 0;
+	PROFILE_BEGIN(PROF_SLEEP);
+	SDL_Delay(left < 10 ? left : 10);
+	PROFILE_END(PROF_SLEEP);
+    }
+    return 1;
+}
+
 /***************************************************************************
  *      poll_and_flame()
- * Poll for events and run the flaming background.
+ * Wait for an event, running the flaming background while we do.
  *********************************************************************PROTO*/
 void
 poll_and_flame(SDL_Event *ev)
 {
-    while (!(SDL_PollEvent(ev))) {
+    while (!atris_wait_event(ev, atris_flame_wait())) {
 	atris_run_flame();
     }
     return;
@@ -118,6 +588,174 @@ setup_colors(SDL_Surface *screen)
     int_dark_purple  = SDL_MapRGB(screen->format, 64, 32, 64);
 }
 
+/* Rendering text with SDL_ttf is slow, so draw_string() keeps what it
+ * has rendered: whole strings in a small LRU cache, and for numbers a
+ * per-font, per-color atlas of the characters below that any number can
+ * be put together from. */
+#define TEXT_CACHE_SIZE	64
+static struct text_cache_struct {
+    TTF_Font	*font;
+    SDL_Color	color;
+    char	*text;
+    SDL_Surface	*surface;
+    Uint32	used;		/* TextCacheClock when last wanted */
+} TextCache[TEXT_CACHE_SIZE];
+static Uint32 TextCacheClock;
+
+#define GLYPHS		"0123456789:-"
+#define NUM_GLYPH	(sizeof(GLYPHS) - 1)
+#define GLYPH_SETS	8
+static struct glyph_set_struct {
+    TTF_Font	*font;
+    SDL_Color	color;
+    SDL_Surface *atlas;			/* GLYPHS, rendered in one go */
+    int		x[NUM_GLYPH + 1];	/* where each one starts */
+    int		w;			/* the widest */
+} GlyphSet[GLYPH_SETS];
+static int next_glyph_set;
+static int last_glyph_set = -1;	/* never reuse the one just handed out */
+
+#define SAME_COLOR(c1,c2) ((c1).r == (c2).r && (c1).g == (c2).g && (c1).b == (c2).b)
+
+/***************************************************************************
+ *      cached_text()
+ * Returns the rendered text, rendering it only if it is not in the cache.
+ * The surface belongs to the cache: do not free it.
+ ***************************************************************************/
+static SDL_Surface *
+cached_text(TTF_Font *f, char *text, SDL_Color sc)
+{
+    int i, oldest = 0;
+
+    TextCacheClock++;
+    for (i=0; i<TEXT_CACHE_SIZE; i++) {
+	struct text_cache_struct *tc = &TextCache[i];
+	if (tc->surface && tc->font == f && SAME_COLOR(tc->color, sc) &&
+		!strcmp(tc->text, text)) {
+	    tc->used = TextCacheClock;
+	    return tc->surface;
+	}
+	if (!tc->surface || 
+		(TextCache[oldest].surface && tc->used < TextCache[oldest].used))
+	    oldest = i;
+    }
+    /* not there: throw out whatever was used least recently */
+    i = oldest;
+    if (TextCache[i].surface) {
+	SDL_FreeSurface(TextCache[i].surface);
+	free(TextCache[i].text);
+    }
+    TextCache[i].surface = TTF_RenderText_Blended(f, text, sc);
+    Assert(TextCache[i].surface);
+    TextCache[i].font = f;
+    TextCache[i].color = sc;
+    Strdup(TextCache[i].text, text);
+    TextCache[i].used = TextCacheClock;
+    return TextCache[i].surface;
+}
+
+/***************************************************************************
+ *      glyph_set()
+ * Finds (or makes) the number atlas for the given font and color. Returns
+ * NULL if the atlas would be too wide to blit from.
+ ***************************************************************************/
+static struct glyph_set_struct *
+glyph_set(TTF_Font *f, SDL_Color sc)
+{
+    struct glyph_set_struct *gs;
+    char buf[NUM_GLYPH + 1];
+    unsigned int i;
+    int h;
+
+    for (i=0; i<GLYPH_SETS; i++)
+	if (GlyphSet[i].atlas && GlyphSet[i].font == f &&
+		SAME_COLOR(GlyphSet[i].color, sc)) {
+	    last_glyph_set = i;
+	    return &GlyphSet[i];
+	}
+
+    if (next_glyph_set == last_glyph_set)
+	next_glyph_set = (next_glyph_set + 1) % GLYPH_SETS;
+    last_glyph_set = next_glyph_set;
+    gs = &GlyphSet[next_glyph_set];
+    next_glyph_set = (next_glyph_set + 1) % GLYPH_SETS;
+    if (gs->atlas)
+	SDL_FreeSurface(gs->atlas);
+    gs->atlas = TTF_RenderText_Blended(f, GLYPHS, sc);
+    Assert(gs->atlas);
+    gs->font = f;
+    gs->color = sc;
+    gs->w = 0;
+    /* the width of each prefix tells us where each character starts */
+    for (i=0; i<=NUM_GLYPH; i++) {
+	memcpy(buf, GLYPHS, i);
+	buf[i] = 0;
+	if (i == 0)
+	    gs->x[i] = 0;
+	else
+	    TTF_SizeText(f, buf, &gs->x[i], &h);
+	if (i > 0 && gs->x[i] - gs->x[i-1] > gs->w)
+	    gs->w = gs->x[i] - gs->x[i-1];
+    }
+    gs->x[NUM_GLYPH] = gs->atlas->w;
+    if (gs->atlas->w > LOGICAL_W) {
+	/* SDL_BlitSafe() would clip the source: don't use this one */
+	SDL_FreeSurface(gs->atlas);
+	gs->atlas = NULL;
+	return NULL;
+    }
+    return gs;
+}
+
+/***************************************************************************
+ *      glyph_width()
+ * How wide one character of a number atlas is.
+ ***************************************************************************/
+static int
+glyph_width(struct glyph_set_struct *gs, char c)
+{
+    int k = strchr(GLYPHS, c) - GLYPHS;
+    return gs->x[k+1] - gs->x[k];
+}
+
+/***************************************************************************
+ *      draw_glyph()
+ * Copies one character of a number atlas to the widget layer. Returns its
+ * width.
+ ***************************************************************************/
+static int
+draw_glyph(struct glyph_set_struct *gs, char c, int x, int y)
+{
+    int k = strchr(GLYPHS, c) - GLYPHS;
+    SDL_Rect src, dst;
+
+    src.x = gs->x[k];
+    src.y = 0;
+    src.w = gs->x[k+1] - gs->x[k];
+    src.h = gs->atlas->h;
+    dst.x = x;
+    dst.y = y;
+    dst.w = src.w;
+    dst.h = src.h;
+    SDL_BlitSafe(gs->atlas, &src, widget_layer, &dst);
+    return src.w;
+}
+
+/***************************************************************************
+ *      is_number()
+ * Returns 1 if every character of the text is in the number atlas.
+ ***************************************************************************/
+static int
+is_number(char *text)
+{
+    if (!*text)
+	return 0;
+    for (; *text; text++)
+	if (!strchr(GLYPHS, *text))
+	    return 0;
+    return 1;
+}
+
 /***************************************************************************
  *      draw_string()
  * Draws the given string at the given location using the default font.
@@ -130,11 +768,15 @@ setup_colors(SDL_Surface *screen)
 #define DRAW_HUGE	(1<<5)
 #define DRAW_LARGE	(1<<6)
 #define DRAW_GRID_0	(1<<7)
+#define DRAW_SMALL	(1<<8)
 int
 draw_string(char *text, SDL_Color sc, int x, int y, int flags)
 {
-    SDL_Surface * text_surface;
+    SDL_Surface * text_surface = NULL;
+    struct glyph_set_struct *gs = NULL;
+    TTF_Font *f;
     SDL_Rect r;
+    int i;
 
     if (flags & DRAW_GRID_0) {
 	r.x = layout.grid[0].x + layout.grid[0].w / 2;
@@ -144,21 +786,33 @@ draw_string(char *text, SDL_Color sc, int x, int y, int flags)
 	r.y = y;
     }
 
-    if (flags & DRAW_HUGE) {
-	text_surface = TTF_RenderText_Blended(hfont, text, sc); Assert(text_surface);
-    } else if (flags & DRAW_LARGE) {
-	text_surface = TTF_RenderText_Blended(lfont, text, sc); Assert(text_surface);
+    if (flags & DRAW_HUGE) 
+	f = hfont;
+    else if (flags & DRAW_LARGE) 
+	f = lfont;
+    else if (flags & DRAW_SMALL) 
+	f = sfont;
+    else 
+	f = font;
+
+    /* numbers (scores, mostly) are put together from the atlas */
+    if (is_number(text))
+	gs = glyph_set(f, sc);
+    if (gs) {
+	r.w = 0;
+	for (i=0; text[i]; i++)
+	    r.w += glyph_width(gs, text[i]);
+	r.h = gs->atlas->h;
     } else {
-	text_surface = TTF_RenderText_Blended(font, text, sc); Assert(text_surface);
+	text_surface = cached_text(f, text, sc);
+	r.w = text_surface->w;
+	r.h = text_surface->h;
     }
 
-    r.w = text_surface->w;
-    r.h = text_surface->h;
-
     if (flags & DRAW_CENTER)
 	r.x -= (r.w / 2);
     if (flags & DRAW_LEFT)
-	r.x -= text_surface->w;
+	r.x -= r.w;
     if (flags & DRAW_ABOVE)
 	r.y -= (r.h);
     if (flags & DRAW_CLEAR) {
@@ -166,13 +820,17 @@ draw_string(char *text, SDL_Color sc, int x, int y, int flags)
 	SDL_FillRect(screen, &r, int_black);
     }
 
-    SDL_BlitSafe(text_surface, NULL, widget_layer, &r);
+    if (gs) {
+	int x = r.x;
+	for (i=0; text[i]; i++)
+	    x += draw_glyph(gs, text[i], x, r.y);
+    } else
+	SDL_BlitSafe(text_surface, NULL, widget_layer, &r);
     SDL_BlitSafe(flame_layer, &r, screen, &r);
     SDL_BlitSafe(widget_layer, &r, screen, &r);
     if (flags & DRAW_UPDATE)
 	SDL_UpdateSafe(screen, 1, &r);
 
-    SDL_FreeSurface(text_surface);
     return r.h;
 }
 
@@ -187,6 +845,13 @@ give_notice(char *s, int quit_possible)
 {
     SDL_Event event;
 
+    if (Options.net_unattended) {
+	/* nobody is watching */
+	if (s && s[0])
+	    Debug("%s\n", s);
+	return quit_possible;
+    }
+
     while (SDL_PollEvent(&event)) {
 	/* pull out all leading 'Q's */
     }
@@ -222,7 +887,7 @@ give_notice(char *s, int quit_possible)
 static void
 load_adjust_symbols()
 {
-    SDL_Surface *bitmap = SDL_LoadBMP("graphics/Level-Up.bmp");
+    SDL_Surface *bitmap = pack_LoadBMP("graphics/Level-Up.bmp");
     if (!bitmap) PANIC("Could not load [graphics/Level-Up.bmp]");
     if (bitmap->format->palette != NULL ) {
 	SDL_SetColors(screen, bitmap->format->palette->colors, 0,
@@ -235,7 +900,7 @@ load_adjust_symbols()
 	    SDL_MapRGB(screen->format, 0, 0, 0));
     SDL_FreeSurface(bitmap);
 
-    bitmap = SDL_LoadBMP("graphics/Level-Medium.bmp");
+    bitmap = pack_LoadBMP("graphics/Level-Medium.bmp");
     if (!bitmap) PANIC("Could not load [graphics/Level-Medium.bmp]");
     if (bitmap->format->palette != NULL ) {
 	SDL_SetColors(screen, bitmap->format->palette->colors, 0,
@@ -248,7 +913,7 @@ load_adjust_symbols()
 	    SDL_MapRGB(screen->format, 0, 0, 0));
     SDL_FreeSurface(bitmap);
 
-    bitmap = SDL_LoadBMP("graphics/Level-Down.bmp");
+    bitmap = pack_LoadBMP("graphics/Level-Down.bmp");
     if (!bitmap) PANIC("Could not load [graphics/Level-Down.bmp]");
     if (bitmap->format->palette != NULL ) {
 	SDL_SetColors(screen, bitmap->format->palette->colors, 0,
@@ -321,9 +986,13 @@ void
 setup_layers(SDL_Surface * screen)
 {
     SDL_Rect all;
+    /* the flame is drawn straight in the screen's format (see
+     * XFRenderFlame()) so that blitting it costs no conversion */
     flame_layer = SDL_CreateRGBSurface
 	(SDL_HWSURFACE|SDL_SRCCOLORKEY,
-	 screen->w, screen->h, 8, 0, 0, 0, 0);
+	 screen->w, screen->h, screen->format->BitsPerPixel, 
+	 screen->format->Rmask, screen->format->Gmask, 
+	 screen->format->Bmask, screen->format->Amask);
     widget_layer = SDL_CreateRGBSurface
 	(SDL_HWSURFACE|SDL_SRCCOLORKEY,
 	 screen->w, screen->h, screen->format->BitsPerPixel, 
@@ -348,16 +1017,27 @@ setup_layers(SDL_Surface * screen)
     SDL_FillRect(flame_layer, &all, int_solid_black);
 }
 
+/* The parts of the play screen that stay put from match to match (the
+ * boards, boxes, labels and names) are drawn once into the widget layer,
+ * kept here along with the layout, and put back with one blit. */
+static struct background_struct {
+    SDL_Surface	*frame;		/* the widget layer with just those on it */
+    struct layout_struct layout;
+    GT		gametype;	/* ... and what they depend on */
+    int		blockWidth;
+    int		w, h;
+    char	name[2][64];
+} Background;
+
 /***************************************************************************
- *      draw_background()
- * Draws the Alizarin Tetris background. Not yet complete, but it's getting
- * better. :-)
- *********************************************************************PROTO*/
-void
-draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
-	int level[], int my_adj[], int their_adj[], char *name[])
+ *      draw_background_frame()
+ * Lays out the play screen and draws the parts that do not change
+ * between matches on the widget layer. See draw_background().
+ ***************************************************************************/
+static void
+draw_background_frame(SDL_Surface *screen, int blockWidth, Grid g[],
+	char *name[])
 {
-    char buf[1024];
     int i;
 #define IS_DOUBLE(x) ((x==NETWORK)||(x==SINGLE_VS_AI)||(x==TWO_PLAYERS)||(x==AI_VS_AI))
 
@@ -370,6 +1050,7 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
      * clear away the old stuff
      */
     memset(&layout, 0, sizeof(layout));
+    SDL_FillRect(widget_layer, NULL, int_black);
     
     if (!adjust_symbol[0]) { /* only load these guys the first time */
 	load_adjust_symbols();
@@ -433,10 +1114,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 	SDL_FillRect(widget_layer, &layout.score[i], int_black);
 	SDL_FillRect(screen, &layout.score[i], int_black);
 
-	SPRINTF(buf,"Level %d, Score:",level[i]);
-	draw_string(buf, color_blue, layout.grid_border[i].x,
-		layout.grid_border[i].y, DRAW_ABOVE | DRAW_CLEAR);
-
 	layout.score[i].x = layout.grid_border[i].x + layout.grid_border[i].w;
 	layout.score[i].y = layout.grid_border[i].y;
     }
@@ -476,8 +1153,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 
     } else if (gametype == AI_VS_AI) {
 	for (i=0;i<3;i++) {
-	    char buf[80];
-
 	    layout.adjust[0].symbol[i].x = (screen->w - adjust_symbol[i]->w)/2;
 	    layout.adjust[0].symbol[i].w = adjust_symbol[i]->w;
 	    layout.adjust[0].symbol[i].h = adjust_symbol[i]->h;
@@ -486,16 +1161,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 
 	    SDL_BlitSafe(adjust_symbol[i], NULL, widget_layer, 
 		    &layout.adjust[0].symbol[i]);
-
-	    /* draw the textual tallies */
-	    SPRINTF(buf,"%d",my_adj[i]);
-	    draw_string(buf, color_red,
-		    layout.adjust[0].symbol[i].x - 10, 
-		    layout.adjust[0].symbol[i].y, DRAW_LEFT | DRAW_CLEAR);
-	    SPRINTF(buf,"%d",their_adj[i]);
-	    draw_string(buf, color_red,
-		    layout.adjust[0].symbol[i].x + layout.adjust[0].symbol[i].w + 10, 
-		    layout.adjust[0].symbol[i].y, DRAW_CLEAR);
 	}
     } else if (IS_DOUBLE(gametype)) {
 	for (i=0;i<3;i++) {
@@ -506,9 +1171,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 		layout.time_border.y+layout.time_border.h + i * adjust_symbol[i]->h;
 	    SDL_FillRect(widget_layer, &layout.adjust[0].symbol[i], int_black);
 	    SDL_FillRect(screen, &layout.adjust[0].symbol[i], int_black);
-	    if (my_adj[i] != -1) 
-		SDL_BlitSafe(adjust_symbol[my_adj[i]], NULL, widget_layer, 
-			&layout.adjust[0].symbol[i]);
 	    layout.adjust[1].symbol[i].w = adjust_symbol[i]->w;
 	    layout.adjust[1].symbol[i].h = adjust_symbol[i]->h;
 	    layout.adjust[1].symbol[i].x = (screen->w)/2 + adjust_symbol[i]->w/2;
@@ -516,9 +1178,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 		layout.time_border.y+layout.time_border.h + i * adjust_symbol[i]->h;
 	    SDL_FillRect(widget_layer, &layout.adjust[1].symbol[i], int_black);
 	    SDL_FillRect(screen, &layout.adjust[1].symbol[i], int_black);
-	    if (their_adj[i] != -1) 
-		SDL_BlitSafe(adjust_symbol[their_adj[i]], NULL, widget_layer, 
-			&layout.adjust[1].symbol[i]);
 	}
     } else { /* single player */
 	for (i=0;i<3;i++) {
@@ -531,9 +1190,6 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 		layout.time_border.y +layout.time_border.h+ i * adjust_symbol[i]->h;
 	    SDL_FillRect(widget_layer, &layout.adjust[0].symbol[i], int_black);
 	    SDL_FillRect(screen, &layout.adjust[0].symbol[i], int_black);
-	    if (my_adj[i] != -1) 
-		SDL_BlitSafe(adjust_symbol[my_adj[i]], NULL, widget_layer, 
-			&layout.adjust[0].symbol[i]);
 	}
     }
 
@@ -592,18 +1248,151 @@ draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
 	layout.pause.h = layout.next_piece_border[0].h / 3;
     }
 
-    /* Blit onto the screen surface */
-    {
-	SDL_Rect dest;
-	dest.x = 0; dest.y = 0; dest.w = screen->w; dest.h = screen->h;
+    /*
+     *	NETWORK STATISTICS (only drawn if the user asked for them)
+     */
+    if (gametype == NETWORK) {
+	layout.net_stats.x = layout.pause.x;
+	layout.net_stats.y = layout.pause.y + layout.pause.h + 2;
+	layout.net_stats.w = layout.pause.w;
+	layout.net_stats.h = screen->h - layout.net_stats.y;
+    }
 
-	SDL_BlitSafe(flame_layer, NULL, screen, NULL);
-	SDL_BlitSafe(widget_layer, NULL, screen, NULL);
-	SDL_UpdateSafe(screen, 1, &dest);
+    /*
+     *	FRAME PROFILE (only drawn if the user asked for it)
+     */
+    if (Options.profile && gametype != DEMO) {
+	/* centered under the pause box, but room for the text */
+	layout.profile.w = max(layout.pause.w, 160);
+	layout.profile.x = max(0,
+		layout.pause.x + (layout.pause.w - layout.profile.w) / 2);
+	layout.profile.h = 5 * TTF_FontLineSkip(sfont);
+	layout.profile.y = screen->h - layout.profile.h;
+	if (gametype == NETWORK)
+	    layout.net_stats.h = layout.profile.y - layout.net_stats.y;
+    } else
+	layout.profile.w = 0;
+    return;
+}
+
+/***************************************************************************
+ *      draw_background_state()
+ * Draws the parts of the play screen that change between matches: the
+ * levels and the level adjustments so far.
+ ***************************************************************************/
+static void
+draw_background_state(int level[], int my_adj[], int their_adj[])
+{
+    char buf[1024];
+    int i;
+
+    for (i=0; i< 1+IS_DOUBLE(gametype); i++) {
+	SPRINTF(buf,"Level %d, Score:",level[i]);
+	draw_string(buf, color_blue, layout.grid_border[i].x,
+		layout.grid_border[i].y, DRAW_ABOVE | DRAW_CLEAR);
     }
+
+    if (gametype == DEMO) {
+
+    } else if (gametype == AI_VS_AI) {
+	for (i=0;i<3;i++) {
+	    /* draw the textual tallies */
+	    SPRINTF(buf,"%d",my_adj[i]);
+	    draw_string(buf, color_red,
+		    layout.adjust[0].symbol[i].x - 10, 
+		    layout.adjust[0].symbol[i].y, DRAW_LEFT | DRAW_CLEAR);
+	    SPRINTF(buf,"%d",their_adj[i]);
+	    draw_string(buf, color_red,
+		    layout.adjust[0].symbol[i].x + layout.adjust[0].symbol[i].w + 10, 
+		    layout.adjust[0].symbol[i].y, DRAW_CLEAR);
+	}
+    } else {
+	for (i=0;i<3;i++) {
+	    if (my_adj[i] != -1) 
+		SDL_BlitSafe(adjust_symbol[my_adj[i]], NULL, widget_layer, 
+			&layout.adjust[0].symbol[i]);
+	    if (IS_DOUBLE(gametype) && their_adj[i] != -1) 
+		SDL_BlitSafe(adjust_symbol[their_adj[i]], NULL, widget_layer, 
+			&layout.adjust[1].symbol[i]);
+	}
+    }
+}
+
+/***************************************************************************
+ *      draw_background()
+ * Draws the Alizarin Tetris background. Not yet complete, but it's getting
+ * better. :-)
+ *
+ * The frame comes from the cache unless the game type, block size, board
+ * size or names have changed since it was drawn.
+ *********************************************************************PROTO*/
+void
+draw_background(SDL_Surface *screen, int blockWidth, Grid g[],
+	int level[], int my_adj[], int their_adj[], char *name[])
+{
+    SDL_Rect dest;
+    int i, n = 1+IS_DOUBLE(gametype);
+    int same = Background.frame && Background.gametype == gametype &&
+	Background.blockWidth == blockWidth &&
+	Background.w == g[0].w && Background.h == g[0].h;
+
+    for (i=0; i<n && same; i++)
+	same = !strncmp(Background.name[i], name[i] ? name[i] : "",
+		sizeof(Background.name[i]));
+
+    if (same) {
+	layout = Background.layout;
+	SDL_BlitSafe(Background.frame, NULL, widget_layer, NULL);
+    } else {
+	draw_background_frame(screen, blockWidth, g, name);
+	if (!Background.frame)
+	    Background.frame = SDL_CreateRGBSurface(SDL_SWSURFACE,
+		    widget_layer->w, widget_layer->h,
+		    widget_layer->format->BitsPerPixel,
+		    widget_layer->format->Rmask, widget_layer->format->Gmask,
+		    widget_layer->format->Bmask, widget_layer->format->Amask);
+	if (Background.frame) {
+	    /* the widget layer's black is transparent, so start with black */
+	    SDL_FillRect(Background.frame, NULL, int_black);
+	    SDL_BlitSafe(widget_layer, NULL, Background.frame, NULL);
+	    Background.layout = layout;
+	    Background.gametype = gametype;
+	    Background.blockWidth = blockWidth;
+	    Background.w = g[0].w;
+	    Background.h = g[0].h;
+	    for (i=0; i<n; i++)
+		strncpy(Background.name[i], name[i] ? name[i] : "",
+			sizeof(Background.name[i]));
+	}
+    }
+    for (i=0; i<n; i++)
+	g[i].board = layout.grid[i];
+
+    draw_background_state(level, my_adj, their_adj);
+
+    /* Blit onto the screen surface */
+    dest.x = 0; dest.y = 0; dest.w = screen->w; dest.h = screen->h;
+
+    SDL_BlitSafe(flame_layer, NULL, screen, NULL);
+    SDL_BlitSafe(widget_layer, NULL, screen, NULL);
+    SDL_UpdateSafe(screen, 1, &dest);
     return;
 }
 
+/***************************************************************************
+ *      draw_pause_text()
+ * Replaces the message in the pause indicator (e.g., to explain why we
+ * are paused). Only call this while paused.
+ *********************************************************************PROTO*/
+void
+draw_pause_text(char *text)
+{
+    draw_pre_bordered_rect(&layout.pause, 2);
+    draw_string(text, color_blue, 
+	    layout.pause.x + layout.pause.w / 2, layout.pause.y,
+	    DRAW_CENTER | DRAW_UPDATE);
+}
+
 /***************************************************************************
  *      draw_pause()
  * Draw or clear the pause indicator.
@@ -613,10 +1402,7 @@ draw_pause(int on)
 {
     int i;
     if (on) {
-	draw_pre_bordered_rect(&layout.pause, 2);
-	draw_string("* Paused *", color_blue, 
-		layout.pause.x + layout.pause.w / 2, layout.pause.y,
-		DRAW_CENTER | DRAW_UPDATE);
+	draw_pause_text("* Paused *");
 	for (i=0; i<2; i++) {
 	    /* save this stuff so that the flame doesn't go over it .. */
 	    if (layout.grid[i].w) {
@@ -655,31 +1441,19 @@ void
 draw_clock(int seconds)
 {
     static int old_seconds = -111;	/* last time we drew */
-    static SDL_Surface * digit[12];
+    struct glyph_set_struct *digits, *marks;
     char buf[16];
-    static int w = -1, h= -1; /* max digit width/height */
+    int w, h; /* max digit width/height */
     int i, c;
 
     if (seconds == old_seconds || gametype == DEMO) return;
 
-    if (old_seconds == -111) {
-	/* setup code */
-
-	for (i=0;i<10;i++) {
-	    SPRINTF(buf,"%d",i);
-	    digit[i] = TTF_RenderText_Blended(font,buf,color_blue);
-	}
-	SPRINTF(buf,":"); digit[10] = TTF_RenderText_Blended(font,buf,color_red);
-	SPRINTF(buf,"-"); digit[11] = TTF_RenderText_Blended(font,buf,color_red);
-
-	for (i=0;i<12;i++) {
-	    Assert(digit[i]);
-	    /* the colorkey and display format are already done */
-	    /* find the largest dimensions */
-	    if (digit[i]->w > w) w = digit[i]->w;
-	    if (digit[i]->h > h) h = digit[i]->h;
-	}
-    }
+    /* the shared number atlases: blue digits, red punctuation */
+    digits = glyph_set(font, color_blue);
+    marks = glyph_set(font, color_red);
+    Assert(digits && marks);
+    w = max(digits->w, marks->w);
+    h = max(digits->atlas->h, marks->atlas->h);
 
     old_seconds = seconds;
 
@@ -699,26 +1473,18 @@ draw_clock(int seconds)
 
 
     for (i=0;buf[i];i++) {
-	SDL_Surface * to_blit;
+	struct glyph_set_struct *gs;
+	int gw;
 
 	if (buf[i] >= '0' && buf[i] <= '9')
-	    to_blit = digit[buf[i] - '0'];
-	else if (buf[i] == ':')
-	    to_blit = digit[10];
-	else if (buf[i] == '-')
-	    to_blit = digit[11];
+	    gs = digits;
+	else if (buf[i] == ':' || buf[i] == '-')
+	    gs = marks;
 	else PANIC("unknown character in clock string [%s]",buf);
 
 	/* center the letter horizontally */
-	if (w > to_blit->w) layout.time.x += (w - to_blit->w) / 2;
-	layout.time.w = to_blit->w;
-	layout.time.h = to_blit->h;
-	/*
-	Debug("[%d+%d, %d+%d]\n",
-		clockPos.x,clockPos.w,clockPos.y,clockPos.h);
-		*/
-	SDL_BlitSafe(to_blit, NULL, widget_layer, &layout.time);
-	if (w > to_blit->w) layout.time.x -= (w - to_blit->w) / 2;
+	gw = glyph_width(gs, buf[i]);
+	draw_glyph(gs, buf[i], layout.time.x + (w - gw) / 2, layout.time.y);
 	layout.time.x += w;
     }
 
@@ -733,6 +1499,82 @@ draw_clock(int seconds)
     return;
 }
 
+/***************************************************************************
+ *      draw_net_stats()
+ * Draws the network link statistics (round-trip time, jitter, throughput
+ * and stalls) in the space below the pause box.
+ *********************************************************************PROTO*/
+void
+draw_net_stats(void)
+{
+    net_stats *ns = &NetStats;
+    char buf[80];
+    int x = layout.net_stats.x + layout.net_stats.w / 2;
+    int y = layout.net_stats.y;
+
+    if (!layout.net_stats.w) return;
+
+    SDL_FillRect(widget_layer, &layout.net_stats, int_black);
+    SDL_FillRect(screen, &layout.net_stats, int_black);
+    SDL_BlitSafe(flame_layer, &layout.net_stats, screen, &layout.net_stats);
+
+    if (ns->rtt < 0)
+	SPRINTF(buf,"rtt -- ms");
+    else
+	SPRINTF(buf,"rtt %d ms, jitter %d", ns->rtt, ns->jitter >> 4);
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"in %u, out %u B/s", ns->recv_rate, ns->sent_rate);
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"gap %d, frame %d ms", ns->gap_max, ns->frame_max);
+    draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SDL_UpdateSafe(screen, 1, &layout.net_stats);
+}
+
+/***************************************************************************
+ *      draw_profile_stats()
+ * Draws the frame profile (rolling frame times and where they went) at
+ * the bottom of the screen, below the pause box.
+ *********************************************************************PROTO*/
+void
+draw_profile_stats(void)
+{
+    char buf[80];
+    int x = layout.profile.x + layout.profile.w / 2;
+    int y = layout.profile.y;
+
+    if (!layout.profile.w) return;
+
+    SDL_FillRect(widget_layer, &layout.profile, int_black);
+    SDL_FillRect(screen, &layout.profile, int_black);
+    SDL_BlitSafe(flame_layer, &layout.profile, screen, &layout.profile);
+
+    /* p50 / p99 */
+    SPRINTF(buf,"frame %.1f / %.1f ms",
+	    Profile_Percentile(50) / 1000.0, Profile_Percentile(99) / 1000.0);
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"sim %d%% net %d%%",
+	    Profile_Share(PROF_SIM), Profile_Share(PROF_NET));
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"grid %d%% fall %d%%",
+	    Profile_Share(PROF_GRID), Profile_Share(PROF_FALLING));
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"piece %d%% flame %d%%",
+	    Profile_Share(PROF_PIECE), Profile_Share(PROF_FLAME));
+    y += draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SPRINTF(buf,"show %d%% idle %d%%",
+	    Profile_Share(PROF_PRESENT), Profile_Share(PROF_SLEEP));
+    draw_string(buf, color_purple, x, y, DRAW_CENTER | DRAW_SMALL);
+
+    SDL_UpdateSafe(screen, 1, &layout.profile);
+}
+
 /***************************************************************************
  *      draw_score()
  *********************************************************************PROTO*/
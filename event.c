@@ -29,9 +29,12 @@
 #include "sound.h"
 #include "ai.h"
 #include "options.h"
+#include "network.h"
+#include "profile.h"
 
 #include "ai.pro"
 #include "display.pro"
+#include "rollback.pro"
 #include "xflame.pro"
 
 extern int Score[];
@@ -139,8 +142,8 @@ screen_to_grid_coords(Grid *g, int blockWidth,
 {
     screen_x -= g->board.x;
     screen_y -= g->board.y;
-    if (screen_x < 0) screen_x -= 19;	/* round up to negative #s */
-    if (screen_y < 0) screen_y -= 19;	/* round up to negative #s */
+    if (screen_x < 0) screen_x -= blockWidth-1;	/* round up to negative #s */
+    if (screen_y < 0) screen_y -= blockWidth-1;	/* round up to negative #s */
 
     *row = screen_y / blockWidth;
     *col = screen_x / blockWidth;
@@ -202,7 +205,7 @@ valid_screen_position(play_piece *pp, int blockWidth, Grid *g,
     if (!valid_position(pp, col, row, rot, g))
 	return 0;
 
-    screen_to_grid_coords(g, blockWidth, screen_x, screen_y+19, &row2, &col);
+    screen_to_grid_coords(g, blockWidth, screen_x, screen_y+blockWidth-1, &row2, &col);
 
     if (row == row2) return 1;	/* no need to recheck, you were aligned */
     else return valid_position(pp, col, row2, rot, g);
@@ -225,9 +228,9 @@ int tetris_event(int *delay, int count, SDL_Surface * screen,
 	State[P].num_lines_cleared += State[P].check_result;
 
 	if (State[P].check_result >= 3)
-	    play_sound(ss,SOUND_CLEAR4,256);
+	    play_sound(ss,SOUND_CLEAR4,23);
 	else for (i=0;i<State[P].check_result;i++)
-	    play_sound(ss,SOUND_CLEAR1,256+6144*i);
+	    play_sound(ss,SOUND_CLEAR1,23+557*i);
 
 	*delay = 1;
 	return 2;
@@ -237,9 +240,9 @@ int tetris_event(int *delay, int count, SDL_Surface * screen,
 
 	if (sock) { 
 	    char msg = 'c'; /* WRW: send update */
-	    send(sock,&msg,1,0);
-	    send(sock,g[0].contents,sizeof(*g[0].contents)
-		    * g[0].h * g[0].w,0); 
+	    Network_Send(sock,&msg,1);
+	    Network_Send(sock,g[0].contents,sizeof(*g[0].contents)
+		    * g[0].h * g[0].w); 
 		    
 	}
 	draw_grid(screen,cs,&g[0],draw);
@@ -275,18 +278,18 @@ int tetris_event(int *delay, int count, SDL_Surface * screen,
 		State[P].num_lines_cleared * level;
 	    if (sock) {
 		char msg = 's'; /* WRW: send update */
-		send(sock,&msg,1,0);
-		send(sock,(char *)&Score[P],sizeof(Score[P]),0);
+		Network_Send(sock,&msg,1);
+		Network_SendInt(sock,Score[P]);
 		if (State[P].num_lines_cleared >= 5) {
 		    char msg = 'g'; /* WRW: send garbage! */
-		    send(sock,&msg,1,0);
+		    Network_Send(sock,&msg,1);
 		    State[P].num_lines_cleared -= 4; /* might possibly also blank! */
 		}
 		if (State[P].num_lines_cleared >= 3) {
 		    int i;
 		    for (i=3;i<=State[P].num_lines_cleared;i++) {
 			char msg = 'b'; /* WRW: send blanking! */
-			send(sock,&msg,1,0);
+			Network_Send(sock,&msg,1);
 		    }
 		}
 	    } else {
@@ -304,7 +307,7 @@ int tetris_event(int *delay, int count, SDL_Surface * screen,
 	}
     } else if (count >= 3 && count <= 22) {
 	if (draw) 
-	    draw_falling(screen, cs->w , &g[0], count - 2);
+	    draw_falling(screen, cs, &g[0], count - 2);
 
 	/*
 	*delay = max(fall_event_interval / 5,4);
@@ -337,7 +340,7 @@ int tetris_event(int *delay, int count, SDL_Surface * screen,
 static void
 do_blank(SDL_Surface *screen, sound_style *ss[2], Grid g[], int P)
 {
-    play_sound(ss[P],SOUND_GARBAGE1,1);
+    play_sound(ss[P],SOUND_GARBAGE1,0);
     if (State[P].draw) {
 	State[P].next_draw = SDL_GetTicks() + 1000;
 	State[P].draw_timeout = 1000;
@@ -547,23 +550,23 @@ handle_special(play_piece *pp, int row, int col, int rot, Grid *g,
 	case Special_Bomb: 
 			 find_on_board(pp, col, row, rot, g, bomb_fun);
 			 if (ss) 
-			     play_sound(ss,SOUND_CLEAR1,256);
+			     play_sound(ss,SOUND_CLEAR1,23);
 			 break;
 	case Special_Repaint: 
 			 most_common_color(g);
 			 find_on_board(pp, col, row, rot, g, repaint_fun);
 			 if (ss) 
-			     play_sound(ss,SOUND_GARBAGE1,256);
+			     play_sound(ss,SOUND_GARBAGE1,23);
 			 break;
 	case Special_Pushdown: 
 			 push_down(pp, col, row, rot, g, repaint_fun);
 			 if (ss) 
-			     play_sound(ss,SOUND_THUD,256*2);
+			     play_sound(ss,SOUND_THUD,46);
 			 break;
 	case Special_Colorkill: 
 			 find_on_board(pp, col, row, rot, g, colorkill_fun);
 			 if (ss) 
-			     play_sound(ss,SOUND_CLEAR1,256);
+			     play_sound(ss,SOUND_CLEAR1,23);
 			 break;
 
     }
@@ -574,7 +577,7 @@ handle_special(play_piece *pp, int row, int col, int rot, Grid *g,
  * Change the pause status of the local player.
  ***************************************************************************/
 static void
-do_pause(int paused, Uint32 tv_now, int *pause_begin_time, int *tv_start)
+do_pause(int paused, Uint32 tv_now, Uint32 *pause_begin_time, Uint32 *tv_start)
 {
     int i;
     draw_pause(paused);
@@ -589,11 +592,184 @@ do_pause(int paused, Uint32 tv_now, int *pause_begin_time, int *tv_start)
 	    State[i].tv_next_ai_think += (tv_now - *pause_begin_time);
 	    State[i].tv_next_ai_move += (tv_now - *pause_begin_time);
 	}
+	Rollback_Resume(tv_now - *pause_begin_time);
     } else {
 	*pause_begin_time = tv_now;
     }
 }
 
+/***************************************************************************
+ *      read_remote_grid()
+ * Reads the other player's board off the network and redraws whatever
+ * changed. Returns 0 on success.
+ ***************************************************************************/
+static int
+read_remote_grid(int sock, SDL_Surface *screen, color_style *cs, Grid *g)
+{
+    int i,j;
+    int len = sizeof(*g->contents) * g->w * g->h;
+
+    Rollback_Board(screen, cs, g);
+    memcpy(g->temp, g->contents, sizeof(*g->temp) * g->w * g->h);
+    if (Network_Recv(sock, g->contents, len) != len)
+	return -1;
+    for (i=0;i<g->w;i++)
+	for (j=0;j<g->h;j++)
+	    if (GRID_CONTENT(*g,i,j) != TEMP_CONTENT(*g,i,j)){
+		GRID_CHANGED(*g,i,j)=1;
+		if (i > 0) GRID_CHANGED(*g,i-1,j) = 1;
+		if (j > 0) GRID_CHANGED(*g,i,j-1) = 1;
+		if (i < g->w-1) GRID_CHANGED(*g,i+1,j) = 1;
+		if (j < g->h-1) GRID_CHANGED(*g,i,j+1) = 1;
+		if (GRID_CONTENT(*g,i,j) == 0) GRID_SET(*g,i,j,REMOVE_ME);
+	    }
+    draw_grid(screen,cs,g,1);
+    return 0;
+}
+
+/***************************************************************************
+ *      resync_match()
+ * After a reconnect, trade snapshots with the other side: our seed
+ * position, score, limbo status, remaining time and board. Messages that
+ * were in flight when the link went down are lost, so this is how we
+ * come to agree again. The server keeps the official time. Returns 0 on
+ * success.
+ ***************************************************************************/
+static int
+resync_match(int sock, SDL_Surface *screen, color_style *cs[2], Grid g[],
+	int P, int adjust[], int *seconds_remaining, Uint32 *tv_start)
+{
+    char tag = NET_SNAPSHOT;
+    int len = sizeof(*g[P].contents) * g[P].w * g[P].h;
+    int their_adjust, their_seconds;
+    Uint32 their_seed;
+
+    if (Network_Send(sock, &tag, 1) != 1 ||
+	    Network_SendU32(sock, State[P].seed) ||
+	    Network_SendInt(sock, Score[P]) ||
+	    Network_SendInt(sock, State[P].limbo ? adjust[P] : -1) ||
+	    Network_SendInt(sock, *seconds_remaining) ||
+	    Network_Send(sock, g[P].contents, len) != len)
+	return -1;
+
+    if (Network_Recv(sock, &tag, 1) != 1 || tag != NET_SNAPSHOT ||
+	    Network_RecvU32(sock, &their_seed) ||
+	    Network_RecvInt(sock, &Score[!P]) ||
+	    Network_RecvInt(sock, &their_adjust) ||
+	    Network_RecvInt(sock, &their_seconds) ||
+	    read_remote_grid(sock, screen, cs[!P], &g[!P]))
+	return -1;
+
+    State[!P].seed = their_seed;	/* where they are in the piece sequence */
+    draw_score(screen, !P);
+    if (their_adjust >= 0) {
+	State[P].other_in_limbo = 1;
+	adjust[!P] = their_adjust;
+    }
+    if (State[P].limbo) 
+	State[P].limbo_sent = 1;	/* the snapshot told them */
+    if (!Network_SessionIsServer()) {
+	*seconds_remaining = their_seconds;
+	*tv_start = SDL_GetTicks() + their_seconds * 1000;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ *      send_piece()
+ * Tells the other side where our falling piece is so that they can show
+ * and predict it (see rollback.c). NET_PIECE also carries what they need
+ * to simulate a new piece; NET_MOVE follows any input that moved it.
+ * Times are on our match clock and positions are relative to the board.
+ ***************************************************************************/
+static void
+send_piece(int sock, char tag, Grid *g, int blockWidth)
+{
+    int P = 0;
+
+    Network_Send(sock, &tag, 1);
+    Network_SendInt(sock, SDL_GetTicks() - NetStats.start);
+    if (tag == NET_PIECE) {
+	Network_SendU32(sock, State[P].seed - 2);	/* cp's seed */
+	Network_SendInt(sock, blockWidth);
+	Network_SendInt(sock, State[P].fall_event_interval);
+	Network_SendInt(sock, Options.long_settle_delay ? 400 : 200);
+    }
+    Network_SendInt(sock, pos[P].x - g->board.x);
+    Network_SendInt(sock, pos[P].y - g->board.y);
+    Network_SendInt(sock, pos[P].rot);
+    Network_SendInt(sock, State[P].fall_speed);
+    Network_SendInt(sock, State[P].tv_next_fall - NetStats.start);
+    Network_SendInt(sock, State[P].collide_time ? 
+	    (int) (State[P].collide_time - NetStats.start) : -1);
+}
+
+/***************************************************************************
+ *      reconnect_match()
+ * The connection to the other player went away in the middle of a match.
+ * Pause and give them NET_RECONNECT_WINDOW seconds (or until the local
+ * player presses 'Q') to come back, then resynchronize and carry on. The
+ * game is always unpaused afterwards, since any pause messages may have
+ * been lost.
+ *
+ * Returns the new socket, or 0 if the other player is really gone.
+ ***************************************************************************/
+static int
+reconnect_match(SDL_Surface *screen, color_style *cs[2], Grid g[], int P,
+	int adjust[], int *paused, Uint32 *pause_begin_time, 
+	int *seconds_remaining, Uint32 *tv_start)
+{
+    Uint32 now = SDL_GetTicks();
+    Uint32 give_up = now + NET_RECONNECT_WINDOW * 1000;
+    int last_shown = -1;
+    int sock = -1;
+    SDL_Event event;
+
+    Debug("WARNING: lost the other player, waiting %d seconds for them.\n",
+	    NET_RECONNECT_WINDOW);
+    if (!*paused) 
+	do_pause(1, now, pause_begin_time, tv_start);
+
+    while (sock < 0 && now < give_up) {
+	int left = (give_up - now + 999) / 1000;
+	if (left != last_shown) {
+	    char buf[80];
+	    SPRINTF(buf,"Reconnecting %d",left);
+	    draw_pause_text(buf);
+	    last_shown = left;
+	}
+	/* wait for the flame (or a key) rather than spin */
+	if (atris_wait_event(&event, atris_flame_wait()))
+	    do {
+		if (event.type == SDL_KEYDOWN &&
+			event.key.keysym.sym == SDLK_q)
+		    give_up = now;
+	    } while (SDL_PollEvent(&event));
+	atris_flush_updates();
+	atris_run_flame();
+	sock = Network_SessionReconnect();
+	now = SDL_GetTicks();
+    }
+
+    do_pause(0, SDL_GetTicks(), pause_begin_time, tv_start);
+    *paused = 0;
+
+    if (sock > 0 && resync_match(sock, screen, cs, g, P, adjust,
+		seconds_remaining, tv_start)) {
+	Debug("WARNING: could not resynchronize with the other player.\n");
+	close(sock);
+	sock = -1;
+    }
+    if (sock < 0) {
+	Network_SessionEnd();
+	return 0;
+    }
+    if (State[P].falling)
+	send_piece(sock, NET_PIECE, &g[P], cs[P]->w);
+    NetStats.next_ping = SDL_GetTicks();
+    return sock;
+}
+
 /***************************************************************************
  *      place_this_piece()
  * Given that the player's current piece structure is already chosen, try
@@ -622,6 +798,25 @@ place_this_piece(int P, int blockWidth, Grid g[])
     return 1;	/* no valid position! */
 }
 
+/***************************************************************************
+ *      nap()
+ * Sleeps between passes through the event loop (the profiler wants to
+ * know).
+ ***************************************************************************/
+static void
+nap(Uint32 ms)
+{
+    PROFILE_BEGIN(PROF_SLEEP);
+    SDL_Delay(ms);
+    PROFILE_END(PROF_SLEEP);
+}
+
+static int run_event_loop(SDL_Surface *screen, piece_style *ps,
+	color_style *cs[2], sound_style *ss[2], Grid g[], int level[2],
+	int sock, int *seconds_remaining, int time_is_hard_limit,
+	int adjust[], int (*handle)(const SDL_Event *), 
+	int seed, int p1, int p2, AI_Player *AI[2]);
+
 /***************************************************************************
  *      event_loop()
  * The main event-processing dispatch loop. 
@@ -638,15 +833,46 @@ event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2],
 	int *seconds_remaining, int time_is_hard_limit,
 	int adjust[], int (*handle)(const SDL_Event *), 
 	int seed, int p1, int p2, AI_Player *AI[2])
+{
+    int retval;
+
+    /* the menus only read the style names; load what we are playing with */
+    use_color_style(cs[0]);
+    use_color_style(cs[1]);
+    use_sound_style(ss[0]);
+    use_sound_style(ss[1]);
+    /* everything drawn during one pass is presented at once */
+    atris_batch_updates(1);
+    Profile_Start();
+    retval = run_event_loop(screen, ps, cs, ss, g, level, sock,
+	    seconds_remaining, time_is_hard_limit, adjust, handle,
+	    seed, p1, p2, AI);
+    Profile_Stop();
+    atris_batch_updates(0);
+    return retval;
+}
+
+/***************************************************************************
+ *      run_event_loop()
+ * What event_loop() actually does. Screen updates are being batched, so
+ * each pass through the loop ends with atris_flush_updates().
+ ***************************************************************************/
+static int
+run_event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2], 
+	sound_style *ss[2], Grid g[], int level[2], int sock,
+	int *seconds_remaining, int time_is_hard_limit,
+	int adjust[], int (*handle)(const SDL_Event *), 
+	int seed, int p1, int p2, AI_Player *AI[2])
 {
     SDL_Event event;
-    Uint32 tv_now, tv_start; 
+    Uint32 tv_now, tv_start, tv_frame; 
     int NUM_PLAYER = 0;
     int NUM_KEYBOARD = 0;
     int last_seconds = -1;
     int minimum_fall_event_interval = 100;
     int paused = 0;
     Uint32 pause_begin_time = 0;
+    int we_moved;
 
     /* measured in milliseconds, 25 frames per second:
      * 1 frame = 40 milliseconds
@@ -760,10 +986,12 @@ event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2],
 
     if (sock) { 
 	char msg = 'c'; /* WRW: send update */
-	send(sock,&msg,1,0);
-	send(sock,g[0].contents,sizeof(*g[0].contents)
-		* g[0].h * g[0].w,0); 
-		
+	Network_StatsReset();
+	Rollback_Reset(&g[1]);
+	Network_Send(sock,&msg,1);
+	Network_Send(sock,g[0].contents,sizeof(*g[0].contents)
+		* g[0].h * g[0].w); 
+	send_piece(sock, NET_PIECE, &g[0], blockWidth);
     }
 
     draw_clock(0);
@@ -785,10 +1013,14 @@ event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2],
 
     while (1) { 
 
+	/* in case the last pass ended early with a "continue" */
+	atris_flush_updates();
+	Profile_Frame();
+
 	if (NUM_PLAYER == 2)
 	    P = !P;
 
-	tv_now = SDL_GetTicks();
+	tv_now = tv_frame = SDL_GetTicks();
 
 	/* update the on-screen clock */
 	if (tv_start >= tv_now)
@@ -909,9 +1141,9 @@ event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2],
 
 	    if (sock) { 
 		char msg = 'c'; /* WRW: send update */
-		send(sock,&msg,1,0);
-		send(sock,g[P].contents,sizeof(*g[P].contents)
-			* g[P].h * g[P].w,0); 
+		Network_Send(sock,&msg,1);
+		Network_Send(sock,g[P].contents,sizeof(*g[P].contents)
+			* g[P].h * g[P].w); 
 	    }
 	    draw_grid(screen,cs[P],&g[P],State[P].draw);
 
@@ -945,7 +1177,7 @@ event_loop(SDL_Surface *screen, piece_style *ps, color_style *cs[2],
 		    do_blank(screen, ss, g, !P);
 		if (garbage) {
 		    add_garbage(&g[!P]);
-		    play_sound(ss[!P],SOUND_GARBAGE1,1);
+		    play_sound(ss[!P],SOUND_GARBAGE1,0);
 		    draw_grid(screen,cs[!P],&g[!P],State[!P].draw);
 		}
 	    }
@@ -996,7 +1228,7 @@ you_lose:
 				count++;
 		    if (count == 0) {
 you_win: 
-			play_sound(ss[P],SOUND_LEVELUP,256);
+			play_sound(ss[P],SOUND_LEVELUP,23);
 			if (*seconds_remaining <= 0) { 
 			    adjust[P] = ADJUST_SAME;
 			    if (NUM_PLAYER == 2 && !sock)
@@ -1027,6 +1259,8 @@ you_win:
 			State[P].accept_input = 1;
 			State[P].tv_next_fall = SDL_GetTicks() + 
 			    State[P].fall_event_interval;
+			if (sock)
+			    send_piece(sock, NET_PIECE, &g[P], blockWidth);
 		    }
 		}
 	    } 
@@ -1133,7 +1367,7 @@ you_win:
 			paused = !paused;
 			if (sock) { 
 			    char msg = 'p'; /* WRW: send pause update */
-			    send(sock,&msg,1,0);
+			    Network_Send(sock,&msg,1);
 			}
 			do_pause(paused, tv_now, &pause_begin_time, &tv_start);
 		    }
@@ -1174,7 +1408,7 @@ you_win:
 			} else if ((ks == SDLK_RETURN) && 
                             ((event.key.keysym.mod & KMOD_LCTRL) ||
                              (event.key.keysym.mod & KMOD_RCTRL))) {
-                          SDL_WM_ToggleFullScreen(screen);
+                          SDL_WM_ToggleFullScreen(SDL_GetVideoSurface());
                           break; 
                         } else break;
 			if (NUM_KEYBOARD == 1) Q = 0;
@@ -1224,6 +1458,7 @@ you_win:
 	/* 
 	 *	Handle Movement 
 	 */
+	we_moved = (sock && pos[0].move != MOVE_NONE);
 	for (Q=0;Q<NUM_PLAYER;Q++) {
 	    switch (pos[Q].move) {
 		case MOVE_ROTATE: 
@@ -1292,6 +1527,8 @@ you_win:
 		    break;
 	    }
 	} /* endof: for each player, check move */
+	if (we_moved && State[0].falling)
+	    send_piece(sock, NET_MOVE, &g[0], blockWidth);
 
 
 	if (State[P].falling && !paused) { 
@@ -1308,8 +1545,18 @@ you_win:
 	    fd_set read_fds;
 	    struct timeval timeout = { 0, 0 };
 	    int retval;
+	    int link_lost = 0;
 
 	    Assert(P == 0);
+	    PROFILE_BEGIN(PROF_NET);
+
+	    /* keep an eye on the link: once we are in limbo the other side
+	     * may have left the event loop, so stop talking to it */
+	    if (tv_now >= NetStats.next_ping && !State[P].limbo) {
+		Network_Ping(sock);
+		if (Options.net_overlay)
+		    draw_net_stats();
+	    }
 
 	    do { 
 		FD_ZERO(&read_fds);
@@ -1322,11 +1569,8 @@ you_win:
 #endif
 		if (retval > 0) {
 		    char msg;
-		    if (recv(sock,&msg,1,0) != 1) {
-			Debug("WARNING: Other player has left?\n");
-			close(sock);
-			sock = 0;
-			retval = 0;
+		    if (Network_Recv(sock,&msg,1) != 1) {
+			link_lost = 1;
 		    } else {
 			switch (msg) {
 			    case 'b': 
@@ -1347,42 +1591,70 @@ you_win:
 
 			    case 'g': 
 				add_garbage(&g[P]);
-				play_sound(ss[P],SOUND_GARBAGE1,1);
+				play_sound(ss[P],SOUND_GARBAGE1,0);
 				draw_grid(screen,cs[P],&g[P],State[P].draw);
 				      break;
+			    case NET_PING:
+				if (Network_ReadPing(sock, !State[P].limbo))
+				    link_lost = 1;
+				break;
+			    case NET_PONG:
+				if (Network_ReadPong(sock))
+				    link_lost = 1;
+				break;
+
 			    case 's':
-				  recv(sock,(char *)&Score[1], sizeof(Score[1]),0);
-				  draw_score(screen, 1);
+				  if (Network_RecvInt(sock,&Score[1]))
+				      link_lost = 1;
+				  else
+				      draw_score(screen, 1);
+				  break;
+			    case 'c':
+				  if (read_remote_grid(sock, screen, cs[!P], &g[!P]))
+				      link_lost = 1;
+				  break;
+			    case NET_PIECE:
+			    case NET_MOVE:
+				  if (Rollback_Input(sock, msg, screen, ps,
+					      cs[!P], &g[!P]))
+				      link_lost = 1;
 				  break;
-			    case 'c':  { int i,j;
-				      memcpy(g[!P].temp,g[!P].contents,
-					      sizeof(*g[0].temp) *
-					      g[!P].w * g[!P].h);
-				      recv(sock,g[!P].contents,
-					      sizeof(*g[!P].contents) *
-					      g[!P].w * g[!P].h,0);
-				      for (i=0;i<g[!P].w;i++)
-					  for (j=0;j<g[!P].h;j++)
-					      if (GRID_CONTENT(g[!P],i,j) != TEMP_CONTENT(g[1],i,j)){
-						  GRID_CHANGED(g[!P],i,j)=1;
-						  if (i > 0) GRID_CHANGED(g[!P],i-1,j) = 1;
-						  if (j > 0) GRID_CHANGED(g[!P],i,j-1) = 1;
-						  if (i < g[!P].w-1) GRID_CHANGED(g[!P],i+1,j) = 1;
-						  if (i < g[!P].h-1) GRID_CHANGED(g[!P],i,j+1) = 1;
-						  if (GRID_CONTENT(g[!P],i,j) == 0) GRID_SET(g[!P],i,j,REMOVE_ME);
-						  }
-				      draw_grid(screen,cs[!P],&g[!P],1);
-				       }
-				      break;
 			    default: break;
 			}
 		    }
+		    if (link_lost) 
+			retval = 0;
 		}
 	    } while (retval > 0 && 
 		    !(State[P].limbo && State[P].other_in_limbo));
 
+	    /* show where we think their piece is by now */
+	    if (!paused)
+		Rollback_Advance(screen, cs[!P], &g[!P]);
+
+	    /* we ping every second, so silence means the link is dead */
+	    if (!link_lost && !State[P].limbo && 
+		    SDL_GetTicks() - NetStats.last_recv > NET_LINK_TIMEOUT) {
+		Debug("WARNING: no word from the other player in %d ms.\n",
+			SDL_GetTicks() - NetStats.last_recv);
+		link_lost = 1;
+	    }
+	    if (link_lost) {
+		sock = reconnect_match(screen, cs, g, P, adjust, &paused,
+			&pause_begin_time, seconds_remaining, &tv_start);
+		tv_now = SDL_GetTicks();
+	    }
+
 	    /* limbo handling */
-	    if (State[P].limbo && State[P].other_in_limbo) {
+	    if (!sock) {
+		/* the other player has left: play on alone, unless we have
+		 * nothing left to play for */
+		Debug("WARNING: Other player has left?\n");
+		if (State[P].limbo) {
+		    stop_playing_sound(ss[0],SOUND_CLOCK);
+		    return 0;
+		}
+	    } else if (State[P].limbo && State[P].other_in_limbo) {
 		Assert(adjust[0] != -1 && adjust[1] != -1);
 		stop_playing_sound(ss[0],SOUND_CLOCK);
 		if (NUM_PLAYER == 2) stop_playing_sound(ss[1],SOUND_CLOCK);
@@ -1391,7 +1663,7 @@ you_win:
 		    !State[P].limbo_sent) {
 		char msg = adjust[P]; /* WRW: send update */
 		State[P].limbo_sent = 1;
-		send(sock,&msg,1,0);
+		Network_Send(sock,&msg,1);
 	    } else if (!State[P].limbo && State[P].other_in_limbo) {
 		char msg; /* WRW: send update */
 		/* hmm, other guy is done ... */
@@ -1413,17 +1685,22 @@ you_win:
 		State[P].limbo = 1;
 		State[P].limbo_sent = 1;
 		msg = adjust[P];
-		send(sock,&msg,1,0);
+		Network_Send(sock,&msg,1);
 		stop_playing_sound(ss[0],SOUND_CLOCK);
 		if (NUM_PLAYER == 2) stop_playing_sound(ss[1],SOUND_CLOCK);
 		return 0;
 	    }
+	    PROFILE_END(PROF_NET);
 	}
 	if (paused) {
 	    atris_run_flame();
 	}
 
+	atris_flush_updates();
+
 	tv_now = SDL_GetTicks();
+	if (sock)
+	    Network_NoteFrame(tv_now - tv_frame);
 	{
 	    Uint32 least = State[0].tv_next_fall;
 
@@ -1443,24 +1720,33 @@ you_win:
 		if (State[1].ai && State[1].tv_next_ai_move < least)
 		    least = State[1].tv_next_ai_move;
 	    }
+	    /* with --refresh, drawing may be waiting for the next refresh */
+	    if (atris_next_present() && atris_next_present() < least)
+		least = atris_next_present();
+	    /* the clocks above stand still while we are paused: only the
+	     * flame has anything to do, so sleep until it does */
+	    if (paused) {
+		Uint32 wait = atris_flame_wait();
+		least = tv_now + (wait ? wait : 1);
+	    }
 
-	    if (least >= tv_now + 4 && !SDL_PollEvent(NULL)) {
+	    if (least >= tv_now + 4 && !paused && !SDL_PollEvent(NULL)) {
 		/* hey, we could sleep for two ... */
 		if (State[0].ai || State[1].ai) {
-		    SDL_Delay(1);
+		    nap(1);
 		    if (State[0].ai && State[0].draw) {
 			int row, col;
 			screen_to_grid_coords(&g[0], blockWidth, pos[0].x, pos[0].y, &row, &col);
 			AI[0]->think(State[0].ai_state, &g[0], &State[0].cp, &State[0].np, col, row, pos[0].rot);
-		    } else SDL_Delay(1);
+		    } else nap(1);
 		    if (State[1].ai && State[1].draw) {
 			int row, col;
 			screen_to_grid_coords(&g[1], blockWidth, pos[1].x, pos[1].y, &row, &col);
 			AI[1]->think(State[1].ai_state, &g[1], &State[1].cp, &State[1].np, col, row, pos[1].rot);
-		    } else SDL_Delay(1);
-		} else SDL_Delay(2);
+		    } else nap(1);
+		} else nap(2);
 	    } else if (least > tv_now && !SDL_PollEvent(NULL))
-		SDL_Delay(least - tv_now);
+		nap(least - tv_now);
 	}
     } 
 }
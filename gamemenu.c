@@ -102,7 +102,7 @@ static int OptionsMenu_action(WalkRadio *wr)
 {
     switch (wr->defaultchoice) {
 	case Opt_ToggleFullScreen:
-	    SDL_WM_ToggleFullScreen(screen);
+	    SDL_WM_ToggleFullScreen(SDL_GetVideoSurface());
 	    break;
 	case Opt_ToggleFlame: Options.flame_wanted = ! Options.flame_wanted; break;
 	case Opt_ToggleSpecial: Options.special_wanted = ! Options.special_wanted; break;
@@ -122,6 +122,7 @@ static int OptionsMenu_action(WalkRadio *wr)
 static int ColorStyleMenu_action(WalkRadio *wr)
 {
     _cs->choice = wr->defaultchoice;
+    use_color_style(_cs->style[_cs->choice]);
     /* Update this choice on the main menu */
     updateMenu((int)ColorStyleMenu, wr->defaultchoice);
     return 1;
@@ -129,6 +130,7 @@ static int ColorStyleMenu_action(WalkRadio *wr)
 static int SoundStyleMenu_action(WalkRadio *wr) 
 {
     _ss->choice = wr->defaultchoice;
+    use_sound_style(_ss->style[_ss->choice]);
     play_all_sounds(_ss->style[_ss->choice]);
     /* Update this choice on the main menu */
     updateMenu((int)SoundStyleMenu, wr->defaultchoice);
@@ -202,7 +204,7 @@ menu_handler(const SDL_Event *event)
 	    case SDLK_RETURN:
                 if ((event->key.keysym.mod & KMOD_LCTRL) ||
                     (event->key.keysym.mod & KMOD_RCTRL)) {
-                  SDL_WM_ToggleFullScreen(screen);
+                  SDL_WM_ToggleFullScreen(SDL_GetVideoSurface());
                   return 1;
                 }
 
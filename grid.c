@@ -12,6 +12,15 @@
 #include "grid.h"
 #include "options.h"
 #include "piece.h"
+#include "profile.h"
+
+/* the falling sprites, one per board being drawn (see draw_falling()) */
+#define SPRITES 2
+static struct {
+    const unsigned char *owner;	/* the contents of the grid it is for */
+    SDL_Surface *sprite;
+} Sprite[SPRITES];
+static int last_sprite = 0;
 
 /***************************************************************************
  *      cleanup_grid()
@@ -67,6 +76,49 @@ generate_board(int w, int h, int level)
     return retval;
 }
 
+/***************************************************************************
+ *      grid_snapshot()
+ * Copies the board contents of "g" into "copy", which must have come
+ * from generate_board() with the same size. Nothing is allocated, so this
+ * is cheap enough to do every time we might want to take something back.
+ *********************************************************************PROTO*/
+void
+grid_snapshot(Grid *copy, Grid *g)
+{
+    int len = g->w * g->h;
+
+    Assert(copy->w == g->w && copy->h == g->h);
+    memcpy(copy->contents, g->contents, len * sizeof(*g->contents));
+    memcpy(copy->fall, g->fall, len * sizeof(*g->fall));
+}
+
+/***************************************************************************
+ *      grid_restore()
+ * Puts a board back the way grid_snapshot() found it. Squares that differ
+ * (and their neighbours, for the edges) are marked changed so that the
+ * next draw_grid() shows the difference.
+ *********************************************************************PROTO*/
+void
+grid_restore(Grid *g, Grid *copy)
+{
+    int i,j;
+
+    Assert(copy->w == g->w && copy->h == g->h);
+    for (j=0;j<g->h;j++)
+	for (i=0;i<g->w;i++) {
+	    int was = GRID_CONTENT(*copy,i,j);
+	    FALL_SET(*g,i,j,FALL_CONTENT(*copy,i,j));
+	    if (GRID_CONTENT(*g,i,j) == was ||
+		    (was == 0 && GRID_CONTENT(*g,i,j) == REMOVE_ME))
+		continue;
+	    GRID_SET(*g,i,j,was ? was : REMOVE_ME);
+	    if (i > 0) GRID_CHANGED(*g,i-1,j) = 1;
+	    if (j > 0) GRID_CHANGED(*g,i,j-1) = 1;
+	    if (i < g->w-1) GRID_CHANGED(*g,i+1,j) = 1;
+	    if (j < g->h-1) GRID_CHANGED(*g,i,j+1) = 1;
+	}
+}
+
 /***************************************************************************
  *      add_garbage()
  * Adds garbage to the given board. Pushes all of the lines up, adds the
@@ -108,6 +160,53 @@ add_garbage(Grid *g)
     return;
 }
 
+/***************************************************************************
+ *      edge_mask()
+ * Which edges does the square at (i,j), color "c", show? Squares that
+ * are different colors or are falling differently get an edge between
+ * them: the EDGE_* bits, for EDGED_TILE().
+ ***************************************************************************/
+static int
+edge_mask(Grid *g, int i, int j, int c)
+{
+    int fall = FALL_CONTENT(*g,i,j);
+    int mask = 0;
+
+    int that_precolor = (j == 0) ? 0 : 
+	GRID_CONTENT(*g,i,j-1);
+    int that_fall = (j == 0) ? -1 :
+	FALL_CONTENT(*g,i,j-1);
+    /* light up */
+    if (that_precolor != c || that_fall != fall)
+	mask |= EDGE_LIGHT_UP;
+
+    /* light left */
+    that_precolor = (i == 0) ? 0 :
+	GRID_CONTENT(*g,i-1,j);
+    that_fall = (i == 0) ? -1 :
+	FALL_CONTENT(*g,i-1,j);
+    if (that_precolor != c || that_fall != fall)
+	mask |= EDGE_LIGHT_LEFT;
+    
+    /* shadow down */
+    that_precolor = (j == g->h-1) ? 0 :
+	GRID_CONTENT(*g,i,j+1);
+    that_fall = (j == g->h-1) ? -1 :
+	FALL_CONTENT(*g,i,j+1);
+    if (that_precolor != c || that_fall != fall)
+	mask |= EDGE_DARK_DOWN;
+
+    /* shadow right */
+    that_precolor = (i == g->w-1) ? 0 :
+	GRID_CONTENT(*g,i+1,j);
+    that_fall = (i == g->w-1) ? -1 :
+	FALL_CONTENT(*g,i+1,j);
+    if (that_precolor != c || that_fall != fall)
+	mask |= EDGE_DARK_RIGHT;
+
+    return mask;
+}
+
 /***************************************************************************
  *      draw_grid()
  * Draws the main grid board. This involves drawing all of the pieces (and
@@ -123,6 +222,8 @@ draw_grid(SDL_Surface *screen, color_style *cs, Grid *g, int draw)
     SDL_Rect r,s;
     int i,j;
     int mini=20, minj=20, maxi=-1, maxj=-1;
+
+    PROFILE_BEGIN(PROF_GRID);
     for (j=g->h-1;j>=0;j--) {
 	for (i=g->w-1;i>=0;i--) {
 	    int c = GRID_CONTENT(*g,i,j);
@@ -136,69 +237,9 @@ draw_grid(SDL_Surface *screen, color_style *cs, Grid *g, int draw)
 		s.w = cs->w;
 		s.h = cs->h;
 
-		SDL_BlitSafe(cs->color[c], NULL, screen, &s);
-
-		{
-		    int fall = FALL_CONTENT(*g,i,j);
-
-		    int that_precolor = (j == 0) ? 0 : 
-			GRID_CONTENT(*g,i,j-1);
-		    int that_fall = (j == 0) ? -1 :
-			FALL_CONTENT(*g,i,j-1);
-		    /* light up */
-		    if (that_precolor != c || that_fall != fall) {
-			r.x = g->board.x + i * cs->w;
-			r.y = g->board.y + j * cs->h;
-			r.h = edge[HORIZ_LIGHT]->h;
-			r.w = edge[HORIZ_LIGHT]->w;
-			SDL_BlitSafe(edge[HORIZ_LIGHT],NULL,
-				    screen, &r);
-		    }
-
-		    /* light left */
-		    that_precolor = (i == 0) ? 0 :
-			GRID_CONTENT(*g,i-1,j);
-		    that_fall = (i == 0) ? -1 :
-			FALL_CONTENT(*g,i-1,j);
-		    if (that_precolor != c || that_fall != fall) {
-			r.x = g->board.x + i * cs->w;
-			r.y = g->board.y + j * cs->h;
-			r.h = edge[VERT_LIGHT]->h;
-			r.w = edge[VERT_LIGHT]->w;
-			SDL_BlitSafe(edge[VERT_LIGHT],NULL,
-				    screen,&r);
-		    }
-		    
-		    /* shadow down */
-		    that_precolor = (j == g->h-1) ? 0 :
-			GRID_CONTENT(*g,i,j+1);
-		    that_fall = (j == g->h-1) ? -1 :
-			FALL_CONTENT(*g,i,j+1);
-		    if (that_precolor != c || that_fall != fall) {
-			r.x = g->board.x + i * cs->w;
-			r.y = (g->board.y + (j+1) * cs->h) 
-			    - edge[HORIZ_DARK]->h;
-			r.h = edge[HORIZ_DARK]->h;
-			r.w = edge[HORIZ_DARK]->w;
-			SDL_BlitSafe(edge[HORIZ_DARK],NULL,
-				    screen,&r);
-		    }
-
-		    /* shadow right */
-		    that_precolor = (i == g->w-1) ? 0 :
-			GRID_CONTENT(*g,i+1,j);
-		    that_fall = (i == g->w-1) ? -1 :
-			FALL_CONTENT(*g,i+1,j);
-		    if (that_precolor != c || that_fall != fall) {
-			r.x = (g->board.x + (i+1) * cs->w) 
-			    - edge[VERT_DARK]->w;
-			r.y = (g->board.y + (j) * cs->h);
-			r.h = edge[VERT_DARK]->h;
-			r.w = edge[VERT_DARK]->w;
-			SDL_BlitSafe(edge[VERT_DARK],NULL,
-				    screen,&r);
-		    }
-		} /* endof: hikari to kage */
+		/* one blit for the block and its edges */
+		EDGED_TILE(cs,edge_mask(g,i,j,c),r);
+		SDL_BlitSafe(cs->edged[c], &r, screen, &s);
 		/* SDL_UpdateSafe(screen, 1, &s); */
 		GRID_CHANGED(*g,i,j) = 0;
 	    } else if (c == REMOVE_ME) {
@@ -223,75 +264,135 @@ draw_grid(SDL_Surface *screen, color_style *cs, Grid *g, int draw)
     s.w = (maxi - mini + 1) * cs->w;
     s.h = (maxj - minj + 1) * cs->h;
     if (draw && maxi >  -1) SDL_UpdateSafe(screen,1,&s);
+    PROFILE_END(PROF_GRID);
     return;
 }
 
+/***************************************************************************
+ *      draw_falling_sprite()
+ * Draws every falling square, just as draw_grid() would, into a sprite
+ * for this grid and returns it. The sprite is a board-sized surface; only
+ * the falling squares in it mean anything. If "redraw" is not set and the
+ * grid already has one, that is returned as it is.
+ *
+ * The sprites are kept here rather than in the Grid: boards come and go
+ * with every match, but there are only ever two on the screen.
+ ***************************************************************************/
+static SDL_Surface *
+draw_falling_sprite(SDL_Surface *screen, color_style *cs, Grid *g, int redraw)
+{
+    SDL_Rect r,s;
+    int i,j,k;
+    SDL_Surface *sprite;
+
+    for (k=0; k<SPRITES && Sprite[k].owner != g->contents; k++)
+	;
+    if (k == SPRITES) {	/* a new board: take the other one's place */
+	k = (last_sprite + 1) % SPRITES;
+	Sprite[k].owner = g->contents;
+	redraw = 1;
+    }
+    last_sprite = k;
+    if (!redraw)
+	return Sprite[k].sprite;
+
+    if (Sprite[k].sprite && (Sprite[k].sprite->w != g->w * cs->w ||
+		Sprite[k].sprite->h != g->h * cs->h ||
+		Sprite[k].sprite->format->BitsPerPixel !=
+		screen->format->BitsPerPixel)) {
+	SDL_FreeSurface(Sprite[k].sprite);
+	Sprite[k].sprite = NULL;
+    }
+    if (!Sprite[k].sprite) {
+	Sprite[k].sprite = SDL_CreateRGBSurface(SDL_SWSURFACE,
+		g->w * cs->w, g->h * cs->h, screen->format->BitsPerPixel, 
+		screen->format->Rmask, screen->format->Gmask, 
+		screen->format->Bmask, screen->format->Amask);
+	if (!Sprite[k].sprite)
+	    PANIC("Could not create the falling sprite");
+    }
+    sprite = Sprite[k].sprite;
+
+    for (j=0;j<g->h;j++)
+	for (i=0;i<g->w;i++) {
+	    int c = GRID_CONTENT(*g,i,j);
+	    if (c && c != REMOVE_ME && FALL_CONTENT(*g,i,j) == FALLING) {
+		s.x = i * cs->w;
+		s.y = j * cs->h;
+		s.w = cs->w;
+		s.h = cs->h;
+		EDGED_TILE(cs,edge_mask(g,i,j,c),r);
+		SDL_BlitSafe(cs->edged[c], &r, sprite, &s);
+	    }
+	}
+    return sprite;
+}
+
 /***************************************************************************
  *      draw_falling()
  * Draws the falling pieces on the main grid. Offset should range from 1 to
  * the size of the color tiles -- the falling pieces are drawn that far
  * down out of their "real" places. This gives a smooth animation effect.
+ *
+ * The falling squares are drawn into a sprite once, at offset 1; after
+ * that each step just places a copy of each falling column.
  *********************************************************************PROTO*/
 void
-draw_falling(SDL_Surface *screen, int blockWidth, Grid *g, int offset)
+draw_falling(SDL_Surface *screen, color_style *cs, Grid *g, int offset)
 {
     SDL_Rect s;
     SDL_Rect r;  
     int i,j;
     int mini=100000, minj=100000, maxi=-1, maxj=-1;
 
-    int cj;	/* cluster right, cluster bottom */
+    int top;	/* of this run of falling squares */
+    SDL_Surface *sprite;
 
-    memset(g->temp, 0, sizeof(*g->temp)*g->w*g->h);
+#define IS_FALLING(i,j) (GRID_CONTENT(*g,i,j) && \
+	GRID_CONTENT(*g,i,j) != REMOVE_ME && FALL_CONTENT(*g,i,j) == FALLING)
 
-    for (j=0;j<g->h;j++) {
-	for (i=0;i<g->w;i++) {
-	    int c = GRID_CONTENT(*g,i,j);
-	    if (c && FALL_CONTENT(*g,i,j) == FALLING &&
-		    TEMP_CONTENT(*g,i,j) == 0) {
-
-		for (cj = j; GRID_CONTENT(*g,i,cj) &&
-			FALL_CONTENT(*g,i,cj) &&
-			TEMP_CONTENT(*g,i,cj) == 0 &&
-			cj < g->h; cj++)
-		    TEMP_CONTENT(*g,i,cj) = 1;
-
-		/* source == up */
-		s.x = g->board.x + (i * blockWidth);
-		s.y = g->board.y + (j * blockWidth) + offset - 1;
-		s.w = blockWidth;
-		s.h = blockWidth * (cj - j + 1); 
-
-		/* dest == down */
-		r.x = g->board.x + (i * blockWidth);
-		r.y = g->board.y + (j * blockWidth) + offset;
-		r.w = blockWidth;
-		r.h = blockWidth * (cj - j + 1); 
-
-		/* just blit the screen down a notch */
-		SDL_BlitSafe(screen, &s, screen, &r);
-
-		if (s.x < mini) mini = s.x; 
-		if (s.y < minj) minj = s.y;
-		if (s.x+s.w > maxi) maxi = s.x+s.w; 
-		if (s.y+s.h > maxj) maxj = s.y+s.h;
-
-		/* clear! */
-		if (j == 0 || FALL_CONTENT(*g,i,j-1) == NOT_FALLING ||
-			GRID_CONTENT(*g,i,j-1) == 0) {
-		    s.h = 1;
-		    SDL_BlitSafe(widget_layer, &s, screen, &s);
-		    /*  SDL_UpdateSafe(screen, 1, &s); */
-		}
-	    }
+    PROFILE_BEGIN(PROF_FALLING);
+    sprite = draw_falling_sprite(screen, cs, g, offset == 1);
+
+    for (i=0;i<g->w;i++) {
+	for (j=0;j<g->h;j++) {
+	    if (!IS_FALLING(i,j))
+		continue;
+	    for (top = j; j+1 < g->h && IS_FALLING(i,j+1); j++)
+		;
+
+	    /* the squares they left behind */
+	    s.x = g->board.x + (i * cs->w);
+	    s.y = g->board.y + (top * cs->h);
+	    s.w = cs->w;
+	    s.h = offset;
+	    SDL_BlitSafe(widget_layer, &s, screen, &s);
+
+	    /* source == the sprite, dest == down */
+	    r.x = i * cs->w;
+	    r.y = top * cs->h;
+	    r.w = cs->w;
+	    r.h = (j - top + 1) * cs->h;
+	    s.x = g->board.x + r.x;
+	    s.y = g->board.y + r.y + offset;
+	    s.w = r.w;
+	    s.h = r.h;
+	    SDL_BlitSafe(sprite, &r, screen, &s);
+
+	    if (s.x < mini) mini = s.x; 
+	    if (s.y - offset < minj) minj = s.y - offset;
+	    if (s.x+s.w > maxi) maxi = s.x+s.w; 
+	    if (s.y+s.h > maxj) maxj = s.y+s.h;
 	}
     }
+#undef IS_FALLING
 
     s.x = mini;
     s.y = minj;
-    s.w = maxi - mini + 1;
-    s.h = maxj - minj + 1;
+    s.w = maxi - mini;
+    s.h = maxj - minj;
     if (maxi >  -1) SDL_UpdateSafe(screen,1,&s);
+    PROFILE_END(PROF_FALLING);
     return;
 }
 
@@ -84,7 +84,7 @@ input_string(SDL_Surface *screen, int x, int y, int opaque)
 		flip_when = SDL_GetTicks() + 400;
 		blink = !blink;
 	    }
-	    if (SDL_PollEvent(&event)) {
+	    if (atris_wait_event(&event, atris_flame_wait())) {
 		if (event.type == SDL_KEYDOWN) {
 		    changed = 1;
 		    switch (event.key.keysym.sym) {
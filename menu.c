@@ -323,8 +323,11 @@ handle_radio_event(WalkRadioGroup *wrg, const SDL_Event *ev)
 {
     int i, ret;
     if (ev->type == SDL_MOUSEBUTTONDOWN) {
+	Uint16 x = ev->button.x, y = ev->button.y;
+
+	logical_position(&x, &y);
 	for (i=0; i<wrg->n; i++) {
-	    if (check_radio(&wrg->wr[i], ev->button.x, ev->button.y)) {
+	    if (check_radio(&wrg->wr[i], x, y)) {
 		if (i != wrg->cur) {
 		    draw_radio(&wrg->wr[wrg->cur], 0);
 		}
@@ -0,0 +1,534 @@
+/*
+ *                               Alizarin Tetris
+ * A network link simulator for testing network play on one machine.
+ *
+ * It sits between a client and a server as a TCP proxy and makes the
+ * loopback link look like a bad one: latency, jitter, a bandwidth cap,
+ * fragmentation and reordering. With --spawn it also starts two headless
+ * AI players (atris --net-server / --net-client) through itself and
+ * reports how the protocol coped.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+#include "config.h"	/* go autoconf! */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+
+#define CHUNK_MAX	4096
+#define QUEUE_SECONDS	1	/* with --bandwidth, how much the wire holds */
+
+typedef struct chunk_struct {
+    struct chunk_struct *next;
+    long	arrived;	/* when we read it, ms */
+    long	due;		/* when it may go out, ms */
+    int		len;
+    int		off;		/* how much of it already went out */
+    char	data[1];
+} chunk;
+
+typedef struct direction_struct {
+    char	*name;
+    int		from, to;	/* sockets */
+    chunk	*head, *tail;
+    long	link_free;	/* bandwidth cap: when the wire is free, ms */
+    int		queued;		/* bytes waiting */
+
+    /* what happened */
+    long	bytes;
+    long	chunks;
+    long	held;		/* chunks held back to simulate reordering */
+    long	delay_total;	/* sum over chunks of (sent - arrived), ms */
+    long	delay_max;
+    int		queued_max;
+} direction;
+
+static struct {
+    int		listen_port;
+    char	*server_host;
+    int		server_port;
+    int		latency;	/* one-way, ms */
+    int		jitter;		/* plus up to this much, ms */
+    int		bandwidth;	/* bytes per second, 0 for no cap */
+    int		fragment;	/* largest write, 0 for no limit */
+    int		reorder;	/* percent of chunks that are held back */
+    int		cut;		/* drop the connection once after this many s */
+    char	*spawn;		/* atris binary to run, or NULL */
+    int		matches;
+    char	*stats;		/* prefix for the players' --netstats files */
+} Sim;
+
+static long start_time;
+static int cut_done = 0;
+
+/***************************************************************************
+ *      now_ms()
+ * Milliseconds since we started.
+ ***************************************************************************/
+static long
+now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000L + tv.tv_usec / 1000) - start_time;
+}
+
+/***************************************************************************
+ *      usage()
+ * Display summary usage information.
+ ***************************************************************************/
+static void
+usage(void)
+{
+    printf("\n\t\tatris-netsim -- network link simulator for atris\n"
+	   "Usage: atris-netsim [options]\n"
+	   "\t--listen=PORT\t\tAccept the client here (default 7742).\n"
+	   "\t--server=HOST[:PORT]\tForward to this server (default localhost:7741).\n"
+	   "\t--latency=MS\t\tOne-way delay added to everything (default 0).\n"
+	   "\t--jitter=MS\t\tPlus a random extra delay of up to MS.\n"
+	   "\t--bandwidth=BPS\t\tCap each direction at BPS bytes per second;\n"
+	   "\t\t\t\tthe sender waits once a second's worth is queued.\n"
+	   "\t--fragment=N\t\tDeliver data in pieces of at most N bytes.\n"
+	   "\t--reorder=PCT\t\tHold back PCT%% of the pieces (see below).\n"
+	   "\t--cut=S\t\t\tDrop both connections once, S seconds in.\n"
+	   "\t--spawn=ATRIS\t\tRun two headless AI players through the proxy.\n"
+	   "\t--matches=N\t\tWith --spawn: how many matches (default 3).\n"
+	   "\t--stats=PREFIX\t\tWith --spawn: players write PREFIX.server\n"
+	   "\t\t\t\tand PREFIX.client (see atris --netstats).\n"
+	   "\nTCP never hands bytes to the game out of order, so a reordered\n"
+	   "segment shows up as a head-of-line stall: the held-back piece and\n"
+	   "everything behind it arrive late, together.\n");
+    exit(1);
+}
+
+/***************************************************************************
+ *      parse_options()
+ * Check the command-line arguments.
+ ***************************************************************************/
+static void
+parse_options(int argc, char *argv[])
+{
+    int i;
+
+    Sim.listen_port = 7742;
+    Sim.server_host = "localhost";
+    Sim.server_port = 7741;
+    Sim.matches = 3;
+
+    for (i=1; i<argc; i++) {
+	char *val = strchr(argv[i], '=');
+	if (val) val++;
+
+	if (!strncmp(argv[i],"--listen=", 9))
+	    Sim.listen_port = atoi(val);
+	else if (!strncmp(argv[i],"--server=", 9)) {
+	    char *colon;
+	    Sim.server_host = val;
+	    if ((colon = strchr(val, ':'))) {
+		*colon = 0;
+		Sim.server_port = atoi(colon+1);
+	    }
+	} else if (!strncmp(argv[i],"--latency=", 10))
+	    Sim.latency = atoi(val);
+	else if (!strncmp(argv[i],"--jitter=", 9))
+	    Sim.jitter = atoi(val);
+	else if (!strncmp(argv[i],"--bandwidth=", 12))
+	    Sim.bandwidth = atoi(val);
+	else if (!strncmp(argv[i],"--fragment=", 11))
+	    Sim.fragment = atoi(val);
+	else if (!strncmp(argv[i],"--reorder=", 10))
+	    Sim.reorder = atoi(val);
+	else if (!strncmp(argv[i],"--cut=", 6))
+	    Sim.cut = atoi(val);
+	else if (!strncmp(argv[i],"--spawn=", 8))
+	    Sim.spawn = val;
+	else if (!strncmp(argv[i],"--matches=", 10))
+	    Sim.matches = atoi(val);
+	else if (!strncmp(argv[i],"--stats=", 8))
+	    Sim.stats = val;
+	else {
+	    printf("option not understood: [%s]\n", argv[i]);
+	    usage();
+	}
+    }
+    if (Sim.fragment < 0 || Sim.fragment > CHUNK_MAX) Sim.fragment = 0;
+    if (Sim.reorder < 0) Sim.reorder = 0;
+    if (Sim.reorder > 100) Sim.reorder = 100;
+}
+
+/***************************************************************************
+ *      listen_on()
+ * Returns a listening socket on the given port.
+ ***************************************************************************/
+static int
+listen_on(int port)
+{
+    struct sockaddr_in addr;
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int val = 1;
+
+    if (sock < 0) { perror("socket"); exit(1); }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&val, sizeof(val));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(sock, 4)) {
+	perror("bind/listen");
+	exit(1);
+    }
+    return sock;
+}
+
+/***************************************************************************
+ *      dial()
+ * Connects to the server. Returns a socket or -1.
+ ***************************************************************************/
+static int
+dial(void)
+{
+    struct sockaddr_in addr;
+    struct hostent *host = gethostbyname(Sim.server_host);
+    int sock;
+    int val = 1;
+
+    if (!host) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr, host->h_addr_list[0], host->h_length);
+    addr.sin_port = htons(Sim.server_port);
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+	close(sock);
+	return -1;
+    }
+    /* we do our own batching */
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (void *)&val, sizeof(val));
+    return sock;
+}
+
+/***************************************************************************
+ *      enqueue()
+ * Splits freshly read data into pieces and decides when each may go out.
+ * Pieces never overtake each other: that is what TCP promises the game.
+ ***************************************************************************/
+static void
+enqueue(direction *d, char *buf, int len)
+{
+    long now = now_ms();
+    int piece = Sim.fragment ? Sim.fragment : len;
+    int off;
+
+    for (off = 0; off < len; off += piece) {
+	int n = (len - off < piece) ? len - off : piece;
+	chunk *c = malloc(sizeof(chunk) + n);
+	long due = now + Sim.latency;
+
+	if (!c) { perror("malloc"); exit(1); }
+	if (Sim.jitter > 0)
+	    due += rand() % (Sim.jitter + 1);
+	if (Sim.reorder && (rand() % 100) < Sim.reorder) {
+	    /* a lost or late segment: TCP holds everything behind it */
+	    due += Sim.latency + Sim.jitter + 20;
+	    d->held++;
+	}
+	if (d->tail && due < d->tail->due)
+	    due = d->tail->due;
+	if (Sim.bandwidth > 0) {
+	    if (due < d->link_free) due = d->link_free;
+	    d->link_free = due + (n * 1000L) / Sim.bandwidth;
+	}
+	c->next = NULL;
+	c->arrived = now;
+	c->due = due;
+	c->len = n;
+	c->off = 0;
+	memcpy(c->data, buf + off, n);
+	if (d->tail) d->tail->next = c; else d->head = c;
+	d->tail = c;
+	d->queued += n;
+	if (d->queued > d->queued_max) d->queued_max = d->queued;
+    }
+}
+
+/***************************************************************************
+ *      full()
+ * With a bandwidth cap, a direction holds at most QUEUE_SECONDS of data;
+ * after that we stop reading from the sender, so that its own socket
+ * buffers fill up and it has to wait, as it would on a real slow link.
+ ***************************************************************************/
+static int
+full(direction *d)
+{
+    long cap = (long) Sim.bandwidth * QUEUE_SECONDS;
+
+    if (Sim.bandwidth <= 0)
+	return 0;
+    if (cap < CHUNK_MAX)
+	cap = CHUNK_MAX;
+    return d->queued >= cap;
+}
+
+/***************************************************************************
+ *      flush()
+ * Sends whatever is due. Returns -1 if the receiving side went away.
+ ***************************************************************************/
+static int
+flush(direction *d)
+{
+    long now = now_ms();
+
+    while (d->head && d->head->due <= now) {
+	chunk *c = d->head;
+	int n = send(d->to, c->data + c->off, c->len - c->off, 0);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return 0;
+	if (n <= 0)
+	    return -1;
+	c->off += n;
+	d->queued -= n;
+	d->bytes += n;
+	if (c->off < c->len)
+	    return 0;
+	d->chunks++;
+	d->delay_total += now - c->arrived;
+	if (now - c->arrived > d->delay_max)
+	    d->delay_max = now - c->arrived;
+	d->head = c->next;
+	if (!d->head) d->tail = NULL;
+	free(c);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ *      drain()
+ * Throws away anything still queued (the connection is gone).
+ ***************************************************************************/
+static void
+drain(direction *d)
+{
+    while (d->head) {
+	chunk *c = d->head;
+	d->head = c->next;
+	free(c);
+    }
+    d->tail = NULL;
+    d->queued = 0;
+    d->link_free = 0;
+}
+
+/***************************************************************************
+ *      report()
+ * Prints what happened in one direction, as "key=value" pairs.
+ ***************************************************************************/
+static void
+report(direction *d)
+{
+    printf("netsim dir=%s bytes=%ld pieces=%ld held=%ld "
+	    "delay_mean_ms=%ld delay_max_ms=%ld queued_max=%d\n",
+	    d->name, d->bytes, d->chunks, d->held,
+	    d->chunks ? d->delay_total / d->chunks : 0, d->delay_max,
+	    d->queued_max);
+}
+
+/***************************************************************************
+ *      spawn()
+ * Runs one headless atris player. Returns its pid.
+ ***************************************************************************/
+static pid_t
+spawn(char *role, char *port_arg, char *stats_arg)
+{
+    char matches[32];
+    pid_t pid = fork();
+
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (pid > 0) return pid;
+
+    snprintf(matches, sizeof(matches), "--matches=%d", Sim.matches);
+    {
+	/* headless: no window, no sound card */
+	extern char **environ;
+	char *env[256];
+	int i, n = 0;
+
+	env[n++] = "SDL_VIDEODRIVER=dummy";
+	env[n++] = "SDL_AUDIODRIVER=dummy";
+	for (i = 0; environ[i] && n < 255; i++)
+	    if (strncmp(environ[i], "SDL_VIDEODRIVER=", 16) &&
+		    strncmp(environ[i], "SDL_AUDIODRIVER=", 16))
+		env[n++] = environ[i];
+	env[n] = NULL;
+	execle(Sim.spawn, Sim.spawn, "-q", "-n", role, port_arg, matches,
+		stats_arg, (char *)NULL, env);
+    }
+    perror(Sim.spawn);
+    _exit(127);
+}
+
+/***************************************************************************
+ *      main()
+ * Proxy between the client and the server until both are done.
+ ***************************************************************************/
+int
+main(int argc, char *argv[])
+{
+    direction up, down;	/* client->server, server->client */
+    int lsock;
+    int client = -1, server = -1;
+    pid_t server_pid = 0, client_pid = 0;
+    int running = 2;
+    long connected_at = -1;
+
+    start_time = 0;
+    start_time = now_ms();
+    signal(SIGPIPE, SIG_IGN);
+    parse_options(argc, argv);
+    srand(getpid());
+
+    memset(&up, 0, sizeof(up));
+    memset(&down, 0, sizeof(down));
+    up.name = "client_to_server";
+    down.name = "server_to_client";
+
+    lsock = listen_on(Sim.listen_port);
+
+    if (Sim.spawn) {
+	char sport[32], cport[64], sstats[256], cstats[256];
+	snprintf(sport, sizeof(sport), "--port=%d", Sim.server_port);
+	snprintf(cport, sizeof(cport), "--port=%d", Sim.listen_port);
+	snprintf(sstats, sizeof(sstats), "--netstats=%s.server",
+		Sim.stats ? Sim.stats : "netsim");
+	snprintf(cstats, sizeof(cstats), "--netstats=%s.client",
+		Sim.stats ? Sim.stats : "netsim");
+	Sim.server_host = "localhost";
+	server_pid = spawn("--net-server", sport, sstats);
+	sleep(1);	/* let it start listening */
+	client_pid = spawn("--net-client=localhost", cport, cstats);
+    }
+
+    while (1) {
+	fd_set read_fds;
+	struct timeval timeout = { 0, 1000 };	/* 1 ms resolution */
+	int maxfd = lsock;
+	char buf[CHUNK_MAX];
+
+	if (Sim.spawn) {
+	    int status;
+	    pid_t pid;
+	    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		printf("netsim %s exited with status %d\n",
+			pid == server_pid ? "server" : 
+			pid == client_pid ? "client" : "child",
+			WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		running--;
+	    }
+	    if (running <= 0)
+		break;
+	}
+
+	FD_ZERO(&read_fds);
+	FD_SET(lsock, &read_fds);
+	if (client >= 0) {
+	    if (!full(&up))
+		FD_SET(client, &read_fds);
+	    if (!full(&down))
+		FD_SET(server, &read_fds);
+	    if (client > maxfd) maxfd = client;
+	    if (server > maxfd) maxfd = server;
+	}
+	select(maxfd+1, &read_fds, NULL, NULL, &timeout);
+
+	if (FD_ISSET(lsock, &read_fds)) {
+	    int fresh = accept(lsock, NULL, NULL);
+	    if (fresh >= 0) {
+		/* a (re)connecting client replaces the old pair */
+		if (client >= 0) {
+		    close(client); close(server);
+		    drain(&up); drain(&down);
+		}
+		client = fresh;
+		server = dial();
+		if (server < 0) {
+		    printf("netsim cannot reach %s:%d\n", Sim.server_host,
+			    Sim.server_port);
+		    close(client);
+		    client = -1;
+		} else {
+		    int val = 1;
+		    setsockopt(client, IPPROTO_TCP, TCP_NODELAY,
+			    (void *)&val, sizeof(val));
+		    fcntl(client, F_SETFL, O_NONBLOCK);
+		    fcntl(server, F_SETFL, O_NONBLOCK);
+		    up.from = down.to = client;
+		    up.to = down.from = server;
+		    if (connected_at < 0) connected_at = now_ms();
+		    printf("netsim connected at %ld ms\n", now_ms());
+		}
+		continue;
+	    }
+	}
+	if (client < 0)
+	    continue;
+
+	if (FD_ISSET(client, &read_fds) || FD_ISSET(server, &read_fds)) {
+	    int gone = 0;
+	    if (FD_ISSET(client, &read_fds)) {
+		int n = recv(client, buf, sizeof(buf), 0);
+		if (n > 0) enqueue(&up, buf, n); else gone = 1;
+	    }
+	    if (FD_ISSET(server, &read_fds)) {
+		int n = recv(server, buf, sizeof(buf), 0);
+		if (n > 0) enqueue(&down, buf, n); else gone = 1;
+	    }
+	    if (gone) {
+		printf("netsim connection closed at %ld ms\n", now_ms());
+		close(client); close(server);
+		drain(&up); drain(&down);
+		client = server = -1;
+		if (!Sim.spawn)
+		    break;
+		continue;
+	    }
+	}
+	if (flush(&up) || flush(&down)) {
+	    printf("netsim connection lost at %ld ms\n", now_ms());
+	    close(client); close(server);
+	    drain(&up); drain(&down);
+	    client = server = -1;
+	    continue;
+	}
+
+	if (Sim.cut && !cut_done && connected_at >= 0 &&
+		now_ms() - connected_at >= Sim.cut * 1000L) {
+	    printf("netsim cutting the connection at %ld ms\n", now_ms());
+	    close(client); close(server);
+	    drain(&up); drain(&down);
+	    client = server = -1;
+	    cut_done = 1;
+	}
+    }
+
+    printf("netsim elapsed_ms=%ld latency=%d jitter=%d bandwidth=%d "
+	    "fragment=%d reorder=%d\n", now_ms(), Sim.latency, Sim.jitter,
+	    Sim.bandwidth, Sim.fragment, Sim.reorder);
+    report(&up);
+    report(&down);
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ *                               Alizarin Tetris
+ * Loopback tests for the network wire format (see network.c). Everything
+ * is sent down one end of a socketpair() and read back from the other,
+ * through the same routines play_NETWORK() uses. Exits with the number of
+ * failures, so that it can be run as a CMake test.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+#include "config.h"	/* go autoconf! */
+#include "atris.h"
+#include "network.h"
+
+#include <limits.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static int failures = 0;
+
+#define CHECK(cond, what) { if (!(cond)) { \
+    printf("FAIL line %d: %s (%s)\n", __LINE__, what, #cond); failures++; } }
+
+/***************************************************************************
+ *      test_ints()
+ * Varints at the edges of the int range, and the sizes they take.
+ ***************************************************************************/
+static void
+test_ints(int s[2])
+{
+    static const int v[] = { 0, 1, -1, 63, -64, 64, -65, INT_MAX, INT_MIN };
+    int n = sizeof(v) / sizeof(v[0]);
+    int i, got;
+
+    for (i=0; i<n; i++)
+	CHECK(Network_SendInt(s[0], v[i]) == 0, "send int");
+    for (i=0; i<n; i++) {
+	got = 12345;
+	CHECK(Network_RecvInt(s[1], &got) == 0, "recv int");
+	CHECK(got == v[i], "int round trip");
+    }
+
+    {
+	unsigned char buf[NET_VARINT_MAX];
+	CHECK(Network_PutVarint(buf, 0) == 1, "0 takes one byte");
+	CHECK(Network_PutVarint(buf, -1) == 1, "-1 takes one byte");
+	CHECK(Network_PutVarint(buf, INT_MAX) == NET_VARINT_MAX,
+		"INT_MAX takes the most");
+	CHECK(Network_PutVarint(buf, INT_MIN) == NET_VARINT_MAX,
+		"INT_MIN takes the most");
+    }
+}
+
+/***************************************************************************
+ *      test_bad_varint()
+ * A varint that never ends must be refused after NET_VARINT_MAX bytes,
+ * and must not eat whatever comes after them.
+ ***************************************************************************/
+static void
+test_bad_varint(int s[2])
+{
+    unsigned char junk[NET_VARINT_MAX + 1];
+    int got = 0;
+
+    memset(junk, 0x80, sizeof(junk));
+    junk[sizeof(junk) - 1] = 0x02;	/* the varint for 1 */
+    CHECK(Network_Send(s[0], junk, sizeof(junk)) == (int) sizeof(junk),
+	    "send junk");
+    CHECK(Network_RecvInt(s[1], &got) == -1, "overlong varint refused");
+    /* we stop reading at NET_VARINT_MAX, so the 1 is left */
+    CHECK(Network_RecvInt(s[1], &got) == 0 && got == 1,
+	    "the rest is still there");
+
+    /* and one that is cut off by the other side going away */
+    CHECK(Network_Send(s[0], junk, 2) == 2, "send truncated");
+    shutdown(s[0], SHUT_WR);
+    CHECK(Network_RecvInt(s[1], &got) == -1, "truncated varint refused");
+}
+
+/***************************************************************************
+ *      test_fixed()
+ * Fixed-width fields keep every bit.
+ ***************************************************************************/
+static void
+test_fixed(int s[2])
+{
+    static const Uint32 v32[] = { 0, 1, 0x7fffffff, 0x80000000, 0xffffffff,
+	0x01020304 };
+    static const Uint64 v64[] = { 0, 1, 0xffffffffULL, 0x100000000ULL,
+	0x8000000000000000ULL, 0xffffffffffffffffULL, 0x0102030405060708ULL };
+    unsigned char buf[8];
+    Uint32 g32;
+    Uint64 g64;
+    int i;
+
+    for (i=0; i<(int)(sizeof(v32)/sizeof(v32[0])); i++) {
+	CHECK(Network_SendU32(s[0], v32[i]) == 0, "send u32");
+	CHECK(Network_RecvU32(s[1], &g32) == 0 && g32 == v32[i],
+		"u32 round trip");
+    }
+    for (i=0; i<(int)(sizeof(v64)/sizeof(v64[0])); i++) {
+	CHECK(Network_SendU64(s[0], v64[i]) == 0, "send u64");
+	CHECK(Network_RecvU64(s[1], &g64) == 0 && g64 == v64[i],
+		"u64 round trip");
+    }
+    /* big-endian, whatever we are */
+    Network_PutU32(buf, 0x01020304);
+    CHECK(buf[0] == 1 && buf[3] == 4, "u32 byte order");
+    Network_PutU64(buf, 0x0102030405060708ULL);
+    CHECK(buf[0] == 1 && buf[7] == 8, "u64 byte order");
+}
+
+/***************************************************************************
+ *      test_seed()
+ * The per-match seed, as play_NETWORK() passes it, between servers with
+ * 32- and 64-bit time_t and clients with either: both ends must seed
+ * with the same 32 bits.
+ ***************************************************************************/
+static void
+test_seed(int s[2])
+{
+    static const Sint64 when[] = { 0, 1, 973000000, 0x7fffffff,
+	-1, (Sint64) 0x80000000U + 12345, 4102444800LL /* 2100 */ };
+    int i;
+
+    for (i=0; i<(int)(sizeof(when)/sizeof(when[0])); i++) {
+	Sint32 t32 = (Sint32) when[i];	/* what a 32-bit time_t holds */
+	Sint64 t64 = when[i];
+	Uint64 seed;
+
+	/* a 32-bit server: time_t widened to the wire's 64 bits */
+	CHECK(Network_SendU64(s[0], (Sint64) t32) == 0, "send seed32");
+	CHECK(Network_RecvU64(s[1], &seed) == 0, "recv seed32");
+	CHECK((Uint32) seed == (Uint32) t32, "32-bit server seed");
+
+	/* a 64-bit server */
+	CHECK(Network_SendU64(s[0], (Sint64) t64) == 0, "send seed64");
+	CHECK(Network_RecvU64(s[1], &seed) == 0, "recv seed64");
+	CHECK((Uint32) seed == (Uint32) t64, "64-bit server seed");
+
+	/* both kinds of server agree with each other on the low bits */
+	CHECK((Uint32) t32 == (Uint32) t64, "32/64 agree");
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int s[2];
+
+    (void) argc; (void) argv;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, s)) {
+	perror("socketpair");
+	return 1;
+    }
+    test_ints(s);
+    test_fixed(s);
+    test_seed(s);
+    test_bad_varint(s);	/* last: it hangs up */
+    close(s[0]);
+    close(s[1]);
+
+    printf("nettest: %d failure%s\n", failures, failures == 1 ? "" : "s");
+    return failures;
+}
@@ -7,6 +7,7 @@
 
 #include "config.h"	/* go autoconf! */
 #include "atris.h" 
+#include "network.h"
 
 #include <sys/types.h>
 #include <unistd.h>
@@ -39,6 +40,19 @@
 
 char *error_msg = NULL;
 
+net_stats NetStats;
+
+/* what we need to know to get a dropped match back */
+static struct session_struct {
+    int		server;		/* were we the listening side? */
+    char	*host;		/* if not, where the server lives */
+    int		port;
+    Uint32	token;		/* proves we are the same two players */
+    int		sock;		/* the current connection */
+    int		pending;	/* client: non-blocking connect in progress */
+    Uint32	next_attempt;	/* client: when to dial again */
+} Session;
+
 /***************************************************************************
  *	Server_AwaitConnection() 
  * Sets up the server side listening socket and awaits connections from the
@@ -171,7 +185,7 @@ Client_Connect(char *hoststr, int lport)
 
     memset(&addr, 0, sizeof(addr)); 
     addr.sin_family = AF_INET; /*host->h_addrtype;*/
-    memcpy(&addr.sin_addr, host->h_addr_list+0, host->h_length);
+    memcpy(&addr.sin_addr, host->h_addr_list[0], host->h_length);
     addr.sin_port=htons(port);
     mySock = socket(AF_INET, SOCK_STREAM, 0);
     if (mySock < 0) {
@@ -191,6 +205,588 @@ Client_Connect(char *hoststr, int lport)
     return mySock;
 }
 
+/***************************************************************************
+ *	Network_Send() 
+ * Sends a message to the other side, keeping track of how many bytes we
+ * have put on the wire. Returns the number of bytes sent or -1 on error.
+ *********************************************************************PROTO*/
+int
+Network_Send(int sock, const void *buf, int len)
+{
+    int retval = send(sock, (const char *)buf, len, 0);
+
+    if (retval > 0) {
+	NetStats.bytes_sent += retval;
+	NetStats.window_sent += retval;
+    }
+    return retval;
+}
+
+/***************************************************************************
+ *	Network_Recv() 
+ * Receives exactly "len" bytes from the other side (TCP is allowed to hand
+ * them to us in pieces). Returns the number of bytes received, which is
+ * less than "len" only if the connection went away.
+ *********************************************************************PROTO*/
+int
+Network_Recv(int sock, void *buf, int len)
+{
+    int got = 0;
+    int retval = 0;
+    Uint32 now;
+
+    while (got < len) {
+	retval = recv(sock, (char *)buf + got, len - got, 0);
+	if (retval <= 0) 
+	    break;
+	got += retval;
+    }
+    if (got == 0)
+	return retval;
+
+    now = SDL_GetTicks();
+    NetStats.bytes_recv += got;
+    NetStats.window_recv += got;
+    if (NetStats.start && (int)(now - NetStats.last_recv) > NetStats.gap_max)
+	NetStats.gap_max = now - NetStats.last_recv;
+    NetStats.last_recv = now;
+    return got;
+}
+
+/***************************************************************************
+ *	Network_PutU32() 
+ * Stores "v" as a four-byte big-endian quantity. Returns the number of
+ * bytes written.
+ *
+ * Everything that goes over the wire is encoded with these routines so
+ * that the byte order and word size of the two machines do not matter.
+ *********************************************************************PROTO*/
+int
+Network_PutU32(unsigned char *buf, Uint32 v)
+{
+    buf[0] = (v >> 24) & 0xff;
+    buf[1] = (v >> 16) & 0xff;
+    buf[2] = (v >>  8) & 0xff;
+    buf[3] = (v      ) & 0xff;
+    return 4;
+}
+
+/***************************************************************************
+ *	Network_GetU32() 
+ * Reads a four-byte big-endian quantity.
+ *********************************************************************PROTO*/
+Uint32
+Network_GetU32(const unsigned char *buf)
+{
+    return ((Uint32)buf[0] << 24) | ((Uint32)buf[1] << 16) |
+	   ((Uint32)buf[2] <<  8) | ((Uint32)buf[3]);
+}
+
+/***************************************************************************
+ *	Network_PutU64() 
+ * Stores "v" as an eight-byte big-endian quantity. Returns the number of
+ * bytes written.
+ *********************************************************************PROTO*/
+int
+Network_PutU64(unsigned char *buf, Uint64 v)
+{
+    Network_PutU32(buf, (Uint32)(v >> 32));
+    Network_PutU32(buf + 4, (Uint32)v);
+    return 8;
+}
+
+/***************************************************************************
+ *	Network_GetU64() 
+ * Reads an eight-byte big-endian quantity.
+ *********************************************************************PROTO*/
+Uint64
+Network_GetU64(const unsigned char *buf)
+{
+    return ((Uint64)Network_GetU32(buf) << 32) | Network_GetU32(buf + 4);
+}
+
+/***************************************************************************
+ *	Network_PutVarint() 
+ * Stores the signed value "v" as a zigzag varint: small magnitudes (like
+ * most scores and levels) take a single byte, and nothing takes more than
+ * NET_VARINT_MAX. Returns the number of bytes written.
+ *********************************************************************PROTO*/
+int
+Network_PutVarint(unsigned char *buf, Sint32 v)
+{
+    Uint32 z = ((Uint32)v << 1) ^ (Uint32)(v < 0 ? -1 : 0);
+    int n = 0;
+
+    while (z >= 0x80) {
+	buf[n++] = (z & 0x7f) | 0x80;
+	z >>= 7;
+    }
+    buf[n++] = z;
+    return n;
+}
+
+/***************************************************************************
+ *	Network_GetVarint() 
+ * Decodes a zigzag varint from the first "len" bytes of "buf". Returns the
+ * number of bytes consumed, or 0 if the encoding is incomplete or too long.
+ *********************************************************************PROTO*/
+int
+Network_GetVarint(const unsigned char *buf, int len, Sint32 *v)
+{
+    Uint32 z = 0;
+    int n;
+
+    for (n = 0; n < len && n < NET_VARINT_MAX; n++) {
+	z |= (Uint32)(buf[n] & 0x7f) << (7 * n);
+	if (!(buf[n] & 0x80)) {
+	    *v = (Sint32)(z >> 1) ^ -(Sint32)(z & 1);
+	    return n + 1;
+	}
+    }
+    return 0;
+}
+
+/***************************************************************************
+ *	Network_SendU32() 
+ * Sends a fixed-width 32-bit field. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_SendU32(int sock, Uint32 v)
+{
+    unsigned char buf[4];
+
+    Network_PutU32(buf, v);
+    return (Network_Send(sock, buf, 4) == 4) ? 0 : -1;
+}
+
+/***************************************************************************
+ *	Network_RecvU32() 
+ * Receives a fixed-width 32-bit field. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_RecvU32(int sock, Uint32 *v)
+{
+    unsigned char buf[4];
+
+    if (Network_Recv(sock, buf, 4) != 4) 
+	return -1;
+    *v = Network_GetU32(buf);
+    return 0;
+}
+
+/***************************************************************************
+ *	Network_SendU64() 
+ * Sends a fixed-width 64-bit field (e.g., a random seed). Returns 0 on
+ * success.
+ *********************************************************************PROTO*/
+int
+Network_SendU64(int sock, Uint64 v)
+{
+    unsigned char buf[8];
+
+    Network_PutU64(buf, v);
+    return (Network_Send(sock, buf, 8) == 8) ? 0 : -1;
+}
+
+/***************************************************************************
+ *	Network_RecvU64() 
+ * Receives a fixed-width 64-bit field. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_RecvU64(int sock, Uint64 *v)
+{
+    unsigned char buf[8];
+
+    if (Network_Recv(sock, buf, 8) != 8) 
+	return -1;
+    *v = Network_GetU64(buf);
+    return 0;
+}
+
+/***************************************************************************
+ *	Network_SendInt() 
+ * Sends an integer (score, level, count, flag ...) as a varint. Returns 0
+ * on success.
+ *********************************************************************PROTO*/
+int
+Network_SendInt(int sock, int v)
+{
+    unsigned char buf[NET_VARINT_MAX];
+    int len = Network_PutVarint(buf, v);
+
+    return (Network_Send(sock, buf, len) == len) ? 0 : -1;
+}
+
+/***************************************************************************
+ *	Network_RecvInt() 
+ * Receives a varint sent by Network_SendInt(). Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_RecvInt(int sock, int *v)
+{
+    unsigned char buf[NET_VARINT_MAX];
+    Sint32 val;
+    int n;
+
+    for (n = 0; n < NET_VARINT_MAX; n++) {
+	if (Network_Recv(sock, buf + n, 1) != 1)
+	    return -1;
+	if (!(buf[n] & 0x80)) {
+	    Network_GetVarint(buf, n + 1, &val);
+	    *v = val;
+	    return 0;
+	}
+    }
+    error_msg = "malformed integer from the other side";
+    return -1;
+}
+
+/***************************************************************************
+ *	Network_StatsReset() 
+ * Call at the beginning of each match to start over with the link
+ * statistics. 
+ *********************************************************************PROTO*/
+void
+Network_StatsReset(void)
+{
+    Uint32 now = SDL_GetTicks();
+
+    memset(&NetStats, 0, sizeof(NetStats));
+    NetStats.start = now;
+    NetStats.next_ping = now;
+    NetStats.last_recv = now;
+    NetStats.window_start = now;
+    NetStats.rtt = -1;
+    NetStats.rtt_min = -1;
+}
+
+/***************************************************************************
+ *	Network_NoteFrame() 
+ * Records how long one pass through the local event loop took, so that
+ * local stalls can be told apart from network ones.
+ *********************************************************************PROTO*/
+void
+Network_NoteFrame(int ms)
+{
+    if (ms > NetStats.frame_max)
+	NetStats.frame_max = ms;
+}
+
+/***************************************************************************
+ *	Network_Ping() 
+ * Sends a timestamped ping to the other side and rolls the bytes-per-second
+ * window over. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_Ping(int sock)
+{
+    unsigned char msg[5];
+    Uint32 now = SDL_GetTicks();
+    Uint32 elapsed = now - NetStats.window_start;
+
+    if (elapsed > 0) {
+	NetStats.sent_rate = (NetStats.window_sent * 1000) / elapsed;
+	NetStats.recv_rate = (NetStats.window_recv * 1000) / elapsed;
+    }
+    NetStats.window_start = now;
+    NetStats.window_sent = 0;
+    NetStats.window_recv = 0;
+
+    msg[0] = NET_PING;
+    Network_PutU32(msg+1, now);
+
+    NetStats.next_ping = now + NET_PING_INTERVAL;
+    NetStats.pings_sent++;
+
+    return (Network_Send(sock, msg, sizeof(msg)) == sizeof(msg)) ? 0 : -1;
+}
+
+/***************************************************************************
+ *	Network_ReadPing() 
+ * Call after reading a NET_PING message tag. Reads the timestamp and, if
+ * "answer" is set, echoes it back as a NET_PONG. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_ReadPing(int sock, int answer)
+{
+    unsigned char msg[5];
+
+    if (Network_Recv(sock, msg+1, 4) != 4)
+	return -1;
+    if (!answer)
+	return 0;
+    msg[0] = NET_PONG;
+    return (Network_Send(sock, msg, sizeof(msg)) == sizeof(msg)) ? 0 : -1;
+}
+
+/***************************************************************************
+ *	Network_ReadPong() 
+ * Call after reading a NET_PONG message tag. Updates the round-trip time
+ * and jitter estimates. Returns 0 on success.
+ *********************************************************************PROTO*/
+int
+Network_ReadPong(int sock)
+{
+    unsigned char msg[4];
+    Uint32 then;
+    int rtt, d;
+
+    if (Network_Recv(sock, msg, 4) != 4)
+	return -1;
+    then = Network_GetU32(msg);
+    rtt = SDL_GetTicks() - then;
+    if (rtt < 0) rtt = 0;
+
+    /* interarrival jitter, as in RFC 1889: J += (|D| - J) / 16 */
+    if (NetStats.pongs_recv > 0) {
+	d = rtt - NetStats.rtt;
+	if (d < 0) d = -d;
+	NetStats.jitter += d - ((NetStats.jitter + 8) >> 4);
+    }
+    NetStats.rtt = rtt;
+    if (NetStats.rtt_min < 0 || rtt < NetStats.rtt_min)
+	NetStats.rtt_min = rtt;
+    if (rtt > NetStats.rtt_max)
+	NetStats.rtt_max = rtt;
+    NetStats.rtt_total += rtt;
+    NetStats.pongs_recv++;
+    return 0;
+}
+
+/***************************************************************************
+ *	Network_StatsDump() 
+ * Summarizes the link statistics for the match that just ended. The
+ * summary always goes to the debugging output; if "filespec" is given, a
+ * single line of "key=value" pairs is appended to that file as well.
+ *********************************************************************PROTO*/
+void
+Network_StatsDump(char *filespec, int match)
+{
+    Uint32 duration = SDL_GetTicks() - NetStats.start;
+    Uint32 secs = duration / 1000 ? duration / 1000 : 1;
+    int rtt_mean = NetStats.pongs_recv ? 
+	(int)(NetStats.rtt_total / NetStats.pongs_recv) : -1;
+    FILE *fout;
+
+    Debug("match %d: rtt %d/%d/%d ms (min/mean/max), jitter %d ms, "
+	    "%u/%u bytes out/in, gap %d ms, frame %d ms\n", match,
+	    NetStats.rtt_min, rtt_mean, NetStats.rtt_max,
+	    NetStats.jitter >> 4, NetStats.bytes_sent, NetStats.bytes_recv,
+	    NetStats.gap_max, NetStats.frame_max);
+
+    if (!filespec) 
+	return;
+    fout = fopen(filespec, "at");
+    if (!fout) {
+	Debug("unable to open [%s]: %s\n", filespec, strerror(errno));
+	return;
+    }
+    fprintf(fout, "match=%d time=%lu duration_ms=%u "
+	    "bytes_sent=%u bytes_recv=%u sent_Bps=%u recv_Bps=%u "
+	    "pings_sent=%u pongs_recv=%u "
+	    "rtt_last_ms=%d rtt_min_ms=%d rtt_mean_ms=%d rtt_max_ms=%d "
+	    "jitter_ms=%d gap_max_ms=%d frame_max_ms=%d\n",
+	    match, (unsigned long)time(NULL), duration,
+	    NetStats.bytes_sent, NetStats.bytes_recv,
+	    NetStats.bytes_sent / secs, NetStats.bytes_recv / secs,
+	    NetStats.pings_sent, NetStats.pongs_recv,
+	    NetStats.rtt, NetStats.rtt_min, rtt_mean, NetStats.rtt_max,
+	    NetStats.jitter >> 4, NetStats.gap_max, NetStats.frame_max);
+    fclose(fout);
+}
+
+/***************************************************************************
+ *	Network_SessionBegin() 
+ * Remembers enough about the current match connection that we can
+ * re-establish it later if it drops. 
+ *********************************************************************PROTO*/
+void
+Network_SessionBegin(int sock, int server, char *host, int port, Uint32 token)
+{
+    Session.server = server;
+    Session.host = host;
+    Session.port = port;
+    Session.token = token;
+    Session.sock = sock;
+    Session.pending = -1;
+    Session.next_attempt = 0;
+}
+
+/***************************************************************************
+ *	Network_SessionSocket() 
+ * Returns the socket for the current match (it changes if we had to
+ * reconnect), or 0 if the other side is gone.
+ *********************************************************************PROTO*/
+int
+Network_SessionSocket(void)
+{
+    return Session.sock;
+}
+
+/***************************************************************************
+ *	Network_SessionIsServer() 
+ * Returns 1 if we are the server side of the current match. 
+ *********************************************************************PROTO*/
+int
+Network_SessionIsServer(void)
+{
+    return Session.server;
+}
+
+/***************************************************************************
+ *	await_readable() 
+ * Waits up to "ms" milliseconds for something to read on "sock". Returns
+ * 1 if there is, 0 if not.
+ ***************************************************************************/
+static int
+await_readable(int sock, int ms)
+{
+#if HAVE_SELECT || HAVE_WINSOCK_H
+    fd_set read_fds;
+    struct timeval timeout;
+
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_usec = (ms % 1000) * 1000;
+    FD_ZERO(&read_fds);
+    FD_SET(sock, &read_fds);
+    return select(sock+1, &read_fds, NULL, NULL, &timeout) > 0;
+#else
+    return 1;	/* just block in recv() */
+#endif
+}
+
+/***************************************************************************
+ *	Network_SessionReconnect() 
+ * Makes one attempt at getting the match connection back. It never blocks
+ * for long, so call it repeatedly (while running the flame, say) until it
+ * returns a socket; it returns -1 while there is nothing yet. 
+ *
+ * The client re-dials the server and sends NET_RECONNECT and the session
+ * token; the server accepts and answers NET_RECONNECT_OK if the token is
+ * the one it gave out at the start of the match. 
+ *********************************************************************PROTO*/
+int
+Network_SessionReconnect(void)
+{
+    unsigned char msg[5];
+    int sock;
+
+    if (Session.sock > 0) {
+	close(Session.sock);
+	Session.sock = 0;
+    }
+
+    if (Session.server) {
+	sock = Server_AwaitConnection(Session.port);
+	if (sock < 0)
+	    return -1;
+	if (!await_readable(sock, NET_RECONNECT_TIMEOUT) ||
+		Network_Recv(sock, msg, 5) != 5 || 
+		msg[0] != NET_RECONNECT || 
+		Network_GetU32(msg+1) != Session.token) {
+	    Debug("rejecting connection: not our match.\n");
+	    close(sock);
+	    return -1;
+	}
+	msg[0] = NET_RECONNECT_OK;
+	if (Network_Send(sock, msg, 1) != 1) {
+	    close(sock);
+	    return -1;
+	}
+    } else {
+#if HAVE_SYS_SOCKET_H
+	if (Session.pending < 0) {
+	    struct sockaddr_in addr;
+	    struct hostent *host;
+
+	    if (SDL_GetTicks() < Session.next_attempt)
+		return -1;
+	    Session.next_attempt = SDL_GetTicks() + 1000;
+
+	    /* like Client_Connect(), but we cannot afford to block while
+	     * the other side is unreachable */
+	    host = gethostbyname(Session.host);
+	    if (!host) 
+		return -1;
+	    memset(&addr, 0, sizeof(addr)); 
+	    addr.sin_family = AF_INET;
+	    memcpy(&addr.sin_addr, host->h_addr_list[0], host->h_length);
+	    addr.sin_port = htons(Session.port);
+	    Session.pending = socket(AF_INET, SOCK_STREAM, 0);
+	    if (Session.pending < 0) 
+		return -1;
+	    fcntl(Session.pending, F_SETFL, O_NONBLOCK);
+	    if (connect(Session.pending, (struct sockaddr *) &addr,
+			sizeof(addr)) < 0 && errno != EINPROGRESS) {
+		close(Session.pending);
+		Session.pending = -1;
+		return -1;
+	    }
+	}
+	{
+	    fd_set write_fds;
+	    struct timeval timeout = { 0, 0 };
+	    int err = 0;
+	    socklen_t len = sizeof(err);
+
+	    FD_ZERO(&write_fds);
+	    FD_SET(Session.pending, &write_fds);
+	    if (select(Session.pending+1, NULL, &write_fds, NULL, &timeout) <= 0) {
+		if (SDL_GetTicks() >= Session.next_attempt) {
+		    /* give up on this one, try again */
+		    close(Session.pending);
+		    Session.pending = -1;
+		}
+		return -1;
+	    }
+	    sock = Session.pending;
+	    Session.pending = -1;
+	    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (void *)&err, &len) 
+		    || err) {
+		close(sock);
+		return -1;
+	    }
+	    fcntl(sock, F_SETFL, 0);
+	}
+#else
+	if (SDL_GetTicks() < Session.next_attempt)
+	    return -1;
+	Session.next_attempt = SDL_GetTicks() + 1000;
+	sock = Client_Connect(Session.host, Session.port);
+	if (sock < 0) 
+	    return -1;
+#endif
+	msg[0] = NET_RECONNECT;
+	Network_PutU32(msg+1, Session.token);
+	if (Network_Send(sock, msg, 5) != 5 || 
+		!await_readable(sock, NET_RECONNECT_TIMEOUT) ||
+		Network_Recv(sock, msg, 1) != 1 || 
+		msg[0] != NET_RECONNECT_OK) {
+	    Debug("the server would not take us back.\n");
+	    close(sock);
+	    return -1;
+	}
+    }
+    Debug("match connection re-established, socketfd %d.\n", sock);
+    Session.sock = sock;
+    return sock;
+}
+
+/***************************************************************************
+ *	Network_SessionEnd() 
+ * The match is over (or abandoned): forget about reconnecting.
+ *********************************************************************PROTO*/
+void
+Network_SessionEnd(void)
+{
+#if HAVE_SYS_SOCKET_H
+    if (Session.pending > 0 && !Session.server)
+	close(Session.pending);
+#endif
+    memset(&Session, 0, sizeof(Session));
+    Session.pending = -1;
+}
+
 /***************************************************************************
  *	Network_Init() 
  * Call before you try to use any networking functions. Returns 0 on
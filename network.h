@@ -0,0 +1,70 @@
+/*
+ *                               Alizarin Tetris
+ * Network play definitions: wire format, in-game messages and link
+ * statistics.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+#ifndef __NETWORK_H
+#define __NETWORK_H
+
+/* in-game link probes: a ping carries the sender's SDL_GetTicks() value
+ * (4 bytes, network order) and the pong echoes it back unchanged */
+#define NET_PING	'?'
+#define NET_PONG	'!'
+
+#define NET_PING_INTERVAL	1000	/* milliseconds between pings */
+
+/* getting a dropped match back: the client re-dials and sends
+ * NET_RECONNECT plus the session token, the server answers with
+ * NET_RECONNECT_OK, and then both sides trade a NET_SNAPSHOT */
+#define NET_RECONNECT		'R'
+#define NET_RECONNECT_OK	'A'
+#define NET_SNAPSHOT		'S'
+
+#define NET_RECONNECT_WINDOW	30	/* seconds we wait for the other side */
+#define NET_RECONNECT_TIMEOUT	2000	/* ms to wait for the token/answer */
+#define NET_LINK_TIMEOUT	5000	/* ms of silence before we assume the
+					   link is dead (we ping every second) */
+
+/* our falling piece, so that the other side can show and predict it (see
+ * rollback.c): NET_PIECE when a new one appears, NET_MOVE after every
+ * input that moved it */
+#define NET_PIECE	'n'
+#define NET_MOVE	'm'
+
+/* a 32-bit zigzag varint never needs more than this many bytes */
+#define NET_VARINT_MAX		5
+
+typedef struct net_stats_struct {
+    Uint32	start;		/* SDL_GetTicks() when the match began */
+    Uint32	next_ping;	/* when we should send the next ping */
+    Uint32	last_recv;	/* when we last heard from the other side */
+
+    Uint32	bytes_sent;	/* totals for this match */
+    Uint32	bytes_recv;
+    Uint32	pings_sent;
+    Uint32	pongs_recv;
+
+    /* bytes per second over the last ping interval */
+    Uint32	window_start;
+    Uint32	window_sent;
+    Uint32	window_recv;
+    Uint32	sent_rate;
+    Uint32	recv_rate;
+
+    int		rtt;		/* last round-trip time, milliseconds */
+    int		rtt_min;
+    int		rtt_max;
+    Uint32	rtt_total;	/* for the per-match mean */
+    int		jitter;		/* RFC 1889 style estimate, ms * 16 */
+
+    int		gap_max;	/* longest silence from the other side, ms */
+    int		frame_max;	/* longest local event loop pass, ms */
+} net_stats;
+
+extern net_stats NetStats;
+
+#include "network.pro"
+
+#endif
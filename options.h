@@ -11,6 +11,24 @@ struct option_struct {
     /* these are startup-time options */
     int bpp_wanted;
     int sound_wanted;	/* you can select no-sound later */
+    int net_overlay;	/* show link statistics during network play */
+    char *net_stats_file; /* append per-match link statistics here */
+    int net_port;	/* TCP port for network play */
+    int net_unattended;	/* play one network game without the menus */
+    char *net_host;	/* ... as the client of this server (or NULL) */
+    int net_ai;		/* ... with this AI playing for us */
+    int net_matches;	/* ... for this many matches (server) */
+    int video;		/* VIDEO_SDL, VIDEO_OFFSCREEN or VIDEO_NULL */
+    int batch_matches;	/* play this many AI vs. AI matches and quit */
+    int display_w;	/* size of the real display (0: same as the */
+    int display_h;	/* ... screen, LOGICAL_W x LOGICAL_H) */
+    int smooth_scaling;	/* bilinear filtering when it is bigger */
+    int profile;	/* time each frame and show where it goes */
+    char *profile_file;	/* append a line per frame here (CSV) */
+    int refresh_hz;	/* present at most this often (0: whenever) */
+    int flame_threads;	/* split the flame among this many threads */
+    int flame_fps;	/* flame frames per second (0: as many as we can) */
+    char *pack_file;	/* the asset pack, relative to ATRIS_LIBDIR */
 
     /* these are run-time options: you can change them in the game */
     int full_screen;
@@ -27,4 +45,10 @@ struct option_struct {
     int named_game;
 } Options;
 
+/* where the pictures go: a real display, a memory surface nobody looks
+ * at, or nowhere at all (drawing is clipped away) */
+#define VIDEO_SDL	0
+#define VIDEO_OFFSCREEN	1
+#define VIDEO_NULL	2
+
 #endif
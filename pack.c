@@ -0,0 +1,434 @@
+/*
+ *                               Alizarin Tetris
+ * Reading the asset pack (see pack.h and atrispack.c). The whole pack is
+ * mapped at startup and everything is found by a binary search of its
+ * index; anything that is not in the pack is read from its own file as
+ * before. A pack that is older than the directories it was made from is
+ * left alone, so that new styles are not hidden by it, and a file that has
+ * changed since it was packed is read from the disk instead.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+/* for fmemopen() and posix_madvise() */
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+/* configure magic for dirent */
+#if HAVE_DIRENT_H
+# include <dirent.h>
+# define NAMLEN(dirent) strlen((dirent)->d_name)
+#else
+# define dirent direct
+# define NAMLEN(dirent) (dirent)->d_namlen
+# if HAVE_SYS_NDIR_H
+#  include <sys/ndir.h>
+# endif
+# if HAVE_SYS_DIR_H
+#  include <sys/dir.h>
+# endif
+# if HAVE_NDIR_H
+#  include <ndir.h>
+# endif
+#endif
+
+#include "atris.h"
+#include "pack.h"
+
+static struct pack_struct {
+    Uint8 *		base;	/* the whole pack, or NULL if we have none */
+    Uint32		size;
+    const pack_entry *	entry;	/* the index */
+    Uint32		count;
+    Uint32		names;	/* the end of the names (and the index) */
+    char *		filename;
+} Pack;
+
+struct pack_dir_struct {
+    DIR *		dir;	/* a real directory ... */
+    Uint32		next;	/* ... or the next entry of the pack */
+    Uint32		prefix_len;
+    char		prefix[256];	/* "styles/" */
+    struct dirent	d;
+};
+
+#define PACK_NAME(e)	((const char *) Pack.base + (e)->name)
+
+/***************************************************************************
+ *      check_pack()
+ * Makes sure that a pack we have just mapped is one of ours and that
+ * nothing in its index points outside of it. Returns 0 if it is fine.
+ ***************************************************************************/
+static int
+check_pack(void)
+{
+    const pack_header *h = (const pack_header *) Pack.base;
+    Uint32 i;
+
+    if (Pack.size < sizeof(*h) || memcmp(h->magic, PACK_MAGIC, 8))
+	return -1;
+    if (h->version != PACK_VERSION || h->byte_order != PACK_BYTE_ORDER ||
+	    h->size != Pack.size)
+	return -1;
+    if (h->index % PACK_ALIGN || h->index > Pack.size ||
+	    h->count > (Pack.size - h->index) / sizeof(pack_entry))
+	return -1;
+    Pack.entry = (const pack_entry *) (Pack.base + h->index);
+    Pack.count = h->count;
+    Pack.names = h->index + h->count * sizeof(pack_entry);
+    for (i=0; i<Pack.count; i++) {
+	const pack_entry *e = &Pack.entry[i];
+	const Uint8 *end;
+	if (e->name >= Pack.size || !(end = memchr(Pack.base + e->name, 0,
+		    Pack.size - e->name)))
+	    return -1;
+	if ((Uint32) (end + 1 - Pack.base) > Pack.names)
+	    Pack.names = end + 1 - Pack.base;
+	if (e->data % PACK_ALIGN || e->data > Pack.size ||
+		e->len > Pack.size - e->data)
+	    return -1;
+	if (e->type == PACK_IMAGE && (e->u.image.w < 1 || e->u.image.h < 1 ||
+		    e->u.image.pitch / 4 < e->u.image.w ||
+		    e->u.image.pitch > e->len / e->u.image.h))
+	    return -1;
+	if (i && strcmp(PACK_NAME(e-1), PACK_NAME(e)) >= 0)
+	    return -1;	/* we could not search it */
+    }
+    return 0;
+}
+
+/***************************************************************************
+ *      pack_is_stale()
+ * Has anything been added to (or removed from) the asset directories
+ * since the pack was made at "made"? Returns the first such directory.
+ ***************************************************************************/
+static const char *
+pack_is_stale(time_t made)
+{
+    static const char *dirs[] = { "styles", "graphics", "sounds" };
+    struct stat st;
+    int i;
+
+    for (i=0; i<3; i++)
+	if (!stat(dirs[i], &st) && st.st_mtime > made)
+	    return dirs[i];
+    return NULL;
+}
+
+#if HAVE_SYS_MMAN_H
+/***************************************************************************
+ *      will_need()
+ * Asks for "len" bytes of the pack at "from" to be read in ahead of time.
+ ***************************************************************************/
+static void
+will_need(Uint32 from, Uint32 len)
+{
+    Uint32 page = sysconf(_SC_PAGESIZE);
+
+    len += from % page;
+    from -= from % page;
+    posix_madvise(Pack.base + from, len, POSIX_MADV_WILLNEED);
+}
+#endif
+
+/***************************************************************************
+ *      pack_open()
+ * Maps the asset pack "filename" into memory. Returns 0 on success; if it
+ * is not there (or not usable, or out of date) every file is read on its
+ * own.
+ *********************************************************************PROTO*/
+int
+pack_open(const char *filename)
+{
+    struct stat st;
+    const char *dir;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0)
+	return -1;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(pack_header) ||
+	    st.st_size > 0x7fffffff) {
+	close(fd);
+	return -1;
+    }
+    if ((dir = pack_is_stale(st.st_mtime))) {
+	Debug("[%s] is older than [%s]: run atrispack again.\n", filename, dir);
+	close(fd);
+	return -1;
+    }
+    Pack.size = st.st_size;
+#if HAVE_SYS_MMAN_H
+    Pack.base = mmap(NULL, Pack.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (Pack.base == MAP_FAILED) {
+	Debug("mmap(%s): %s\n", filename, strerror(errno));
+	Pack.base = NULL;
+	close(fd);
+	return -1;
+    }
+#else
+    {
+	Uint32 got = 0;
+	int n = 1;
+
+	Malloc(Pack.base, Uint8 *, Pack.size);
+	while (got < Pack.size && (n = read(fd, Pack.base + got,
+			Pack.size - got)) > 0)
+	    got += n;
+	if (got < Pack.size) {
+	    Free(Pack.base);
+	    close(fd);
+	    return -1;
+	}
+    }
+#endif
+    close(fd);
+    if (check_pack()) {
+	Debug("[%s] is not an asset pack we can use.\n", filename);
+#if HAVE_SYS_MMAN_H
+	munmap(Pack.base, Pack.size);
+	Pack.base = NULL;
+#else
+	Free(Pack.base);
+#endif
+	return -1;
+    }
+#if HAVE_SYS_MMAN_H
+    /* one long read now of what we look at first -- the index and the
+     * style descriptors -- rather than a seek for every page later. The
+     * pictures and sounds are read as the styles that use them are. */
+    {
+	Uint32 i;
+
+	will_need(0, Pack.names);
+	for (i=0; i<Pack.count; i++)
+	    if (Pack.entry[i].type == PACK_FILE)
+		will_need(Pack.entry[i].data, Pack.entry[i].len);
+    }
+#endif
+    Strdup(Pack.filename, filename);
+    Debug("Asset pack [%s]: %d entries, %d bytes.\n", filename,
+	    (int) Pack.count, (int) Pack.size);
+    return 0;
+}
+
+/***************************************************************************
+ *      pack_find()
+ * Looks a file up in the pack by name. Returns NULL if it is not there, is
+ * not of the given type, or has been changed on the disk since it was
+ * packed.
+ ***************************************************************************/
+static const pack_entry *
+pack_find(const char *name, int type)
+{
+    Uint32 lo = 0, hi = Pack.count;
+    struct stat st;
+
+    if (!Pack.base)
+	return NULL;
+    if (!strncmp(name, "./", 2))
+	name += 2;
+    while (lo < hi) {
+	Uint32 mid = (lo + hi) / 2;
+	int c = strcmp(name, PACK_NAME(&Pack.entry[mid]));
+	if (!c) {
+	    const pack_entry *e = &Pack.entry[mid];
+	    if (e->type != (Uint32) type)
+		return NULL;
+	    if (!stat(name, &st) && ((Uint32) st.st_mtime != e->mtime ||
+			(Uint32) st.st_size != e->src_len)) {
+		Debug("[%s] has changed since it was packed.\n", name);
+		return NULL;
+	    }
+	    return e;
+	}
+	if (c < 0)
+	    hi = mid;
+	else
+	    lo = mid + 1;
+    }
+    return NULL;
+}
+
+/***************************************************************************
+ *      pack_fopen()
+ * Opens a text file (a style descriptor, say) for reading, from the pack
+ * if it is there.
+ *********************************************************************PROTO*/
+FILE *
+pack_fopen(const char *name)
+{
+    const pack_entry *e = pack_find(name, PACK_FILE);
+
+    if (e && e->len)
+	return fmemopen(Pack.base + e->data, e->len, "r");
+    return fopen(name, "rt");
+}
+
+/***************************************************************************
+ *      pack_RWops()
+ * An SDL_RWops for reading a file (a font, say), from the pack if it is
+ * there.
+ *********************************************************************PROTO*/
+SDL_RWops *
+pack_RWops(const char *name)
+{
+    const pack_entry *e = pack_find(name, PACK_FILE);
+
+    if (e)
+	return SDL_RWFromConstMem(Pack.base + e->data, e->len);
+    return SDL_RWFromFile(name, "rb");
+}
+
+/***************************************************************************
+ *      pack_LoadBMP()
+ * Like SDL_LoadBMP(). A picture from the pack is not decoded again: the
+ * surface's pixels are the pack's own, so it must not be written to.
+ * Either way, free it with SDL_FreeSurface().
+ *********************************************************************PROTO*/
+SDL_Surface *
+pack_LoadBMP(const char *name)
+{
+    const pack_entry *e = pack_find(name, PACK_IMAGE);
+
+    if (!e)
+	return SDL_LoadBMP(name);
+    return SDL_CreateRGBSurfaceFrom(Pack.base + e->data, e->u.image.w,
+	    e->u.image.h, 32, e->u.image.pitch,
+	    PACK_RMASK, PACK_GMASK, PACK_BMASK, 0);
+}
+
+/***************************************************************************
+ *      pack_image_size()
+ * Finds the size of a picture in the pack without making a surface.
+ * Returns 0 if it is there.
+ *********************************************************************PROTO*/
+int
+pack_image_size(const char *name, int *w, int *h)
+{
+    const pack_entry *e = pack_find(name, PACK_IMAGE);
+
+    if (!e)
+	return -1;
+    *w = e->u.image.w;
+    *h = e->u.image.h;
+    return 0;
+}
+
+/***************************************************************************
+ *      pack_LoadWAV()
+ * Finds a sound in the pack. Returns 1 and points "audio_buf" at its
+ * samples (which belong to the pack: don't free them) if it is there.
+ *********************************************************************PROTO*/
+int
+pack_LoadWAV(const char *name, SDL_AudioSpec *spec, Uint8 **audio_buf,
+	Uint32 *audio_len)
+{
+    const pack_entry *e = pack_find(name, PACK_SOUND);
+
+    if (!e)
+	return 0;
+    memset(spec, 0, sizeof(*spec));
+    spec->freq = e->u.sound.freq;
+    spec->format = e->u.sound.format;
+    spec->channels = e->u.sound.channels;
+    *audio_buf = Pack.base + e->data;
+    *audio_len = e->len;
+    return 1;
+}
+
+/***************************************************************************
+ *      pack_locate()
+ * Where a file is in the pack, for reading it with stdio rather than
+ * through the map (a long sound, say). Returns the name of the pack file,
+ * or NULL if it is not there.
+ *********************************************************************PROTO*/
+const char *
+pack_locate(const char *name, int type, Uint32 *offset, Uint32 *len)
+{
+    const pack_entry *e = pack_find(name, type);
+
+    if (!e)
+	return NULL;
+    *offset = e->data;
+    *len = e->len;
+    return Pack.filename;
+}
+
+/***************************************************************************
+ *      pack_opendir()
+ * Like opendir(), except that if the pack has anything in "dir" we list
+ * the pack's index instead. (pack_open() has made sure that nothing has
+ * been added to or taken from the directory since it was packed.)
+ *********************************************************************PROTO*/
+pack_dir *
+pack_opendir(const char *dir)
+{
+    pack_dir *retval;
+    Uint32 lo = 0, hi = Pack.count;
+
+    Calloc(retval, pack_dir *, sizeof(*retval));
+    SPRINTF(retval->prefix, "%s/", dir);
+    retval->prefix_len = strlen(retval->prefix);
+    /* the first name that is not before the prefix */
+    while (lo < hi) {
+	Uint32 mid = (lo + hi) / 2;
+	if (strcmp(PACK_NAME(&Pack.entry[mid]), retval->prefix) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    retval->next = lo;
+    if (Pack.base && lo < Pack.count && !strncmp(PACK_NAME(&Pack.entry[lo]),
+		retval->prefix, retval->prefix_len))
+	return retval;
+    retval->dir = opendir(dir);
+    if (!retval->dir) {
+	free(retval);
+	return NULL;
+    }
+    return retval;
+}
+
+/***************************************************************************
+ *      pack_readdir()
+ * Like readdir(). Only d_name is filled in for the pack's files.
+ *********************************************************************PROTO*/
+struct dirent *
+pack_readdir(pack_dir *d)
+{
+    if (d->dir)
+	return readdir(d->dir);
+    for (; d->next < Pack.count; d->next++) {
+	const char *name = PACK_NAME(&Pack.entry[d->next]);
+	if (strncmp(name, d->prefix, d->prefix_len))
+	    break;	/* past the end of this directory */
+	name += d->prefix_len;
+	if (strchr(name, '/') || strlen(name) >= sizeof(d->d.d_name))
+	    continue;	/* in a subdirectory */
+	strcpy(d->d.d_name, name);
+	d->next++;
+	return &d->d;
+    }
+    return NULL;
+}
+
+/***************************************************************************
+ *      pack_closedir()
+ * Like closedir().
+ *********************************************************************PROTO*/
+void
+pack_closedir(pack_dir *d)
+{
+    if (d->dir)
+	closedir(d->dir);
+    free(d);
+}
@@ -0,0 +1,57 @@
+/*
+ *                               Alizarin Tetris
+ * The asset pack: every style descriptor, picture and sound the game
+ * needs in one file, made offline by atrispack and mapped into memory at
+ * startup. Pictures and sounds are stored already decoded.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+#ifndef __PACK_H
+#define __PACK_H
+
+#define PACK_MAGIC	"ATRISPAK"
+#define PACK_VERSION	2
+#define PACK_BYTE_ORDER	0x01020304	/* as the packer's machine wrote it */
+#define PACK_ALIGN	16		/* every entry's data starts on one */
+
+#define PACK_FILE	0	/* stored as it is (descriptors, fonts) */
+#define PACK_IMAGE	1	/* a BMP, as 32-bit pixels (PACK_?MASK) */
+#define PACK_SOUND	2	/* a WAV, as PCM in the format given */
+
+#define PACK_RMASK	0x00ff0000
+#define PACK_GMASK	0x0000ff00
+#define PACK_BMASK	0x000000ff
+
+/* at offset 0 */
+typedef struct pack_header_struct {
+    char	magic[8];	/* PACK_MAGIC, no NUL */
+    Uint32	version;
+    Uint32	byte_order;	/* PACK_BYTE_ORDER */
+    Uint32	count;		/* entries in the index */
+    Uint32	index;		/* offset of the index */
+    Uint32	size;		/* of the whole pack */
+    Uint32	pad;
+} pack_header;
+
+/* the index is sorted by name; all offsets are from the start */
+typedef struct pack_entry_struct {
+    Uint32	name;		/* offset of the name ("graphics/A.bmp") */
+    Uint32	type;		/* PACK_FILE, PACK_IMAGE or PACK_SOUND */
+    Uint32	data;		/* offset of the contents */
+    Uint32	len;		/* ... and their size in bytes */
+    union {
+	struct { Uint32 w, h, pitch; } image;
+	struct { Uint32 freq, format, channels; } sound;
+    } u;
+    Uint32	mtime;		/* the file it was made from, when packed */
+    Uint32	src_len;	/* ... and its size then */
+    Uint32	pad[3];
+} pack_entry;
+
+/* pack_opendir() reads either a real directory or a part of the pack */
+typedef struct pack_dir_struct pack_dir;
+struct dirent;
+
+#include "pack.pro"
+
+#endif
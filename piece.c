@@ -32,6 +32,8 @@
 #include "display.h"
 #include "piece.h"
 #include "options.h"
+#include "profile.h"
+#include "pack.h"
 
 /***************************************************************************
  *      load_piece_style()
@@ -42,7 +44,7 @@ load_piece_style(const char *filename)
 {
     piece_style *retval;
     char buf[2048];
-    FILE *fin = fopen(filename,"rt");
+    FILE *fin = pack_fopen(filename);
     int i;
 
     if (!fin) {
@@ -156,104 +158,166 @@ piece_styles
 load_piece_styles(void)
 {
     piece_styles retval;
-    int i = 0;
-    DIR *my_dir;
+    pack_dir *my_dir;
     char filespec[2048];
 
     memset(&retval, 0, sizeof(retval));
 
-    my_dir = opendir("styles");
-    if (my_dir) {
-	while (1) { 
-	    struct dirent *this_file = readdir(my_dir);
-	    if (!this_file) break;
-	    if (piece_Select(this_file))
-		i++;
-	} 
-	closedir(my_dir);
-    } else {
+    my_dir = pack_opendir("styles");
+    if (!my_dir)
 	PANIC("Cannot read directory [styles/]");
-    }
-    my_dir = opendir("styles");
-    if (my_dir) {
-	if (i > 0) { 
-	    int j;
-	    Calloc(retval.style,piece_style **,sizeof(*(retval.style))*i);
-	    retval.num_style = i;
-	    j = 0;
-	    while (j<i) {
-		struct dirent *this_file = readdir(my_dir);
-		if (!piece_Select(this_file)) continue;
-		SPRINTF(filespec,"styles/%s",this_file->d_name);
-		retval.style[j] = load_piece_style(filespec);
-		if (strstr(retval.style[j]->name,"Default"))
-		    retval.choice = j;
-		j++;
-	    }
-	    closedir(my_dir);
-	    return retval;
-	} else {
-	    PANIC("No piece styles [styles/*.Piece] found.\n");
-	}
-    } else { 
-	PANIC("Cannot read directory [styles/]");
-    }
+    while (1) { 
+	struct dirent *this_file = pack_readdir(my_dir);
+	if (!this_file) break;
+	if (!piece_Select(this_file)) continue;
+	SPRINTF(filespec,"styles/%s",this_file->d_name);
+	Realloc(retval.style,piece_style **,
+		sizeof(*(retval.style))*(retval.num_style+1));
+	retval.style[retval.num_style] = load_piece_style(filespec);
+	if (!retval.style[retval.num_style]) continue;
+	if (strstr(retval.style[retval.num_style]->name,"Default"))
+	    retval.choice = retval.num_style;
+	retval.num_style++;
+    } 
+    pack_closedir(my_dir);
+    if (!retval.num_style)
+	PANIC("No piece styles [styles/*.Piece] found.\n");
     return retval;
 }
 
 /***************************************************************************
- *      load_color_style()
- * Load a color style from the given file.
+ *      make_edged()
+ * Draws one color block with each of the 16 combinations of edges on it,
+ * laid out as EDGED_TILE() expects. The edges must already be loaded.
  ***************************************************************************/
-static color_style *
-load_color_style(SDL_Surface * screen, const char *filename)
+static SDL_Surface *
+make_edged(SDL_Surface *screen, SDL_Surface *block)
 {
-    color_style *retval;
-    char buf[2048];
-    FILE *fin = fopen(filename,"rt");
-    int i;
-
-    if (!fin) {
-	Debug("fopen(%s)\n",filename);
+    SDL_Surface *retval;
+    SDL_PixelFormat *fmt = block->format;
+    SDL_Rect r;
+    int w = block->w, h = block->h;
+    int mask;
+
+    retval = SDL_CreateRGBSurface(SDL_SWSURFACE, w * 4, h * 4,
+	    fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+    if (!retval)
 	return NULL;
+    if (fmt->palette != NULL && screen->format->palette != NULL)
+	SDL_SetColors(retval, screen->format->palette->colors, 0,
+		screen->format->palette->ncolors);
+
+    for (mask = 0; mask < 16; mask++) {
+	int x = (mask & 3) * w, y = (mask >> 2) * h;
+
+	r.x = x; r.y = y; r.w = w; r.h = h;
+	SDL_BlitSafe(block, NULL, retval, &r);
+	/* same order and places as draw_grid() used to draw them */
+	if (mask & EDGE_LIGHT_UP) {
+	    r.x = x; r.y = y;
+	    r.w = edge[HORIZ_LIGHT]->w; r.h = edge[HORIZ_LIGHT]->h;
+	    SDL_BlitSafe(edge[HORIZ_LIGHT], NULL, retval, &r);
+	}
+	if (mask & EDGE_LIGHT_LEFT) {
+	    r.x = x; r.y = y;
+	    r.w = edge[VERT_LIGHT]->w; r.h = edge[VERT_LIGHT]->h;
+	    SDL_BlitSafe(edge[VERT_LIGHT], NULL, retval, &r);
+	}
+	if (mask & EDGE_DARK_DOWN) {
+	    r.x = x; r.y = y + h - edge[HORIZ_DARK]->h;
+	    r.w = edge[HORIZ_DARK]->w; r.h = edge[HORIZ_DARK]->h;
+	    SDL_BlitSafe(edge[HORIZ_DARK], NULL, retval, &r);
+	}
+	if (mask & EDGE_DARK_RIGHT) {
+	    r.x = x + w - edge[VERT_DARK]->w; r.y = y;
+	    r.w = edge[VERT_DARK]->w; r.h = edge[VERT_DARK]->h;
+	    SDL_BlitSafe(edge[VERT_DARK], NULL, retval, &r);
+	}
     }
-    Calloc(retval,color_style *,sizeof(*retval));
+    return retval;
+}
 
-    fgets(buf,sizeof(buf),fin);
-    if (feof(fin)) {
-	Debug("unexpected EOF after name in [%s]\n",filename);
-	free(retval);
-	return NULL;
+/***************************************************************************
+ *      bmp_size()
+ * Reads the width and height of a BMP from its header (or the asset
+ * pack). Returns 0 on success.
+ ***************************************************************************/
+static int
+bmp_size(const char *filename, int *w, int *h)
+{
+    unsigned char b[26];
+    FILE *fin;
+    int ok;
+
+    if (!pack_image_size(filename,w,h))
+	return 0;
+    fin = fopen(filename,"rb");
+    if (!fin)
+	return -1;
+    ok = (fread(b,1,sizeof(b),fin) == sizeof(b) && b[0] == 'B' && b[1] == 'M');
+    fclose(fin);
+    if (!ok)
+	return -1;
+#define LE16(p)	((p)[0] | ((p)[1] << 8))
+#define LE32(p)	((Sint32) (LE16(p) | (LE16((p)+2) << 16)))
+    if (LE32(b+14) == 12) {	/* an old OS/2 header */
+	*w = LE16(b+18);
+	*h = LE16(b+20);
+    } else {
+	*w = LE32(b+18);
+	*h = abs(LE32(b+22));	/* negative if it is stored top-down */
     }
+#undef LE16
+#undef LE32
+    return (*w > 0 && *h > 0) ? 0 : -1;
+}
+
+/***************************************************************************
+ *      next_line()
+ * Reads the next line of a style file that is not blank or a comment,
+ * without its newline. Returns 0 at the end of the file.
+ ***************************************************************************/
+static int
+next_line(FILE *fin, char *buf, int size)
+{
+    do {
+	buf[0] = 0;
+	fgets(buf,size,fin);
+    } while (!feof(fin) && (buf[0] == '\n' || buf[0] == '#'));
     if (strchr(buf,'\n'))
 	*(strchr(buf,'\n')) = 0;
-    retval->name = strdup(buf);
+    return buf[0] != 0;
+}
 
-    if (fscanf(fin,"%d\n",&retval->num_color) != 1) {
-	Debug("malformed color count in [%s]\n",filename);
-	free(retval->name);
-	free(retval);
-	return NULL;
-    }
+/***************************************************************************
+ *      load_color_style()
+ * Loads the surfaces of a color style that index_color_style() has
+ * found.
+ ***************************************************************************/
+static void
+load_color_style(SDL_Surface * screen, color_style *cs)
+{
+    char buf[2048];
+    FILE *fin = pack_fopen(cs->filename);
+    int i, w = 0, h = 0;
 
-    Malloc(retval->color, SDL_Surface **,
-	    (retval->num_color+1)*sizeof(retval->color[0]));
+    if (!fin)
+	PANIC("cannot reopen [%s] for color style [%s]",cs->filename,cs->name);
+    fgets(buf,sizeof(buf),fin);		/* the name */
+    fgets(buf,sizeof(buf),fin);		/* the count */
 
-    for (i=1;i<=retval->num_color;i++) {
-	SDL_Surface *imagebmp;
+    Malloc(cs->color, SDL_Surface **,
+	    (cs->num_color+1)*sizeof(cs->color[0]));
 
-	do {
-	    buf[0] = 0;
-	    fgets(buf,sizeof(buf),fin);
-	} while (!feof(fin) && (buf[0] == '\n' || buf[0] == '#'));
+    for (i=1;i<=cs->num_color;i++) {
+	SDL_Surface *imagebmp;
 
-	if (feof(fin)) PANIC("unexpected EOF in color style [%s]",retval->name);
-	if (strchr(buf,'\n'))
-	    *(strchr(buf,'\n')) = 0;
+	if (!next_line(fin,buf,sizeof(buf)))
+	    PANIC("unexpected EOF in color style [%s]",cs->name);
 
-	imagebmp = SDL_LoadBMP(buf);
+	imagebmp = pack_LoadBMP(buf);
 	if (!imagebmp) 
-	    PANIC("cannot load [%s] in color style [%s]",buf,retval->name);
+	    PANIC("cannot load [%s] in color style [%s]",buf,cs->name);
 	/* set the video colormap */
 	if ( imagebmp->format->palette != NULL ) {
 	    SDL_SetColors(screen,
@@ -261,30 +325,134 @@ load_color_style(SDL_Surface * screen, const char *filename)
 		    imagebmp->format->palette->ncolors);
 	}
 	/* Convert the image to the video format (maps colors) */
-	retval->color[i] = SDL_DisplayFormat(imagebmp);
+	cs->color[i] = SDL_DisplayFormat(imagebmp);
 	SDL_FreeSurface(imagebmp);
-	if ( !retval->color[i] ) 
+	if ( !cs->color[i] ) 
 	    PANIC("could not convert [%s] in color style [%s]", 
-		buf, retval->name);
+		buf, cs->name);
 	if (i == 1) {
-	    retval->h = retval->color[i]->h;
-	    retval->w = retval->color[i]->w;
+	    h = cs->color[i]->h;
+	    w = cs->color[i]->w;
 	} else {
-	    if (retval->h != retval->color[i]->h ||
-		    retval->w != retval->color[i]->w)
+	    if (h != cs->color[i]->h || w != cs->color[i]->w)
 		PANIC("[%s] has the wrong size in color style [%s]",
-			buf, retval->name);
+			buf, cs->name);
 	}
 
     }
-    retval->color[0] = retval->color[1];
+    fclose(fin);
+    /* everyone has been laying things out with the size we told them */
+    if (cs->w && (w != cs->w || h != cs->h))
+	PANIC("color style [%s] changed size on disk",cs->name);
+    cs->w = w;
+    cs->h = h;
+    cs->color[0] = cs->color[1];
+
+    Malloc(cs->edged, SDL_Surface **,
+	    (cs->num_color+1)*sizeof(cs->edged[0]));
+    for (i=1;i<=cs->num_color;i++) {
+	cs->edged[i] = make_edged(screen, cs->color[i]);
+	if (!cs->edged[i])
+	    PANIC("could not make the edged blocks for color style [%s]",
+		    cs->name);
+    }
+    cs->edged[0] = cs->edged[1];
+
+    Debug("Color Style [%s] loaded (%d colors).\n",cs->name,
+	    cs->num_color);
+}
+
+/***************************************************************************
+ *      unload_color_style()
+ * Frees the surfaces of a color style; use_color_style() can load them
+ * again.
+ ***************************************************************************/
+static void
+unload_color_style(color_style *cs)
+{
+    int i;
+
+    for (i=1;i<=cs->num_color;i++) {
+	SDL_FreeSurface(cs->color[i]);
+	SDL_FreeSurface(cs->edged[i]);
+    }
+    Free(cs->color);
+    Free(cs->edged);
+}
+
+/***************************************************************************
+ *      index_color_style()
+ * Reads just enough of a color style file to put it in the menu and lay
+ * out the board: its name, number of colors and block size. The surfaces
+ * wait until use_color_style().
+ ***************************************************************************/
+static color_style *
+index_color_style(SDL_Surface * screen, const char *filename)
+{
+    color_style *retval;
+    char buf[2048];
+    FILE *fin = pack_fopen(filename);
+
+    if (!fin) {
+	Debug("fopen(%s)\n",filename);
+	return NULL;
+    }
+    Calloc(retval,color_style *,sizeof(*retval));
 
-    Debug("Color Style [%s] loaded (%d colors).\n",retval->name,
-	    retval->num_color);
+    fgets(buf,sizeof(buf),fin);
+    if (feof(fin)) {
+	Debug("unexpected EOF after name in [%s]\n",filename);
+	free(retval);
+	fclose(fin);
+	return NULL;
+    }
+    if (strchr(buf,'\n'))
+	*(strchr(buf,'\n')) = 0;
+    Strdup(retval->name, buf);
+    Strdup(retval->filename, filename);
 
+    if (fscanf(fin,"%d\n",&retval->num_color) != 1 ||
+	    retval->num_color < 1) {
+	Debug("malformed color count in [%s]\n",filename);
+	free(retval->filename);
+	free(retval->name);
+	free(retval);
+	fclose(fin);
+	return NULL;
+    }
+    if (!next_line(fin,buf,sizeof(buf)))
+	PANIC("unexpected EOF in color style [%s]",retval->name);
+    fclose(fin);
+    if (bmp_size(buf,&retval->w,&retval->h)) {
+	/* we can't tell without loading it, so load the lot */
+	retval->w = retval->h = 0;
+	load_color_style(screen, retval);
+    }
     return retval;
 }
 
+/***************************************************************************
+ *      use_color_style()
+ * Makes sure that the surfaces of a color style are loaded. Only the
+ * COLOR_CACHE most recently used styles keep theirs, so call this before
+ * drawing with a style.
+ *********************************************************************PROTO*/
+void
+use_color_style(color_style *cs)
+{
+    static color_style *cache[COLOR_CACHE];	/* most recent first */
+    int i;
+
+    for (i=0; i<COLOR_CACHE-1 && cache[i] != cs; i++)
+	;
+    if (cache[i] != cs && cache[i] && cache[i]->color)
+	unload_color_style(cache[i]);	/* the least recently used */
+    if (!cs->color)
+	load_color_style(screen, cs);
+    memmove(cache+1, cache, i*sizeof(cache[0]));
+    cache[0] = cs;
+}
+
 /***************************************************************************
  *	color_Select()
  * Returns 1 if the file pointed to ends with ".Color" 
@@ -327,7 +495,7 @@ load_special(void)
     for (i=0; i<NUM_SPECIAL; i++) {
 	SDL_Surface *imagebmp;
 	/* grab the lighting */
-	imagebmp = SDL_LoadBMP(filename[i]);
+	imagebmp = pack_LoadBMP(filename[i]);
 	if (!imagebmp) 
 	    PANIC("cannot load [%s], a required special piece",filename[i]);
 	if ( imagebmp->format->palette != NULL ) {
@@ -361,7 +529,7 @@ load_edges(void)
     for (i=0;i<4;i++) {
 	SDL_Surface *imagebmp;
 	/* grab the lighting */
-	imagebmp = SDL_LoadBMP(filename[i]);
+	imagebmp = pack_LoadBMP(filename[i]);
 	if (!imagebmp) 
 	    PANIC("cannot load [%s], a required edge",filename[i]);
 	/* set the video colormap */
@@ -390,8 +558,7 @@ color_styles
 load_color_styles(SDL_Surface * screen)
 {
     color_styles retval;
-    int i = 0;
-    DIR *my_dir;
+    pack_dir *my_dir;
     char filespec[2048];
 
     load_edges();
@@ -399,42 +566,25 @@ load_color_styles(SDL_Surface * screen)
 
     memset(&retval, 0, sizeof(retval));
 
-    my_dir = opendir("styles");
-    if (my_dir) {
-	while (1) { 
-	    struct dirent *this_file = readdir(my_dir);
-	    if (!this_file) break;
-	    if (color_Select(this_file))
-		i++;
-	} 
-	closedir(my_dir);
-    } else {
-	PANIC("Cannot read directory [styles/]");
-    }
-    my_dir = opendir("styles");
-    if (my_dir) {
-	if (i > 0) { 
-	    int j;
-	    Calloc(retval.style,color_style **,sizeof(*(retval.style))*i);
-	    retval.num_style = i;
-	    j = 0;
-	    while (j<i) {
-		struct dirent *this_file = readdir(my_dir);
-		if (!color_Select(this_file)) continue;
-		SPRINTF(filespec,"styles/%s",this_file->d_name);
-		retval.style[j] = load_color_style(screen, filespec);
-		if (strstr(retval.style[j]->name,"Default"))
-		    retval.choice = j;
-		j++;
-	    }
-	    closedir(my_dir);
-	    return retval;
-	} else {
-	    PANIC("No piece styles [styles/*.Color] found.\n");
-	}
-    } else { 
+    my_dir = pack_opendir("styles");
+    if (!my_dir)
 	PANIC("Cannot read directory [styles/]");
-    }
+    while (1) { 
+	struct dirent *this_file = pack_readdir(my_dir);
+	if (!this_file) break;
+	if (!color_Select(this_file)) continue;
+	SPRINTF(filespec,"styles/%s",this_file->d_name);
+	Realloc(retval.style,color_style **,
+		sizeof(*(retval.style))*(retval.num_style+1));
+	retval.style[retval.num_style] = index_color_style(screen, filespec);
+	if (!retval.style[retval.num_style]) continue;
+	if (strstr(retval.style[retval.num_style]->name,"Default"))
+	    retval.choice = retval.num_style;
+	retval.num_style++;
+    } 
+    pack_closedir(my_dir);
+    if (!retval.num_style)
+	PANIC("No color styles [styles/*.Color] found.\n");
     return retval;
 }
 
@@ -503,6 +653,7 @@ draw_play_piece(SDL_Surface *screen, color_style *cs,
     int i,j;
     int w,h;
 
+    PROFILE_BEGIN(PROF_PIECE);
     if (pp->special != No_Special)
 	cs = &special_style;
 
@@ -531,60 +682,45 @@ draw_play_piece(SDL_Surface *screen, color_style *cs,
 		dstrect.y = y + j * h;
 		dstrect.w = w;
 		dstrect.h = h;
-		SDL_BlitSafe(cs->color[this_color], NULL,screen,&dstrect) ;
-		if (pp->special == No_Special)
-		{
-		    int that_precolor = (j == 0) ? 0 : 
-			PRECOLOR_AT(pp,rot,i,j-1);
+		if (pp->special != No_Special) {
+		    SDL_BlitSafe(cs->color[this_color], NULL,screen,&dstrect) ;
+		} else {
+		    SDL_Rect srcrect;
+		    int mask = 0;
+		    int that_precolor;
 
 		    /* light up */
+		    that_precolor = (j == 0) ? 0 : 
+			PRECOLOR_AT(pp,rot,i,j-1);
 		    if (that_precolor == 0 ||
-			    pp->colormap[that_precolor] != this_color) {
-			dstrect.x = x + i * w;
-			dstrect.y = y + j * h;
-			dstrect.h = edge[HORIZ_LIGHT]->h;
-			dstrect.w = edge[HORIZ_LIGHT]->w;
-			SDL_BlitSafe(edge[HORIZ_LIGHT],NULL,
-				    screen,&dstrect) ;
-		    }
+			    pp->colormap[that_precolor] != this_color)
+			mask |= EDGE_LIGHT_UP;
 
 		    /* light left */
 		    that_precolor = (i == 0) ? 0 :
 			PRECOLOR_AT(pp,rot,i-1,j);
 		    if (that_precolor == 0 ||
-			    pp->colormap[that_precolor] != this_color) {
-			dstrect.x = x + i * w;
-			dstrect.y = y + j * h;
-			dstrect.h = edge[VERT_LIGHT]->h;
-			dstrect.w = edge[VERT_LIGHT]->w;
-			SDL_BlitSafe(edge[VERT_LIGHT],NULL,
-				    screen,&dstrect) ;
-		    }
+			    pp->colormap[that_precolor] != this_color)
+			mask |= EDGE_LIGHT_LEFT;
 		    
 		    /* shadow down */
 		    that_precolor = (j == pp->base->dim-1) ? 0 :
 			PRECOLOR_AT(pp,rot,i,j+1);
 		    if (that_precolor == 0 ||
-			    pp->colormap[that_precolor] != this_color) {
-			dstrect.x = x + i * w;
-			dstrect.y = (y + (j+1) * h) - edge[HORIZ_DARK]->h;
-			dstrect.h = edge[HORIZ_DARK]->h;
-			dstrect.w = edge[HORIZ_DARK]->w;
-			SDL_BlitSafe(edge[HORIZ_DARK],NULL,
-				    screen,&dstrect);
-		    }
+			    pp->colormap[that_precolor] != this_color)
+			mask |= EDGE_DARK_DOWN;
 
 		    /* shadow right */
 		    that_precolor = (i == pp->base->dim-1) ? 0 :
 			PRECOLOR_AT(pp,rot,i+1,j);
 		    if (that_precolor == 0 ||
-			    pp->colormap[that_precolor] != this_color) {
-			dstrect.x = (x + (i+1) * w) - edge[VERT_DARK]->w;
-			dstrect.y = (y + (j) * h);
-			dstrect.h = edge[VERT_DARK]->h;
-			dstrect.w = edge[VERT_DARK]->w;
-			SDL_BlitSafe(edge[VERT_DARK],NULL, screen,&dstrect);
-		    }
+			    pp->colormap[that_precolor] != this_color)
+			mask |= EDGE_DARK_RIGHT;
+
+		    /* the block and its edges in one go */
+		    EDGED_TILE(cs,mask,srcrect);
+		    SDL_BlitSafe(cs->edged[this_color],&srcrect,
+			    screen,&dstrect);
 		}
 	    }
 	}
@@ -604,6 +740,7 @@ draw_play_piece(SDL_Surface *screen, color_style *cs,
 
     SDL_UpdateSafe(screen,1,&dstrect);
 
+    PROFILE_END(PROF_PIECE);
     return;
 }
 
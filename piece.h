@@ -60,11 +60,15 @@ typedef struct play_piece_struct {
  * tiles that make up pieces */
 typedef struct color_style_struct {
     char *name;			/* the name of the style */
+    char *filename;		/* where the rest of it comes from */
     int num_color;		/* number of colors defined */
-    SDL_Surface **color;	/* surfaces for the colors */
+    SDL_Surface **color;	/* surfaces for the colors (NULL until
+				   use_color_style() loads them) */
     /* note that the colors go from 1 to "num_color" inclusive! */
     int w;			/* width of each color block */
     int h;			/* height of each color block */
+    SDL_Surface **edged;	/* per color: the block with every mix of
+				   edges already drawn on (see EDGED_TILE) */
 } color_style;
 
 color_style special_style;
@@ -75,6 +79,20 @@ color_style special_style;
 #define VERT_DARK	3
 SDL_Surface *edge[4];	/* hikari to kage */
 
+/* which edges a block needs. The "edged" surface of a color holds all 16
+ * combinations in a 4x4 grid, so that a block and its edges are one blit */
+#define EDGE_LIGHT_UP		1
+#define EDGE_LIGHT_LEFT		2
+#define EDGE_DARK_DOWN		4
+#define EDGE_DARK_RIGHT		8
+#define EDGED_TILE(cs,mask,r)	((r).x = ((mask) & 3) * (cs)->w, \
+				 (r).y = ((mask) >> 2) * (cs)->h, \
+				 (r).w = (cs)->w, (r).h = (cs)->h)
+
+/* how many color styles keep their surfaces loaded at once: the two in
+ * play and a couple more */
+#define COLOR_CACHE	4
+
 /* this structure holds all of the color styles we have been able to load
  * for this game */
 typedef struct color_styles_struct {
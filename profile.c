@@ -0,0 +1,247 @@
+/*
+ *                               Alizarin Tetris
+ * The frame profiler. Each pass through the event loop is a frame; its
+ * time is split between the PROF_* sections as they are entered and
+ * left. The last PROF_WINDOW frame times give the rolling p50/p99 for
+ * the overlay, and every frame can be appended to a CSV trace.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+#include "config.h"	/* go autoconf! */
+
+#include "atris.h"
+#include "display.h"
+#include "grid.h"
+#include "options.h"
+#include "profile.h"
+
+#include "display.pro"
+
+static char *section_name[PROF_NUM] = {
+    "sim", "grid", "falling", "piece", "flame", "net", "present", "sleep"
+};
+
+static struct profile_struct {
+    int		running;	/* between Profile_Start() and Profile_Stop() */
+    Uint32	frames;		/* this match */
+    Uint32	frame_start;	/* microseconds, see now_us() */
+    Uint32	mark;		/* when we last charged a section */
+    int		current;	/* the section being charged */
+    int		stack[PROF_DEPTH];	/* ... and the ones it interrupted */
+    int		depth;
+    Uint32	spent[PROF_NUM];	/* this frame, microseconds */
+    Uint32	recent[PROF_NUM];	/* since the overlay was drawn */
+    Uint32	match[PROF_NUM];	/* this match */
+    Uint32	window[PROF_WINDOW];	/* the last frame times */
+    Uint32	next_overlay;	/* SDL_GetTicks() */
+    FILE	*trace;
+} Prof;
+
+/***************************************************************************
+ *      now_us()
+ * A microsecond clock. It wraps every 71 minutes, but we only ever look
+ * at differences.
+ ***************************************************************************/
+static Uint32
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (Uint32) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/***************************************************************************
+ *      charge()
+ * Bills the time since the last mark to the current section.
+ ***************************************************************************/
+static Uint32
+charge(void)
+{
+    Uint32 t = now_us();
+
+    Prof.spent[Prof.current] += t - Prof.mark;
+    Prof.mark = t;
+    return t;
+}
+
+/***************************************************************************
+ *      by_value()
+ * For qsort().
+ ***************************************************************************/
+static int
+by_value(const void *a, const void *b)
+{
+    Uint32 x = *(const Uint32 *)a, y = *(const Uint32 *)b;
+
+    return (x > y) - (x < y);
+}
+
+/***************************************************************************
+ *      Profile_Start()
+ * Call when the event loop starts. Opens the trace file the first time.
+ *********************************************************************PROTO*/
+void
+Profile_Start(void)
+{
+    if (!Options.profile)
+	return;
+    if (Options.profile_file && !Prof.trace) {
+	Prof.trace = fopen(Options.profile_file, "a");
+	if (!Prof.trace)
+	    Debug("Cannot open [%s] for the profile trace.\n",
+		    Options.profile_file);
+	else if (ftell(Prof.trace) == 0) {
+	    int s;
+
+	    fprintf(Prof.trace, "frame,total_us");
+	    for (s=0; s<PROF_NUM; s++)
+		fprintf(Prof.trace, ",%s_us", section_name[s]);
+	    fprintf(Prof.trace, "\n");
+	}
+    }
+    memset(Prof.spent, 0, sizeof(Prof.spent));
+    memset(Prof.recent, 0, sizeof(Prof.recent));
+    memset(Prof.match, 0, sizeof(Prof.match));
+    Prof.frames = 0;
+    Prof.depth = 0;
+    Prof.current = PROF_SIM;
+    Prof.frame_start = Prof.mark = now_us();
+    Prof.next_overlay = SDL_GetTicks();
+    Prof.running = 1;
+}
+
+/***************************************************************************
+ *      Profile_Begin()
+ * Starts charging time to section "s" (use PROFILE_BEGIN()).
+ *********************************************************************PROTO*/
+void
+Profile_Begin(int s)
+{
+    if (!Prof.running)
+	return;
+    charge();
+    if (Prof.depth < PROF_DEPTH)
+	Prof.stack[Prof.depth++] = Prof.current;
+    Prof.current = s;
+}
+
+/***************************************************************************
+ *      Profile_End()
+ * Goes back to charging whatever section "s" interrupted (use
+ * PROFILE_END()).
+ *********************************************************************PROTO*/
+void
+Profile_End(int s)
+{
+    if (!Prof.running || Prof.current != s)
+	return;
+    charge();
+    Prof.current = Prof.depth ? Prof.stack[--Prof.depth] : PROF_SIM;
+}
+
+/***************************************************************************
+ *      Profile_Percentile()
+ * The frame time (in microseconds) that "pct" percent of the recent
+ * frames came in under.
+ *********************************************************************PROTO*/
+Uint32
+Profile_Percentile(int pct)
+{
+    Uint32 sorted[PROF_WINDOW];
+    int n = min(Prof.frames, PROF_WINDOW);
+
+    if (n == 0)
+	return 0;
+    memcpy(sorted, Prof.window, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), by_value);
+    return sorted[(n - 1) * pct / 100];
+}
+
+/***************************************************************************
+ *      Profile_Share()
+ * The percentage of the time since the overlay was last drawn that went
+ * to section "s".
+ *********************************************************************PROTO*/
+int
+Profile_Share(int s)
+{
+    Uint32 total = 0;
+    int i;
+
+    for (i=0; i<PROF_NUM; i++)
+	total += Prof.recent[i];
+    if (total == 0)
+	return 0;
+    return (int) ((double) Prof.recent[s] * 100 / total + 0.5);
+}
+
+/***************************************************************************
+ *      Profile_Frame()
+ * Call at the top of each pass through the event loop: closes the frame
+ * that just ended, traces it and redraws the overlay now and then.
+ *********************************************************************PROTO*/
+void
+Profile_Frame(void)
+{
+    Uint32 t, total;
+    int s;
+
+    if (!Prof.running)
+	return;
+    t = charge();
+    total = t - Prof.frame_start;
+    Prof.window[Prof.frames % PROF_WINDOW] = total;
+    Prof.frames++;
+
+    if (Prof.trace) {
+	fprintf(Prof.trace, "%u,%u", (unsigned) Prof.frames, (unsigned) total);
+	for (s=0; s<PROF_NUM; s++)
+	    fprintf(Prof.trace, ",%u", (unsigned) Prof.spent[s]);
+	fprintf(Prof.trace, "\n");
+    }
+    for (s=0; s<PROF_NUM; s++) {
+	Prof.recent[s] += Prof.spent[s];
+	Prof.match[s] += Prof.spent[s];
+	Prof.spent[s] = 0;
+    }
+    Prof.frame_start = t;
+
+    if (SDL_GetTicks() >= Prof.next_overlay) {
+	draw_profile_stats();
+	memset(Prof.recent, 0, sizeof(Prof.recent));
+	Prof.next_overlay = SDL_GetTicks() + PROF_OVERLAY_INTERVAL;
+	/* don't bill the next frame for drawing this one's numbers */
+	Prof.frame_start = Prof.mark = now_us();
+    }
+}
+
+/***************************************************************************
+ *      Profile_Stop()
+ * Call when the event loop is done: prints a summary of the match.
+ *********************************************************************PROTO*/
+void
+Profile_Stop(void)
+{
+    Uint32 total = 0;
+    int s;
+
+    if (!Prof.running)
+	return;
+    Prof.running = 0;
+    if (Prof.trace)
+	fflush(Prof.trace);
+    if (!Prof.frames)
+	return;
+    for (s=0; s<PROF_NUM; s++)
+	total += Prof.match[s];
+    Debug("%u frames, mean %u us, p50 %u us, p99 %u us\n",
+	    (unsigned) Prof.frames, (unsigned) (total / Prof.frames),
+	    (unsigned) Profile_Percentile(50),
+	    (unsigned) Profile_Percentile(99));
+    for (s=0; s<PROF_NUM; s++)
+	Debug("%-8s %5.1f%%  %u us/frame\n", section_name[s],
+		total ? (double) Prof.match[s] * 100 / total : 0.0,
+		(unsigned) (Prof.match[s] / Prof.frames));
+}
@@ -0,0 +1,33 @@
+/*
+ *                               Alizarin Tetris
+ * The frame profiler: where each pass through the event loop spends its
+ * time. Nothing is measured unless the user asked for it (--profile).
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+/* what a frame's time goes to; anything not claimed by one of the others
+ * is counted as simulation */
+#define PROF_SIM	0
+#define PROF_GRID	1	/* draw_grid() */
+#define PROF_FALLING	2	/* draw_falling() */
+#define PROF_PIECE	3	/* draw_play_piece() */
+#define PROF_FLAME	4	/* atris_run_flame() */
+#define PROF_NET	5	/* polling and reading the network */
+#define PROF_PRESENT	6	/* atris_flush_updates() */
+#define PROF_SLEEP	7	/* waiting for the next thing to do */
+#define PROF_NUM	8
+
+#define PROF_WINDOW	256	/* frames in the rolling p50/p99 */
+#define PROF_DEPTH	8	/* sections can nest this deep */
+#define PROF_OVERLAY_INTERVAL	500	/* ms between overlay redraws */
+
+/* cheap enough to leave in everywhere */
+#define PROFILE_BEGIN(s)	{ if (Options.profile) Profile_Begin(s); }
+#define PROFILE_END(s)		{ if (Options.profile) Profile_End(s); }
+
+#include "profile.pro"
+
+#endif
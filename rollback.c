@@ -0,0 +1,327 @@
+/*
+ *                               Alizarin Tetris
+ * Rollback prediction for network play. The other player's falling piece
+ * is simulated here from the NET_PIECE and NET_MOVE messages they send,
+ * so that it shows up on their board without waiting for the network.
+ * Gravity is deterministic; only their inputs are unknown, and we predict
+ * that they make none. When a late input turns up we throw the prediction
+ * away, go back to the moment the input happened and re-simulate to now.
+ *
+ * Copyright 2000, Kiri Wagstaff & Westley Weimer
+ */
+
+#include "config.h"	/* go autoconf! */
+
+#include "atris.h"
+#include "display.h"
+#include "grid.h"
+#include "piece.h"
+#include "sound.h"
+#include "ai.h"
+#include "network.h"
+#include "fastrand.h"
+
+#include "event.pro"
+
+/* if the other side's event loop fell this far behind a falling event
+ * it skips the ones it missed (see event_loop()), and so do we */
+#define RB_CATCHUP	250
+
+/* one moment in the life of their falling piece; times are in their
+ * milliseconds since the match began, positions are board-relative */
+typedef struct rb_state_struct {
+    Uint32	frame;
+    int		x, y, rot;
+    int		fall_speed;
+    Uint32	next_fall;
+    int		collide;	/* when it settles, -1 if not resting */
+} rb_state;
+
+static struct rollback_struct {
+    int		active;		/* do we have a piece in the air? */
+    int		landed;		/* did we predict that it came down? */
+    play_piece	pp;
+    int		blockWidth;
+    int		fall_interval;
+    int		settle;
+    rb_state	input;		/* the last thing they told us */
+    rb_state	now;		/* our guess at where it is now */
+    int		skew;		/* their clock minus ours, at least */
+    int		have_skew;
+    Grid	saved;		/* their board before our predicted landing */
+    int		drawn;		/* where we last drew the piece */
+    int		drawn_x, drawn_y, drawn_rot;
+    int		redraw_grid;
+    Uint32	rollbacks;	/* predictions we had to take back */
+} R;
+
+/***************************************************************************
+ *      erase_piece()
+ * Uncovers whatever was under the piece as we last drew it.
+ ***************************************************************************/
+static void
+erase_piece(SDL_Surface *screen, color_style *cs, Grid *g)
+{
+    SDL_Rect dstrect;
+    int i,j;
+
+    if (!R.drawn)
+	return;
+    for (j=0;j<R.pp.base->dim;j++)
+	for (i=0;i<R.pp.base->dim;i++)
+	    if (BITMAP(*R.pp.base,R.drawn_rot,i,j)) {
+		dstrect.x = g->board.x + R.drawn_x + i * cs->w;
+		dstrect.y = g->board.y + R.drawn_y + j * cs->h;
+		dstrect.w = cs->w;
+		dstrect.h = cs->h;
+		SDL_BlitSafe(widget_layer,&dstrect,screen,&dstrect);
+	    }
+    R.drawn = 0;
+}
+
+/***************************************************************************
+ *      remote_now()
+ * Our best guess at the other side's match clock: the largest lead their
+ * messages have shown over ours plus half the round trip they took.
+ ***************************************************************************/
+static Uint32
+remote_now(void)
+{
+    Uint32 now = SDL_GetTicks() - NetStats.start + R.skew;
+
+    if (NetStats.rtt > 0)
+	now += NetStats.rtt / 2;
+    return now;
+}
+
+/***************************************************************************
+ *      note_frame()
+ * Keeps the clock skew estimate up to date with a message stamped at
+ * their time "frame".
+ ***************************************************************************/
+static void
+note_frame(Uint32 frame)
+{
+    int lead = (int) (frame - (SDL_GetTicks() - NetStats.start));
+
+    if (!R.have_skew || lead > R.skew) {
+	R.skew = lead;
+	R.have_skew = 1;
+    }
+}
+
+/***************************************************************************
+ *      fall_event()
+ * One falling event for their piece at their time "t", exactly as
+ * event_loop() would run it.
+ ***************************************************************************/
+static void
+fall_event(Grid *g, Uint32 t)
+{
+    rb_state *s = &R.now;
+    int try, row, col;
+
+    do {
+	s->next_fall += R.fall_interval;
+    } while (s->next_fall <= t);
+
+    for (try = s->fall_speed; try > 0; try--)
+	if (valid_screen_position(&R.pp, R.blockWidth, g, s->rot,
+		    g->board.x + s->x, g->board.y + s->y + try)) {
+	    s->y += try;
+	    s->fall_speed = try;
+	    return;
+	}
+    if (s->collide < 0) {
+	s->collide = t + R.settle;
+	return;
+    }
+    if ((int) t < s->collide)
+	return;
+
+    /* we think it landed: keep their board so that we can take it back */
+    R.active = 0;
+    R.landed = 1;
+    grid_snapshot(&R.saved, g);
+    if (R.pp.special != No_Special)
+	return;	/* we leave the special effects to them */
+    if (s->x % R.blockWidth || s->y % R.blockWidth)
+	return;
+    col = s->x / R.blockWidth;
+    row = s->y / R.blockWidth;
+    if (valid_position(&R.pp, col, row, s->rot, g)) {
+	paste_on_board(&R.pp, col, row, s->rot, g);
+	R.redraw_grid = 1;
+    }
+}
+
+/***************************************************************************
+ *      simulate()
+ * Runs their piece forward to their time "t".
+ ***************************************************************************/
+static void
+simulate(Grid *g, Uint32 t)
+{
+    while (R.active && R.now.next_fall <= t) {
+	if (t - R.now.next_fall > RB_CATCHUP)
+	    fall_event(g, t);	/* they stalled too */
+	else
+	    fall_event(g, R.now.next_fall);
+    }
+    R.now.frame = t;
+}
+
+/***************************************************************************
+ *      Rollback_Reset()
+ * Call at the beginning of each network match, after
+ * Network_StatsReset(). "g" is the other player's board.
+ *********************************************************************PROTO*/
+void
+Rollback_Reset(Grid *g)
+{
+    Grid saved = R.saved;
+
+    if (saved.w != g->w || saved.h != g->h)
+	saved = generate_board(g->w, g->h, 0);
+    if (R.rollbacks)
+	Debug("Rollback: %d predictions taken back last match.\n",
+		(int) R.rollbacks);
+    memset(&R, 0, sizeof(R));
+    R.saved = saved;
+}
+
+/***************************************************************************
+ *      Rollback_Input()
+ * Reads a NET_PIECE or NET_MOVE message (the tag has already been read)
+ * and replays their piece from the moment it was sent. Returns 0 on
+ * success.
+ *********************************************************************PROTO*/
+int
+Rollback_Input(int sock, char tag, SDL_Surface *screen, piece_style *ps,
+	color_style *cs, Grid *g)
+{
+    int frame, x, y, rot, fall_speed, next_fall, collide;
+    int bw = R.blockWidth, interval = R.fall_interval, settle = R.settle;
+    Uint32 seed = 0, now;
+
+    if (Network_RecvInt(sock, &frame))
+	return -1;
+    if (tag == NET_PIECE && (Network_RecvU32(sock, &seed) ||
+		Network_RecvInt(sock, &bw) ||
+		Network_RecvInt(sock, &interval) ||
+		Network_RecvInt(sock, &settle)))
+	return -1;
+    if (Network_RecvInt(sock, &x) || Network_RecvInt(sock, &y) ||
+	    Network_RecvInt(sock, &rot) || Network_RecvInt(sock, &fall_speed) ||
+	    Network_RecvInt(sock, &next_fall) || Network_RecvInt(sock, &collide))
+	return -1;
+
+    note_frame(frame);
+
+    if (tag == NET_PIECE) {
+	Uint32 our_seed = GetRandSeed();
+
+	erase_piece(screen, cs, g);
+	/* the same seed gives the same piece, as long as our piece style
+	 * agrees with theirs; don't disturb anyone else's random numbers */
+	R.pp = generate_piece(ps, cs, seed);
+	SeedRandom(our_seed);
+	R.blockWidth = bw;
+	R.fall_interval = interval > 0 ? interval : 1;
+	R.settle = settle;
+	R.landed = 0;
+	/* we can only draw it if our blocks are the same size */
+	R.active = (bw == cs->w);
+    } else if (!R.active && !R.landed)
+	return 0;	/* nothing of theirs is falling */
+
+    if (R.landed) {
+	/* we guessed it had landed, but they were still moving it */
+	grid_restore(g, &R.saved);
+	R.landed = 0;
+	R.active = 1;
+	R.redraw_grid = 1;
+	R.rollbacks++;
+    }
+    if (!R.active)
+	return 0;
+
+    R.input.frame = frame;
+    R.input.x = x;
+    R.input.y = y;
+    R.input.rot = rot & 3;
+    R.input.fall_speed = fall_speed;
+    R.input.next_fall = next_fall;
+    R.input.collide = collide;
+
+    /* roll back to their input and run forward again */
+    R.now = R.input;
+    now = remote_now();
+    simulate(g, now > R.input.frame ? now : R.input.frame);
+    return 0;
+}
+
+/***************************************************************************
+ *      Rollback_Board()
+ * Their real board is about to arrive, so any piece we are showing has
+ * really landed (or was never there): stop predicting it.
+ *********************************************************************PROTO*/
+void
+Rollback_Board(SDL_Surface *screen, color_style *cs, Grid *g)
+{
+    if (R.active)
+	erase_piece(screen, cs, g);
+    R.drawn = 0;
+    R.active = 0;
+    R.landed = 0;
+}
+
+/***************************************************************************
+ *      Rollback_Resume()
+ * The game was paused for "ms" milliseconds. Their falling events were
+ * put off by the same amount (see do_pause()), so put ours off too.
+ *********************************************************************PROTO*/
+void
+Rollback_Resume(Uint32 ms)
+{
+    R.now.next_fall += ms;
+    if (R.now.collide >= 0)
+	R.now.collide += ms;
+}
+
+/***************************************************************************
+ *      Rollback_Advance()
+ * Moves their piece along to where we think it is now and draws it. Call
+ * once per pass through the event loop when we are not paused.
+ *********************************************************************PROTO*/
+void
+Rollback_Advance(SDL_Surface *screen, color_style *cs, Grid *g)
+{
+    if (R.active)
+	simulate(g, remote_now());
+
+    if (R.redraw_grid) {
+	erase_piece(screen, cs, g);
+	draw_grid(screen, cs, g, 1);
+	R.redraw_grid = 0;
+    }
+    if (!R.active) {
+	erase_piece(screen, cs, g);
+	return;
+    }
+    if (R.drawn && R.drawn_x == R.now.x && R.drawn_y == R.now.y &&
+	    R.drawn_rot == R.now.rot)
+	return;
+    if (!R.drawn) {
+	R.drawn_x = R.now.x;
+	R.drawn_y = R.now.y;
+	R.drawn_rot = R.now.rot;
+    }
+    draw_play_piece(screen, cs, &R.pp,
+	    g->board.x + R.drawn_x, g->board.y + R.drawn_y, R.drawn_rot,
+	    &R.pp, g->board.x + R.now.x, g->board.y + R.now.y, R.now.rot);
+    R.drawn = 1;
+    R.drawn_x = R.now.x;
+    R.drawn_y = R.now.y;
+    R.drawn_rot = R.now.rot;
+}
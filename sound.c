@@ -29,97 +29,479 @@
 
 #include "atris.h"
 #include "sound.h"
+#include "pack.h"
 
 samples_to_be_played current;	/* what should we play now? */
+static sound_ring ring;		/* what should we play next? */
+static SDL_AudioSpec device;	/* what the sound card really plays */
+static sound_stream *streams;	/* every streamed WAV */
+static SDL_sem *loader_wake;	/* posted when a stream wants reading */
+
+/* one bit per sound ID: is any slot in "current" playing it? Only the
+ * audio thread looks at these */
+static Uint32 *playing;
+#define PLAYING(id)	(playing[(id) >> 5] & (1u << ((id) & 31)))
+#define SET_PLAYING(id)	(playing[(id) >> 5] |= (1u << ((id) & 31)))
+#define CLR_PLAYING(id)	(playing[(id) >> 5] &= ~(1u << ((id) & 31)))
 
 char *sound_name[NUM_SOUND] = { /* english names */
     "thud", "clear1", "clear4", "levelup", "leveldown" , "garbage1", "clock"
 };
 
+/* the two ends of the ring (and of the list of streams) only ever meet
+ * through these */
+#if defined(__GNUC__)
+#define RING_GET(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_PUT(p,v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LIST_GET(p)	RING_GET(p)
+#define LIST_PUT(p,v)	RING_PUT(p,v)
+#else
+#define RING_GET(p)	(*(volatile Uint32 *)(p))
+#define RING_PUT(p,v)	(*(volatile Uint32 *)(p) = (v))
+#define LIST_GET(p)	(*(sound_stream * volatile *)(p))
+#define LIST_PUT(p,v)	(*(sound_stream * volatile *)(p) = (v))
+#endif
+
+/***************************************************************************
+ *      start_sample()
+ * Puts a sample into a free mixer slot. Called by the audio thread.
+ ***************************************************************************/
+static void
+start_sample(sound_command *c)
+{
+    int i;
+
+    for (i=0; i< MAX_MIXED_SAMPLES; i++) 
+	if (current.sample[i].in_use == 0) {
+	    current.sample[i].in_use = 1;
+	    current.sample[i].delay = c->delay;
+	    current.sample[i].len = c->len;
+	    current.sample[i].pos = 0;
+	    current.sample[i].audio_data = c->audio_data;
+	    current.sample[i].id = c->id;
+	    current.sample[i].gain[0] = c->gain[0];
+	    current.sample[i].gain[1] = c->gain[1];
+	    current.sample[i].stream = c->stream;
+	    SET_PLAYING(c->id);
+	    if (c->stream) {
+		/* from the top, please */
+		c->stream->owed = 0;
+		RING_PUT(&c->stream->want, c->stream->want + 1);
+		SDL_SemPost(loader_wake);
+	    }
+	    return;
+	}
+    /* no room in the mixer: the sound is lost (and we can't very well
+     * print anything from in here) */
+}
+
+/***************************************************************************
+ *      end_sample()
+ * Frees mixer slot "i". Called by the audio thread.
+ ***************************************************************************/
+static void
+end_sample(int i)
+{
+    int j, id = current.sample[i].id;
+
+    current.sample[i].in_use = 0;
+    /* the same sound may be playing in another slot */
+    for (j=0; j< MAX_MIXED_SAMPLES; j++) 
+	if (current.sample[j].in_use != 0 && current.sample[j].id == id)
+	    return;
+    CLR_PLAYING(id);
+}
+
+/***************************************************************************
+ *      run_commands()
+ * Carries out everything the game has posted since the last call. Called
+ * by the audio thread.
+ ***************************************************************************/
+static void
+run_commands(void)
+{
+    Uint32 tail = ring.tail, head = RING_GET(&ring.head);
+    sound_command *c;
+    int i;
+
+    for (; tail != head; tail++) {
+	c = &ring.cmd[tail & (SOUND_RING - 1)];
+	switch (c->op) {
+	    case SOUND_PLAY_ONCE:
+		/* are we already playing? */
+		if (!PLAYING(c->id))
+		    start_sample(c);
+		break;
+
+	    case SOUND_PLAY:
+		/* a stream can only play once at a time */
+		if (!c->stream || !PLAYING(c->id))
+		    start_sample(c);
+		break;
+
+	    case SOUND_STOP:
+		if (!PLAYING(c->id))
+		    break;
+		for (i=0; i< MAX_MIXED_SAMPLES; i++) 
+		    if (current.sample[i].in_use != 0 &&
+			    current.sample[i].id == c->id)
+			current.sample[i].in_use = 0; /* turn it off */
+		CLR_PLAYING(c->id);
+		break;
+
+	    case SOUND_STOP_ALL:
+		for (i=0; i<MAX_MIXED_SAMPLES; i++)
+		    if (current.sample[i].in_use != 0) {
+			current.sample[i].in_use = 0;
+			CLR_PLAYING(current.sample[i].id);
+		    }
+		break;
+	}
+    }
+    RING_PUT(&ring.tail, tail);
+}
+
+/***************************************************************************
+ *      ms_to_bytes()
+ * How many bytes of device audio last "ms" milliseconds? Always a whole
+ * number of sample frames.
+ ***************************************************************************/
+static Uint32
+ms_to_bytes(int ms)
+{
+    Uint32 frame = (device.format & 0xff) / 8 * device.channels;
+
+    if (ms <= 0)
+	return 0;
+    return (Uint32) ms * device.freq / 1000 * frame;
+}
+
+/***************************************************************************
+ *      bytes_to_ms()
+ * ... and the other way around.
+ ***************************************************************************/
+static int
+bytes_to_ms(Uint32 len)
+{
+    Uint32 frame = (device.format & 0xff) / 8 * device.channels;
+
+    if (!frame || !device.freq)
+	return 0;
+    return (int) (len / frame * 1000 / device.freq);
+}
+
+/***************************************************************************
+ *      post_command()
+ * Hands a command to the mixer without waiting for it. "volume" runs from
+ * 0 to SDL_MIX_MAXVOLUME and "pan" from -128 (left) to 128 (right).
+ * Returns 0 on success, -1 if the mixer has fallen so far behind that the
+ * ring is full.
+ ***************************************************************************/
+static int
+post_command(int op, sound_style *ss, int which, int delay, int volume,
+	int pan)
+{
+    Uint32 head = ring.head;
+    sound_command *c;
+
+    if (head - RING_GET(&ring.tail) >= SOUND_RING) {
+	Debug("Sound commands are not being heard: dropping one.\n");
+	return -1;
+    }
+    if (volume < 0) volume = 0;
+    if (volume > SDL_MIX_MAXVOLUME) volume = SDL_MIX_MAXVOLUME;
+    if (pan < -128) pan = -128;
+    if (pan > 128) pan = 128;
+
+    c = &ring.cmd[head & (SOUND_RING - 1)];
+    c->op = op;
+    c->delay = ms_to_bytes(delay);
+    if (device.channels == 2) {
+	c->gain[0] = volume * (pan > 0 ? 128 - pan : 128) / 128;
+	c->gain[1] = volume * (pan < 0 ? 128 + pan : 128) / 128;
+    } else
+	c->gain[0] = c->gain[1] = volume;
+    if (ss) {
+	c->len = ss->WAV[which].audio_len;
+	c->audio_data = ss->WAV[which].audio_buf;
+	c->id = ss->WAV[which].id;
+	c->stream = ss->WAV[which].stream;
+	/* the read-ahead buffer only exists once it is needed */
+	if (c->stream && !c->stream->buf)
+	    Malloc(c->stream->buf, Uint8 *, c->stream->size);
+    }
+    RING_PUT(&ring.head, head + 1);
+    return 0;
+}
+
+/* The mixer proper, for 16-bit devices: every voice is added into a wide
+ * buffer at its own gain, and the sum is scaled and clipped to 16 bits
+ * once at the end. Samples alternate left, right on a stereo device, and
+ * every voice starts on a whole frame, so sample i gets gain[i & 1] */
+#define MIX_SHIFT	7	/* SDL_MIX_MAXVOLUME == 1 << MIX_SHIFT */
+
+static Sint32 *mixbuf;		/* device.size / 2 of them */
+static int mixlen;		/* ... which is this many bytes of output */
+
+static void
+mix_voice_c(Sint32 *acc, const Sint16 *s, int i, int n, const Sint32 *gain)
+{
+    for (; i<n; i++)
+	acc[i] += s[i] * gain[i & 1];
+}
+
+static void
+clip_mix_c(Sint16 *out, const Sint32 *acc, int i, int n)
+{
+    Sint32 v;
+
+    for (; i<n; i++) {
+	v = acc[i] >> MIX_SHIFT;
+	if (v > 32767) v = 32767;
+	if (v < -32768) v = -32768;
+	out[i] = v;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SOUND_SIMD
+#include <immintrin.h>
+
+/* SSE2 has no 32-bit multiply, but a 16-bit sample times a gain of at
+ * most 128 is put together exactly from the low and high halves of the
+ * 16-bit product */
+static void __attribute__((target("sse2")))
+mix_voice_sse2(Sint32 *acc, const Sint16 *s, int i, int n, const Sint32 *gain)
+{
+    __m128i g = _mm_set_epi16(gain[1], gain[0], gain[1], gain[0],
+	    gain[1], gain[0], gain[1], gain[0]);
+    __m128i x, lo, hi, a;
+
+    for (; i+8<=n; i+=8) {
+	x = _mm_loadu_si128((__m128i *) (s+i));
+	lo = _mm_mullo_epi16(x, g);
+	hi = _mm_mulhi_epi16(x, g);
+	a = _mm_loadu_si128((__m128i *) (acc+i));
+	_mm_storeu_si128((__m128i *) (acc+i),
+		_mm_add_epi32(a, _mm_unpacklo_epi16(lo, hi)));
+	a = _mm_loadu_si128((__m128i *) (acc+i+4));
+	_mm_storeu_si128((__m128i *) (acc+i+4),
+		_mm_add_epi32(a, _mm_unpackhi_epi16(lo, hi)));
+    }
+    mix_voice_c(acc, s, i, n, gain);
+}
+
+static void __attribute__((target("sse2")))
+clip_mix_sse2(Sint16 *out, const Sint32 *acc, int i, int n)
+{
+    __m128i a, b;
+
+    for (; i+8<=n; i+=8) {
+	a = _mm_srai_epi32(_mm_loadu_si128((__m128i *) (acc+i)), MIX_SHIFT);
+	b = _mm_srai_epi32(_mm_loadu_si128((__m128i *) (acc+i+4)), MIX_SHIFT);
+	_mm_storeu_si128((__m128i *) (out+i), _mm_packs_epi32(a, b));
+    }
+    clip_mix_c(out, acc, i, n);
+}
+
+static void __attribute__((target("avx2")))
+mix_voice_avx2(Sint32 *acc, const Sint16 *s, int i, int n, const Sint32 *gain)
+{
+    __m256i g = _mm256_setr_epi32(gain[0], gain[1], gain[0], gain[1],
+	    gain[0], gain[1], gain[0], gain[1]);
+    __m256i x, a;
+
+    for (; i+8<=n; i+=8) {
+	x = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *) (s+i)));
+	a = _mm256_loadu_si256((__m256i *) (acc+i));
+	_mm256_storeu_si256((__m256i *) (acc+i),
+		_mm256_add_epi32(a, _mm256_mullo_epi32(x, g)));
+    }
+    mix_voice_c(acc, s, i, n, gain);
+}
+
+static void __attribute__((target("avx2")))
+clip_mix_avx2(Sint16 *out, const Sint32 *acc, int i, int n)
+{
+    __m256i a, b;
+
+    for (; i+16<=n; i+=16) {
+	a = _mm256_srai_epi32(_mm256_loadu_si256((__m256i *) (acc+i)),
+		MIX_SHIFT);
+	b = _mm256_srai_epi32(_mm256_loadu_si256((__m256i *) (acc+i+8)),
+		MIX_SHIFT);
+	/* packing works within each 128-bit half: put the quarters back
+	 * in order */
+	_mm256_storeu_si256((__m256i *) (out+i),
+		_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8));
+    }
+    clip_mix_c(out, acc, i, n);
+}
+#endif
+
+/* the kernels in use, picked by pick_mixer() */
+static void (*mix_voice)(Sint32 *, const Sint16 *, int, int, const Sint32 *)
+    = mix_voice_c;
+static void (*clip_mix)(Sint16 *, const Sint32 *, int, int) = clip_mix_c;
+
+/***************************************************************************
+ *      pick_mixer()
+ * Picks the fastest mixing kernels this processor can run.
+ ***************************************************************************/
+static void
+pick_mixer(void)
+{
+#ifdef SOUND_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	mix_voice = mix_voice_avx2;
+	clip_mix = clip_mix_avx2;
+	Debug("Mixer: using AVX2.\n");
+    } else if (__builtin_cpu_supports("sse2")) {
+	mix_voice = mix_voice_sse2;
+	clip_mix = clip_mix_sse2;
+	Debug("Mixer: using SSE2.\n");
+    }
+#endif
+}
+
+/***************************************************************************
+ *      mix_piece()
+ * Mixes "n" bytes of "data" into "stream", "start" bytes in.
+ ***************************************************************************/
+static void
+mix_piece(Uint8 *stream, int start, Uint8 *data, int n, Sint32 *gain,
+	int wide)
+{
+    if (wide)
+	mix_voice(mixbuf + start / 2, (Sint16 *) data, 0, n / 2, gain);
+    else
+	SDL_MixAudio(stream + start, data, n,
+		gain[0] > gain[1] ? gain[0] : gain[1]);
+}
+
+/***************************************************************************
+ *      mix_stream()
+ * Mixes up to "n" bytes of a streamed voice into "stream", "start" bytes
+ * in, from whatever the loader has read so far. Returns 1 once the whole
+ * stream has been played.
+ *
+ * If the loader falls behind we play silence, and then skip as much of
+ * what it reads next, so that the rest of the sound is not late.
+ ***************************************************************************/
+static int
+mix_stream(playing_sample *p, Uint8 *stream, int start, int n, int wide)
+{
+    sound_stream *st = p->stream;
+    Uint32 head, tail = st->tail, at, skip;
+    int done, piece, used = 0;
+
+    if (RING_GET(&st->have) != st->want)
+	return 0;	/* still rewinding */
+    done = RING_GET(&st->done);
+    head = RING_GET(&st->head);
+    skip = head - tail;
+    if (skip > st->owed)
+	skip = st->owed;
+    tail += skip;
+    st->owed -= skip;
+    while (used < n && tail != head) {
+	at = tail % st->size;
+	piece = head - tail;
+	if (piece > n - used) piece = n - used;
+	if (piece > (int) (st->size - at)) piece = st->size - at;
+	mix_piece(stream, start + used, st->buf + at, piece, p->gain, wide);
+	used += piece;
+	tail += piece;
+    }
+    if (tail != st->tail) {
+	RING_PUT(&st->tail, tail);
+	SDL_SemPost(loader_wake);	/* there is room for more */
+    }
+    if (!done && used < n)
+	st->owed += n - used;	/* ran dry: that bit is skipped */
+    return done && tail == head;
+}
+
+/***************************************************************************
+ *      mix_chunk()
+ * Mixes "len" bytes' worth of every voice into "stream".
+ ***************************************************************************/
+static void
+mix_chunk(Uint8 *stream, int len)
+{
+    playing_sample *p;
+    int i, start, n, wide = (device.format == AUDIO_S16SYS && mixbuf);
+
+    if (wide)
+	memset(mixbuf, 0, len / 2 * sizeof(*mixbuf));
+
+    for (i=0; i<MAX_MIXED_SAMPLES; i++) { /* for each possible sample */
+	p = &current.sample[i];
+	if (!p->in_use)
+	    continue;
+	if (p->delay >= len) { /* keep pausing! */
+	    p->delay -= len;
+	    continue;
+	}
+	/* it starts somewhere in this chunk */
+	start = p->delay;
+	p->delay = 0;
+	if (p->stream) {
+	    if (mix_stream(p, stream, start, len - start, wide))
+		end_sample(i);
+	    continue;
+	}
+	n = len - start;
+	if (n > (int) (p->len - p->pos))
+	    n = p->len - p->pos;
+	mix_piece(stream, start, p->audio_data, n, p->gain, wide);
+	p->audio_data += n;
+	p->pos += n;
+	if (p->pos >= p->len)
+	    end_sample(i);
+    }
+
+    if (wide)
+	clip_mix((Sint16 *) stream, mixbuf, 0, len / 2);
+}
+
 /***************************************************************************
  *      fill_audio()
  ***************************************************************************/
 static void 
 fill_audio(void *udata, Uint8 *stream, int len)
 {
-    int i;
+    int n;
 
-    for (i=0; i<MAX_MIXED_SAMPLES; i++) /* for each possible sample to be mixed */
-	if (current.sample[i].in_use) {
-	    if (current.sample[i].delay >= len) /* keep pausing! */
-		current.sample[i].delay -= len;
-	    else if (current.sample[i].delay > 0 && 
-		     current.sample[i].delay < len) {
-		/* pause a bit! */
-		int diff = len - current.sample[i].delay;
-		if (diff + current.sample[i].pos >= current.sample[i].len) {
-		    diff = current.sample[i].len - current.sample[i].pos;
-		    current.sample[i].in_use = 0;
-		}
-		current.sample[i].delay = 0;
-		SDL_MixAudio(stream+current.sample[i].delay, 
-			current.sample[i].audio_data, diff, SDL_MIX_MAXVOLUME);
-		current.sample[i].audio_data += diff;
-		current.sample[i].pos += diff;
-	    } else {
-		/* we can play it now */
-		int to_play = len;
-		Assert(current.sample[i].delay == 0);
-		if (to_play + current.sample[i].pos >= current.sample[i].len) {
-		    to_play = current.sample[i].len - current.sample[i].pos;
-		    current.sample[i].in_use = 0;
-		}
-		SDL_MixAudio(stream, current.sample[i].audio_data, 
-			to_play, SDL_MIX_MAXVOLUME);
-		current.sample[i].audio_data += to_play;
-		current.sample[i].pos += to_play;
-	    }
-	} /* end: if in_use */
+    run_commands();
+
+    /* SDL asks for device.size bytes at a time, which is what mixbuf
+     * holds, but it doesn't hurt to be careful */
+    while (len > 0) {
+	n = (mixlen && len > mixlen) ? mixlen : len;
+	mix_chunk(stream, n);
+	stream += n;
+	len -= n;
+    }
     return;
 }
 
 /***************************************************************************
  *      play_sound_unless_already_playing()
- * Schedules a sound to be played (unless it is already playing). "delay"
- * is in bytes (sigh!) at 11025 Hz, unsigned 8-bit samples, mono.
+ * Schedules a sound to be played (unless it is already playing) in "delay"
+ * milliseconds.
  *********************************************************************PROTO*/
 void
 play_sound_unless_already_playing(sound_style *ss, int which, int delay)
 {
-    int i;
-
     if (ss->WAV[which].audio_len == 0) {
 	if (strcmp(ss->name,"No Sound"))
 		Debug("No [%s] sound in Sound Style [%s]\n", 
 		    sound_name[which], ss->name);
 	return;
     }
-    /* are we already playing? */
-    for (i=0; i< MAX_MIXED_SAMPLES; i++) 
-	if (current.sample[i].in_use != 0 &&
-		!strcmp(current.sample[i].filename, ss->WAV[which].filename)) 
-	    /* alreadying playing */
-	    return; 
-
-    /* find an empty slot */
-    for (i=0; i< MAX_MIXED_SAMPLES; i++) {
-	if (current.sample[i].in_use == 0) {
-	    /* found it! */
-	    SDL_LockAudio();
-	    current.sample[i].in_use = 1;
-	    current.sample[i].delay = delay;
-	    current.sample[i].len = ss->WAV[which].audio_len;
-	    current.sample[i].pos = 0;
-	    current.sample[i].audio_data = ss->WAV[which].audio_buf;
-	    current.sample[i].filename = ss->WAV[which].filename;
-	    SDL_UnlockAudio();
-	    /*
-	    Debug("Scheduled sound %d with delay %d\n",which,delay);
-	    */
-	    return;
-	}
-    }
-    Debug("No room in the mixer for sound %d\n",which);
+    post_command(SOUND_PLAY_ONCE, ss, which, delay, SDL_MIX_MAXVOLUME, 0);
     return;
 }
 
@@ -130,67 +512,52 @@ play_sound_unless_already_playing(sound_style *ss, int which, int delay)
 void
 stop_playing_sound(sound_style *ss, int which)
 {
-    int i;
-    /* are we already playing? */
-    for (i=0; i< MAX_MIXED_SAMPLES; i++) 
-	if (current.sample[i].in_use != 0 &&
-		!strcmp(current.sample[i].filename, ss->WAV[which].filename)) {
-	    /* alreadying playing that sound */
-	    current.sample[i].in_use = 0; /* turn it off */
-	}
+    if (ss->WAV[which].audio_len == 0)
+	return;	/* then it isn't playing */
+    post_command(SOUND_STOP, ss, which, 0, 0, 0);
     return;
 
 }
 
 /***************************************************************************
- *      play_sound()
- * Schedules a sound to be played. "delay" is in bytes (sigh!) at 11025 Hz,
- * unsigned 8-bit samples, mono.
+ *      play_sound_panned()
+ * Schedules a sound to be played in "delay" milliseconds at "volume" (0 to
+ * SDL_MIX_MAXVOLUME, which is as recorded) and "pan" (-128 is all the way
+ * left, 0 the middle, 128 all the way right).
  *********************************************************************PROTO*/
 void
-play_sound(sound_style *ss, int which, int delay)
+play_sound_panned(sound_style *ss, int which, int delay, int volume, int pan)
 {
-    int i;
-
     if (ss->WAV[which].audio_len == 0) {
 	if (strcmp(ss->name,"No Sound"))
 		Debug("No [%s] sound in Sound Style [%s]\n", 
 		    sound_name[which], ss->name);
 	return;
     }
-
-    /* find an empty slot */
-    for (i=0; i< MAX_MIXED_SAMPLES; i++) {
-	if (current.sample[i].in_use == 0) {
-	    /* found it! */
-	    SDL_LockAudio();
-	    current.sample[i].in_use = 1;
-	    current.sample[i].delay = delay;
-	    current.sample[i].len = ss->WAV[which].audio_len;
-	    current.sample[i].pos = 0;
-	    current.sample[i].audio_data = ss->WAV[which].audio_buf;
-	    current.sample[i].filename = ss->WAV[which].filename;
-	    SDL_UnlockAudio();
-	    /*
-	    Debug("Scheduled sound %d with delay %d\n",which,delay);
-	    */
-	    return;
-	}
-    }
-    Debug("No room in the mixer for sound %d\n",which);
+    post_command(SOUND_PLAY, ss, which, delay, volume, pan);
     return;
 }
 
+/***************************************************************************
+ *      play_sound()
+ * Schedules a sound to be played in "delay" milliseconds.
+ *********************************************************************PROTO*/
+void
+play_sound(sound_style *ss, int which, int delay)
+{
+    play_sound_panned(ss, which, delay, SDL_MIX_MAXVOLUME, 0);
+}
+
 /***************************************************************************
  *      stop_all_playing()
- * Schedule all of the sounds associated with a given style to be played.
+ * Stops every sound that is playing.
  *********************************************************************PROTO*/
 void
 stop_all_playing(void)
 {
-    int i;
-    for (i=0; i<MAX_MIXED_SAMPLES; i++) /* for each possible sample to be mixed */
-	current.sample[i].in_use = 0;
+    if (SDL_GetAudioStatus() == SDL_AUDIO_STOPPED)
+	return;	/* nobody would hear it */
+    post_command(SOUND_STOP_ALL, NULL, 0, 0, 0, 0);
     return;
 }
 
@@ -207,23 +574,270 @@ play_all_sounds(sound_style *ss)
     for (i=0; i<NUM_SOUND; i++) {
 	if (i == SOUND_CLOCK) continue;
 	play_sound(ss, i, delay);
-	delay += ss->WAV[i].audio_len + 6144;
+	delay += bytes_to_ms(ss->WAV[i].audio_len) + 557;
     }
 }
 
 /***************************************************************************
- *      load_sound_style()
- * Parse a sound config file.
+ *      convert_sample()
+ * Converts a freshly loaded WAV to the device's format and rate, once, so
+ * that the mixer never has to.
+ ***************************************************************************/
+static void
+convert_sample(WAV_sample *w)
+{
+    SDL_AudioCVT cvt;
+    Uint32 frame = (device.format & 0xff) / 8 * device.channels;
+
+    if (SDL_BuildAudioCVT(&cvt, w->spec.format, w->spec.channels,
+		w->spec.freq, device.format, device.channels, device.freq) < 0)
+	PANIC("Cannot convert [%s] for the sound card: %s",
+		w->filename, SDL_GetError());
+    if (cvt.needed) {
+	cvt.len = w->audio_len;
+	Malloc(cvt.buf, Uint8 *, cvt.len * cvt.len_mult);
+	memcpy(cvt.buf, w->audio_buf, w->audio_len);
+	if (SDL_ConvertAudio(&cvt) < 0)
+	    PANIC("Cannot convert [%s] for the sound card: %s",
+		    w->filename, SDL_GetError());
+	w->audio_len = cvt.len_cvt;
+    } else {
+	/* keep it in memory of our own, so that unloading is just free() */
+	Malloc(cvt.buf, Uint8 *, w->audio_len);
+	memcpy(cvt.buf, w->audio_buf, w->audio_len);
+    }
+    SDL_FreeWAV(w->audio_buf);
+    w->audio_buf = cvt.buf;
+    w->spec.format = device.format;
+    w->spec.channels = device.channels;
+    w->spec.freq = device.freq;
+    /* whole sample frames only */
+    w->audio_len -= w->audio_len % frame;
+}
+
+/* little-endian numbers in a WAV header */
+#define LE16(p)	((p)[0] | ((p)[1] << 8))
+#define LE32(p)	((Uint32) LE16(p) | ((Uint32) LE16((p)+2) << 16))
+
+/***************************************************************************
+ *      new_stream()
+ * Sets "w" up to be played, a little at a time, from the "len" bytes of
+ * PCM (in the format of w->spec) at "start" in the file "filename".
+ * Returns 1 if it can be.
+ ***************************************************************************/
+static int
+new_stream(WAV_sample *w, const char *filename, Uint32 start, Uint32 len)
+{
+    Uint32 frames;
+    sound_stream *st;
+
+    if (!loader_wake)
+	return 0;	/* nobody to read it */
+    Calloc(st, sound_stream *, sizeof(sound_stream));
+    if (SDL_BuildAudioCVT(&st->cvt, w->spec.format, w->spec.channels,
+		w->spec.freq, device.format, device.channels, device.freq) < 0) {
+	free(st);
+	return 0;
+    }
+    st->filename = filename;
+    st->data_start = start;
+    st->data_len = len;
+    st->src_frame = (w->spec.format & 0xff) / 8 * w->spec.channels;
+    st->dst_frame = (device.format & 0xff) / 8 * device.channels;
+    /* a chunk, converted, is at most a quarter of the buffer */
+    st->chunk = STREAM_RING / 4 / (st->cvt.needed ? st->cvt.len_mult : 1);
+    st->chunk -= st->chunk % st->src_frame;
+    st->size = STREAM_RING - STREAM_RING % st->dst_frame;
+
+    /* the loader may be walking the list: it sees "st" whole, or not */
+    st->next = streams;
+    LIST_PUT(&streams, st);
+    w->stream = st;
+    /* as long as it will be once it is converted */
+    frames = len / st->src_frame;
+    w->audio_len = (Uint32) ((double) frames * device.freq / w->spec.freq)
+	* st->dst_frame;
+    Debug("Streaming [%s] (%u bytes).\n", w->filename, (unsigned) len);
+    return 1;
+}
+
+/***************************************************************************
+ *      open_stream()
+ * Looks at the header of a WAV. If it is PCM with more than STREAM_BYTES
+ * of data, sets it up to be played from the disk and returns 1. Returns 0
+ * if it should be loaded as usual.
+ ***************************************************************************/
+static int
+open_stream(WAV_sample *w)
+{
+    FILE *fp;
+    Uint8 h[12], c[8], fmt[16];
+    Uint32 n;
+    int got_fmt = 0, bits;
+
+    if (!loader_wake)
+	return 0;	/* nobody to read it */
+    fp = fopen(w->filename, "rb");
+    if (!fp)
+	return 0;
+    memset(c, 0, sizeof(c));
+    if (fread(h, 1, 12, fp) != 12 || memcmp(h, "RIFF", 4) ||
+	    memcmp(h+8, "WAVE", 4)) {
+	fclose(fp);
+	return 0;
+    }
+    /* find the format and then the data */
+    while (fread(c, 1, 8, fp) == 8) {
+	n = LE32(c+4);
+	if (!memcmp(c, "data", 4))
+	    break;
+	if (!memcmp(c, "fmt ", 4) && n >= 16) {
+	    if (fread(fmt, 1, 16, fp) != 16)
+		break;
+	    got_fmt = 1;
+	    n -= 16;
+	}
+	fseek(fp, n + (n & 1), SEEK_CUR);
+    }
+    bits = got_fmt ? LE16(fmt+14) : 0;
+    if (!got_fmt || memcmp(c, "data", 4) || n <= STREAM_BYTES ||
+	    LE16(fmt) != 1 || (bits != 8 && bits != 16)) {
+	fclose(fp);
+	return 0;	/* small, or something SDL_LoadWAV() can handle */
+    }
+
+    w->spec.format = (bits == 8) ? AUDIO_U8 : AUDIO_S16LSB;
+    w->spec.channels = LE16(fmt+2);
+    w->spec.freq = LE32(fmt+4);
+    n = new_stream(w, w->filename, ftell(fp), n);
+    fclose(fp);	/* the loader opens it again when it is wanted */
+    return n;
+}
+
+/***************************************************************************
+ *      pack_sample()
+ * Takes a sound from the asset pack if it is there. If the pack's format
+ * is the card's (it usually is) we play it straight from the pack; if it
+ * is longer than STREAM_BYTES we stream it from the pack file instead.
+ * Returns 1 if it was there.
+ ***************************************************************************/
+static int
+pack_sample(WAV_sample *w)
+{
+    Uint8 *buf;
+    const char *file;
+    Uint32 at, len;
+    Uint32 frame = (device.format & 0xff) / 8 * device.channels;
+
+    if (!pack_LoadWAV(w->filename, &w->spec, &buf, &w->audio_len))
+	return 0;
+    /* a long one is read from the pack as it plays, like any other */
+    if (w->audio_len > STREAM_BYTES &&
+	    (file = pack_locate(w->filename, PACK_SOUND, &at, &len)) &&
+	    new_stream(w, file, at, len))
+	return 1;
+    if (w->spec.format == device.format && w->spec.freq == device.freq &&
+	    w->spec.channels == device.channels) {
+	w->audio_buf = buf;
+	w->audio_len -= w->audio_len % frame;
+	w->in_pack = 1;
+	return 1;
+    }
+    /* convert_sample() wants one of its own */
+    Malloc(w->audio_buf, Uint8 *, w->audio_len);
+    memcpy(w->audio_buf, buf, w->audio_len);
+    convert_sample(w);
+    return 1;
+}
+
+/***************************************************************************
+ *      fill_stream()
+ * Rewinds a stream if the mixer wants it from the top, and reads as much
+ * as will fit. Called by the loader thread.
+ ***************************************************************************/
+static void
+fill_stream(sound_stream *st)
+{
+    Uint32 want = RING_GET(&st->want), head = st->head, n, at, k;
+
+    if (want == 0)
+	return;		/* never played */
+    if (want != st->have) {
+	if (!st->scratch)
+	    Malloc(st->scratch, Uint8 *,
+		    st->chunk * (st->cvt.needed ? st->cvt.len_mult : 1));
+	if (!st->fp)
+	    st->fp = fopen(st->filename, "rb");
+	if (!st->fp || fseek(st->fp, st->data_start, SEEK_SET))
+	    RING_PUT(&st->done, 1);	/* nothing to play, then */
+	else
+	    RING_PUT(&st->done, 0);
+	st->read = 0;
+	/* the mixer is waiting for us, so the tail stays put */
+	head = RING_GET(&st->tail);
+	RING_PUT(&st->head, head);
+	RING_PUT(&st->have, want);
+    }
+    while (!st->done && st->size - (head - RING_GET(&st->tail)) >=
+	    st->chunk * (st->cvt.needed ? st->cvt.len_mult : 1)) {
+	if (RING_GET(&st->want) != st->have)
+	    return;	/* they want it from the top again */
+	n = st->data_len - st->read;
+	if (n > st->chunk) n = st->chunk;
+	n = fread(st->scratch, 1, n, st->fp);
+	st->read += n;
+	n -= n % st->src_frame;
+	st->cvt.buf = st->scratch;
+	st->cvt.len = n;
+	st->cvt.len_cvt = n;
+	if (n && st->cvt.needed && SDL_ConvertAudio(&st->cvt) < 0)
+	    st->cvt.len_cvt = 0;
+	k = st->cvt.len_cvt - st->cvt.len_cvt % st->dst_frame;
+	/* copy it in, around the end of the buffer if need be */
+	at = head % st->size;
+	if (k > st->size - at) {
+	    memcpy(st->buf + at, st->scratch, st->size - at);
+	    memcpy(st->buf, st->scratch + (st->size - at),
+		    k - (st->size - at));
+	} else
+	    memcpy(st->buf + at, st->scratch, k);
+	head += k;
+	RING_PUT(&st->head, head);
+	if (!n || st->read >= st->data_len)
+	    RING_PUT(&st->done, 1);
+    }
+}
+
+/***************************************************************************
+ *      loader_thread()
+ * Keeps every playing stream topped up.
+ ***************************************************************************/
+static int
+loader_thread(void *data)
+{
+    sound_stream *st;
+
+    (void) data;
+    for (;;) {
+	SDL_SemWait(loader_wake);
+	for (st = LIST_GET(&streams); st; st = st->next)
+	    fill_stream(st);
+    }
+    return 0;
+}
+
+/***************************************************************************
+ *      index_sound_style()
+ * Reads the name of a sound style; its sounds get IDs "first_id" onwards
+ * but are not loaded until use_sound_style().
  ***************************************************************************/
 static sound_style *
-load_sound_style(const char *filename)
+index_sound_style(const char *filename, int first_id)
 {
     sound_style *retval;
     char buf[2048];
-
-    FILE *fin = fopen(filename,"rt");
-    int ok;
-    int count = 0;
+    FILE *fin = pack_fopen(filename);
+    int i;
 
     if (!fin) {
 	Debug("fopen(%s)\n",filename);
@@ -233,9 +847,35 @@ load_sound_style(const char *filename)
 
     /* find the name */
     fgets(buf,sizeof(buf),fin);
+    fclose(fin);
     if (strchr(buf,'\n'))
 	*(strchr(buf,'\n')) = 0;
-    retval->name = strdup(buf);
+    Strdup(retval->name, buf);
+    Strdup(retval->filename, filename);
+    for (i=0; i<NUM_SOUND; i++)
+	retval->WAV[i].id = first_id + i;
+    return retval;
+}
+
+/***************************************************************************
+ *      load_sound_style()
+ * Parse the rest of a sound config file and load its sounds. Streamed
+ * sounds stay open from one load to the next.
+ ***************************************************************************/
+static void
+load_sound_style(sound_style *ss)
+{
+    char buf[2048];
+
+    FILE *fin = pack_fopen(ss->filename);
+    int ok;
+    int count = 0;
+
+    if (!fin) 
+	PANIC("cannot reopen [%s] for sound style [%s]",ss->filename,ss->name);
+
+    /* skip the name */
+    fgets(buf,sizeof(buf),fin);
 
     while (!(feof(fin))) {
 	int i;
@@ -251,37 +891,105 @@ load_sound_style(const char *filename)
 		 
 	for (i=0; i<NUM_SOUND; i++)
 	    if (!strncasecmp(buf,sound_name[i],strlen(sound_name[i]))) {
+		WAV_sample *w = &ss->WAV[i];
 		char *p = strchr(buf,' ');
 		if (!p) {
 		    Debug("malformed input line [%s] in [%s]\n",
-			    buf,filename);
-		    return NULL;
+			    buf,ss->filename);
+		    ok = 1;
+		    break;
 		}
 		p++;
-		if (!(SDL_LoadWAV(p,&(retval->WAV[i].spec), 
-				&(retval->WAV[i].audio_buf),
-				&(retval->WAV[i].audio_len)))) {
-		    PANIC("Couldn't open %s [%s] in [%s]: %s",
-			    sound_name[i], p, filename, SDL_GetError());
-		}
-		retval->WAV[i].filename = strdup(filename);
 		count++;
 		ok = 1;
+		if (w->stream)
+		    continue;	/* still there from last time */
+		Strdup(w->filename, p);
+		if (pack_sample(w))
+		    continue;
+		if (open_stream(w))
+		    continue;
+		if (!(SDL_LoadWAV(p,&(w->spec), 
+				&(w->audio_buf),
+				&(w->audio_len)))) {
+		    PANIC("Couldn't open %s [%s] in [%s]: %s",
+			    sound_name[i], p, ss->filename, SDL_GetError());
+		}
+		convert_sample(w);
 	    }
 	if (!ok) {
 	    Debug("unknown sound name [%s] in [%s]\nvalid names:",
-		    buf, filename);
+		    buf, ss->filename);
 	    for (i=0;i<NUM_SOUND;i++)
 		printf(" %s",sound_name[i]);
 	    printf("\n");
-	    return NULL;
+	    break;
 	}
     }
+    fclose(fin);
+    ss->loaded = 1;
 
-    Debug("Sound Style [%s] loaded (%d/%d sounds).\n",retval->name,
+    Debug("Sound Style [%s] loaded (%d/%d sounds).\n",ss->name,
 	    count, NUM_SOUND);
+}
 
-    return retval;
+/***************************************************************************
+ *      unload_sound_style()
+ * Frees the samples of a sound style, first making sure that the mixer
+ * is not playing (or about to play) any of them.
+ ***************************************************************************/
+static void
+unload_sound_style(sound_style *ss)
+{
+    int i, first = ss->WAV[0].id;
+
+    SDL_LockAudio();
+    run_commands();	/* the audio thread is waiting, so this is safe */
+    for (i=0; i<MAX_MIXED_SAMPLES; i++)
+	if (current.sample[i].in_use &&
+		current.sample[i].id >= first &&
+		current.sample[i].id < first + NUM_SOUND) {
+	    current.sample[i].in_use = 0;
+	    CLR_PLAYING(current.sample[i].id);
+	}
+    SDL_UnlockAudio();
+
+    for (i=0; i<NUM_SOUND; i++) {
+	WAV_sample *w = &ss->WAV[i];
+	if (w->stream)
+	    continue;	/* cheap to keep, and the loader knows about it */
+	if (!w->in_pack)
+	    free(w->audio_buf);
+	w->audio_buf = NULL;
+	w->in_pack = 0;
+	Free(w->filename);
+	w->audio_len = 0;
+    }
+    ss->loaded = 0;
+}
+
+/***************************************************************************
+ *      use_sound_style()
+ * Makes sure that the samples of a sound style are loaded. Only the
+ * SOUND_CACHE most recently used styles keep theirs, so call this before
+ * playing a style.
+ *********************************************************************PROTO*/
+void
+use_sound_style(sound_style *ss)
+{
+    static sound_style *cache[SOUND_CACHE];	/* most recent first */
+    int i;
+
+    if (!ss->filename)
+	return;	/* "No Sound" */
+    for (i=0; i<SOUND_CACHE-1 && cache[i] != ss; i++)
+	;
+    if (cache[i] != ss && cache[i] && cache[i]->loaded)
+	unload_sound_style(cache[i]);	/* the least recently used */
+    if (!ss->loaded)
+	load_sound_style(ss);
+    memmove(cache+1, cache, i*sizeof(cache[0]));
+    cache[0] = ss;
 }
 
 /***************************************************************************
@@ -310,8 +1018,7 @@ load_sound_styles(int sound_wanted)
 {
     sound_styles retval;
     SDL_AudioSpec wanted;
-    DIR *my_dir;
-    int i = 0;
+    pack_dir *my_dir;
 
     memset(&retval,0,sizeof(retval));
 
@@ -324,61 +1031,65 @@ load_sound_styles(int sound_wanted)
     }
 
     memset(&current,0,sizeof(current));	/* clear memory */
+    memset(&ring,0,sizeof(ring));
 
-    wanted.freq = 11025;
-    wanted.format = AUDIO_U8;
-    wanted.channels = 1;
+    wanted.freq = SOUND_FREQ;
+    wanted.format = SOUND_FORMAT;
+    wanted.channels = SOUND_CHANNELS;
     wanted.samples = 512; /* good low-latency value for callback */
     wanted.callback = fill_audio;
     wanted.userdata = NULL;
-    /* Open the audio device, forcing the desired format */
-    if (SDL_OpenAudio(&wanted, NULL) < 0) {
+    /* Open the audio device in whatever format it likes best: our sounds
+     * are converted to that as they are loaded */
+    if (SDL_OpenAudio(&wanted, &device) < 0) {
 	Debug("Couldn't open audio: %s\n",SDL_GetError());
 	goto nosound;
     }
+    Debug("Audio: %d Hz, %d channels, format 0x%x.\n", device.freq,
+	    device.channels, device.format);
+    /* room to mix one callback's worth */
+    mixlen = device.size;
+    Calloc(mixbuf,Sint32 *,mixlen / 2 * sizeof(*mixbuf));
+    pick_mixer();
+    /* and someone to read the long sounds from the disk */
+    loader_wake = SDL_CreateSemaphore(0);
+    if (!loader_wake || !SDL_CreateThread(loader_thread, NULL)) {
+	Debug("No sound loader thread (%s): long sounds will be loaded.\n",
+		SDL_GetError());
+	loader_wake = NULL;
+    }
 
-    my_dir = opendir("sounds");
-    if (my_dir) {
-	while (1) { 
-	    struct dirent *this_file = readdir(my_dir);
-	    if (!this_file) break;
-	    if (sound_Select(this_file))
-		i++;
-	} 
-	closedir(my_dir);
-    } else {
+    my_dir = pack_opendir("sounds");
+    if (!my_dir) {
 	Debug("Cannot read directory [sounds/]: atris-sounds not found!\n");
 	goto nosound;
     }
-    my_dir = opendir("sounds");
-    if (my_dir) {
-	if (i >= 0) { 
-	    int j;
-	    Calloc(retval.style,sound_style **,sizeof(*(retval.style))*i+1);
-	    retval.num_style = i+1;
-	    j = 0;
-	    while (j<i) {
-		char filespec[1024];
-		struct dirent *this_file = readdir(my_dir);
-		if (!sound_Select(this_file)) continue;
-		SPRINTF(filespec,"sounds/%s",this_file->d_name);
-		retval.style[j] = load_sound_style(filespec);
-		if (strstr(retval.style[j]->name,"Default"))
-		    retval.choice = j;
-		j++;
-	    }
-	    closedir(my_dir);
-	    Calloc(retval.style[i],sound_style *,sizeof(sound_style));
-	    retval.style[i]->name = "No Sound";
-	    SDL_PauseAudio(0);	/* start playing sound! */
-	    return retval;
-	} else {
-	    PANIC("No sound styles [sounds/*.Sound] found.\n");
-	}
-    } else { 
-	PANIC("Cannot read directory [sounds/]");
+    while (1) { 
+	char filespec[1024];
+	struct dirent *this_file = pack_readdir(my_dir);
+	if (!this_file) break;
+	if (!sound_Select(this_file)) continue;
+	SPRINTF(filespec,"sounds/%s",this_file->d_name);
+	Realloc(retval.style,sound_style **,
+		sizeof(*(retval.style))*(retval.num_style+1));
+	retval.style[retval.num_style] = 
+	    index_sound_style(filespec, retval.num_style * NUM_SOUND);
+	if (!retval.style[retval.num_style]) continue;
+	if (strstr(retval.style[retval.num_style]->name,"Default"))
+	    retval.choice = retval.num_style;
+	retval.num_style++;
     }
-    Debug("No sound styles [sounds/*.Sound] found.\n");
+    pack_closedir(my_dir);
+    /* one "playing" bit for each sound of each style */
+    Calloc(playing,Uint32 *,
+	    sizeof(Uint32)*((retval.num_style*NUM_SOUND+31)/32+1));
+    Realloc(retval.style,sound_style **,
+	    sizeof(*(retval.style))*(retval.num_style+1));
+    Calloc(retval.style[retval.num_style],sound_style *,sizeof(sound_style));
+    retval.style[retval.num_style]->name = "No Sound";
+    retval.num_style++;
+    SDL_PauseAudio(0);	/* start playing sound! */
+    return retval;
 
     /* for whatever reason, you don't get sound */
 nosound: 
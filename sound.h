@@ -13,6 +13,44 @@
 
 #define MAX_MIXED_SAMPLES	32
 
+/* what we ask the sound card for (and what atrispack converts to) */
+#define SOUND_FREQ	22050
+#define SOUND_FORMAT	AUDIO_S16SYS
+#define SOUND_CHANNELS	2
+
+/* WAVs with more audio data than this are played straight from the disk,
+ * a little at a time, rather than loaded */
+#define STREAM_BYTES	(256*1024)
+#define STREAM_RING	(128*1024)	/* bytes of converted audio read ahead */
+
+/* A streamed WAV. The loader thread reads and converts it into "buf";
+ * the mixer plays it from there. The game never touches it after it asks
+ * for the first play (which allocates "buf"). To (re)start, the mixer
+ * bumps "want" and waits for the loader to rewind and set "have" to
+ * match; "head" belongs to the loader, "tail" to the mixer */
+typedef struct sound_stream_struct {
+    const char *filename;
+    Uint32	data_start;	/* where the samples are in the file */
+    Uint32	data_len;
+    int		src_frame;	/* bytes per sample frame in the file */
+    int		dst_frame;	/* ... and for the device */
+    SDL_AudioCVT cvt;		/* file format to device format */
+    Uint32	chunk;		/* file bytes converted at once */
+    Uint8 *	scratch;	/* ... room to do that */
+    FILE *	fp;
+    Uint32	read;		/* file bytes read since the rewind */
+
+    Uint8 *	buf;
+    Uint32	size;		/* bytes in "buf", whole frames */
+    Uint32	head;		/* bytes written, ever */
+    Uint32	tail;		/* bytes played, ever */
+    Uint32	want;		/* plays asked for by the mixer */
+    Uint32	have;		/* ... and rewinds done by the loader */
+    Uint32	done;		/* the whole file is in "buf" */
+    Uint32	owed;		/* bytes the mixer ran dry for, to skip */
+    struct sound_stream_struct *next;
+} sound_stream;
+
 /* a sample to be played */
 typedef struct playing_sample_struct {
     int		in_use;		/* only play this if it is in use */
@@ -20,7 +58,9 @@ typedef struct playing_sample_struct {
     Uint32	len;
     Uint32	pos;
     Uint8 *	audio_data;
-    char *	filename;
+    int		id;		/* which sound this is (see WAV_sample) */
+    Sint32	gain[2];	/* left, right: SDL_MIX_MAXVOLUME is as is */
+    sound_stream *stream;	/* if it plays from the disk */
 } playing_sample;
 
 /* all samples to be played */
@@ -28,11 +68,42 @@ typedef struct samples_to_be_played_struct {
     playing_sample sample[MAX_MIXED_SAMPLES];	
 } samples_to_be_played;
 
+/* what the game asks the mixer to do: posted by play_sound() and friends,
+ * carried out by fill_audio() at the start of its next call */
+#define SOUND_PLAY		0	/* start a sample */
+#define SOUND_PLAY_ONCE		1	/* ... unless it is already playing */
+#define SOUND_STOP		2	/* stop every copy of a sample */
+#define SOUND_STOP_ALL		3	/* stop everything */
+
+typedef struct sound_command_struct {
+    int		op;
+    int		delay;		/* as in playing_sample */
+    Uint32	len;
+    Uint8 *	audio_data;
+    int		id;
+    Sint32	gain[2];
+    sound_stream *stream;
+} sound_command;
+
+/* single producer (the game), single consumer (the audio callback): only
+ * the game moves "head" and only the callback moves "tail", so neither
+ * ever waits for the other */
+#define SOUND_RING	64	/* a power of two */
+
+typedef struct sound_ring_struct {
+    sound_command	cmd[SOUND_RING];
+    Uint32		head;	/* next command the game will post */
+    Uint32		tail;	/* next command the mixer will carry out */
+} sound_ring;
+
 typedef struct WAV_sample_struct {
     SDL_AudioSpec	spec;
     Uint8 *		audio_buf;
     Uint32 		audio_len;
     char *		filename;
+    int			id;	/* unique among all loaded sounds */
+    sound_stream *	stream;	/* not loaded: audio_len is a guess */
+    int			in_pack; /* audio_buf belongs to the asset pack */
 } WAV_sample;
 
 #define SOUND_THUD	0	/* the piece you were moving settled */
@@ -47,8 +118,13 @@ typedef struct WAV_sample_struct {
 typedef struct sound_style_struct {
     WAV_sample WAV[NUM_SOUND];
     char *name;	/* name of this sound style */
+    char *filename;	/* where its sounds are listed, NULL for none */
+    int loaded;	/* are the samples in memory? see use_sound_style() */
 } sound_style;
 
+/* how many sound styles keep their samples loaded at once */
+#define SOUND_CACHE	3
+
 typedef struct sound_styles_struct {
     int num_style;
     int choice;
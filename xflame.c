@@ -33,6 +33,7 @@
 #include "config.h"
 #include "atris.h"
 #include "options.h"
+#include "profile.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -47,6 +48,7 @@
 #define VARIANCE 5
 #define VARTREND 2
 #define RESIDUAL 68
+#define SLOWEST 8	/* never drop below this many frames a second */
 
 #define NONE 0x00
 #define CMAP 0x02
@@ -112,25 +114,29 @@ SetFlamePalette(struct globaldata *gb, int f,int *ctab)
   SDL_Color cmap[MAX];
   
   /* This step is only needed on palettized screens */
-  r = g = b = 0;
-  for (i=0; (r != 255) || (g != 255) || (b != 255); i++)
+  if (gb->screen->format->palette)
     {
-      r=i*3;
-      g=(i-80)*3;
-      b=(i-160)*3;
-      if (r<0) r=0;
-      if (r>255) r=255;
-      if (g<0) g=0;
-      if (g>255) g=255;
-      if (b<0) b=0;
-      if (b>255) b=255;
-      cmap[i].r = r;
-      cmap[i].g = g;
-      cmap[i].b = b;
+      r = g = b = 0;
+      for (i=0; (r != 255) || (g != 255) || (b != 255); i++)
+        {
+          r=i*3;
+          g=(i-80)*3;
+          b=(i-160)*3;
+          if (r<0) r=0;
+          if (r>255) r=255;
+          if (g<0) g=0;
+          if (g>255) g=255;
+          if (b<0) b=0;
+          if (b>255) b=255;
+          cmap[i].r = r;
+          cmap[i].g = g;
+          cmap[i].b = b;
+        }
+      SDL_SetColors(gb->screen, cmap, 0, i);
     }
-  SDL_SetColors(gb->screen, cmap, 0, i);
 
-  /* This step is for all depths */
+  /* This step is for all depths: ctab holds ready-made pixels in the */
+  /* surface's own format, so drawing the flame is a plain table lookup */
   for (i=0;i<MAX;i++)
     {
       r=i*3;
@@ -180,83 +186,342 @@ XFModifyFlameBase(int *f, int w, int ws, int h)
     }
 }
 
+/* how much of a cell's heat "v" reaches a neighbour that gets share "s" */
+#define HEAT(v,s) (((v)*(s))>>8)
+
+static void
+XFGatherRow(int *pre, int *f, int *v1, int *v2, int x, int w)
+{
+  /*This function works out, for cells x..w-1 of one row, the heat that */
+  /*rises into each of them from the two rows below (v1 and v2, which */
+  /*are already done) on top of what was left there last time (f) */
+  for (;x<w;x++)
+    pre[x]=f[x]+HEAT(v1[x],VSPREAD)+(HEAT(v2[x],VSPREAD)>>1)
+      +HEAT(v1[x-1],HSPREAD)+HEAT(v1[x+1],HSPREAD);
+}
+
 static void
-XFProcessFlame(int *f, int w, int ws, int h, int *ff)
+XFChainRow(int *v, int *pre, int x, int w)
+{
+  /*This function adds to each cell half a share of its left neighbour's */
+  /*final heat, left to right, and clamps it */
+  int n;
+  
+  for (;x<w;x++)
+    {
+      n=pre[x]+(HEAT(v[x-1],HSPREAD)>>1);
+      if (n>MAX) n=MAX;
+      v[x]=n;
+    }
+}
+
+static void
+XFSettleRow(int *f, int *ff, int *v, int x, int w, int residual)
+{
+  /*This function shows the finished cells (cells that went out keep */
+  /*showing what they had) and leaves behind what stays in each of them */
+  /*plus half a share from its right neighbour */
+  for (;x<w;x++)
+    {
+      if (v[x]>0) ff[x]=v[x];
+      f[x]=HEAT(v[x],residual)+(HEAT(v[x+1],HSPREAD)>>1);
+    }
+}
+
+static void
+XFSpreadRow(int *f, int *ff, int *pre, int *v, int x, int w, int residual)
+{
+  XFChainRow(v,pre,x,w);
+  XFSettleRow(f,ff,v,x,w,residual);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XF_SIMD
+#include <immintrin.h>
+
+/* The chain in XFChainRow() goes one cell at a time, but a cell only */
+/* gets 0..15 from its left neighbour, so it rarely matters more than a */
+/* few cells back. The SIMD versions guess each cell by running the */
+/* chain from nothing three cells to its left, then check every guess */
+/* against the guess to its left and run the real chain only over the */
+/* stretches where they disagree. */
+
+static int
+XFRepairRow(int *f, int *ff, int *pre, int *v, int x0, int x, int m, int w,
+	    int residual)
+{
+  /*This function runs the chain from x (all of v left of x is right) */
+  /*past the first wrong guess m until it agrees with the guesses again, */
+  /*finishes those cells, and returns where checking should carry on */
+  int n,start;
+  
+  start=(m>x) ? x : m-1;
+  if (start<x0) start=x0;
+  for (;x<w;x++)
+    {
+      n=pre[x]+(HEAT(v[x-1],HSPREAD)>>1);
+      if (n>MAX) n=MAX;
+      if (x>m && n==v[x]) break;
+      v[x]=n;
+    }
+  XFSettleRow(f,ff,v,start,x,residual);
+  return x;
+}
+
+/* SSE2 has no 32-bit multiply or minimum, but every value we multiply */
+/* is at most MAX and every heat fits in 15 bits, so the high half of */
+/* each lane is zero and the 16-bit instructions do the job */
+#define HEAT4(v,k) _mm_srli_epi32(_mm_madd_epi16((v),(k)),8)
+
+static void __attribute__((target("sse2")))
+XFGatherRowSSE2(int *pre, int *f, int *v1, int *v2, int x, int w)
 {
-  /*This function processes entire flame array */
-  int x,y,*ptr,*p,tmp,val;
+  __m128i kv=_mm_set1_epi32(VSPREAD),kh=_mm_set1_epi32(HSPREAD),a;
   
-  for (y=(h-1);y>=2;y--)
+  for (;x+4<=w;x+=4)
     {
-      for (x=1;x<(w-1);x++)
+      a=_mm_add_epi32(_mm_loadu_si128((__m128i *)(f+x)),
+		      HEAT4(_mm_loadu_si128((__m128i *)(v1+x)),kv));
+      a=_mm_add_epi32(a,_mm_srli_epi32(
+		      HEAT4(_mm_loadu_si128((__m128i *)(v2+x)),kv),1));
+      a=_mm_add_epi32(a,HEAT4(_mm_loadu_si128((__m128i *)(v1+x-1)),kh));
+      a=_mm_add_epi32(a,HEAT4(_mm_loadu_si128((__m128i *)(v1+x+1)),kh));
+      _mm_storeu_si128((__m128i *)(pre+x),a);
+    }
+  XFGatherRow(pre,f,v1,v2,x,w);
+}
+
+static void __attribute__((target("sse2")))
+XFSpreadRowSSE2(int *f, int *ff, int *pre, int *v, int x0, int w, int residual)
+{
+  /*The guess looks up to three cells left of x0, so pre must have */
+  /*zeros there */
+  __m128i kh=_mm_set1_epi32(HSPREAD),kr=_mm_set1_epi32(residual);
+  __m128i max=_mm_set1_epi32(MAX),zero=_mm_setzero_si128(),a,n;
+  int x,ok;
+  
+#define HALF4(v) _mm_srli_epi32(HEAT4((v),kh),1)
+#define LOAD4(p) _mm_loadu_si128((__m128i *)(p))
+  for (x=x0;x+4<=w;x+=4)
+    {
+      a=_mm_min_epi16(LOAD4(pre+x-3),max);
+      a=_mm_min_epi16(_mm_add_epi32(LOAD4(pre+x-2),HALF4(a)),max);
+      a=_mm_min_epi16(_mm_add_epi32(LOAD4(pre+x-1),HALF4(a)),max);
+      a=_mm_min_epi16(_mm_add_epi32(LOAD4(pre+x),HALF4(a)),max);
+      _mm_storeu_si128((__m128i *)(v+x),a);
+    }
+  XFChainRow(v,pre,x,w);
+  x=x0;
+  while (x+4<=w)
+    {
+      a=LOAD4(v+x);
+      n=_mm_min_epi16(_mm_add_epi32(LOAD4(pre+x),HALF4(LOAD4(v+x-1))),max);
+      ok=_mm_movemask_epi8(_mm_cmpeq_epi32(n,a));
+      if (ok!=0xffff)
 	{
-	  ptr=f+(y<<ws)+x;
-	  val=(int)*ptr;
-	  if (val>MAX) *ptr=(int)MAX;
-	  val=(int)*ptr;
-	  if (val>0)
-	    {
-	      tmp=(val*VSPREAD)>>8;
-	      p=ptr-(2<<ws);				
-	      *p=*p+(tmp>>1);
-	      p=ptr-(1<<ws);				
-	      *p=*p+tmp;
-	      tmp=(val*HSPREAD)>>8;
-	      p=ptr-(1<<ws)-1;
-	      *p=*p+tmp;
-	      p=ptr-(1<<ws)+1;
-	      *p=*p+tmp;
-	      p=ptr-1;
-	      *p=*p+(tmp>>1);
-	      p=ptr+1;
-	      *p=*p+(tmp>>1);
-	      p=ff+(y<<ws)+x;
-	      *p=val;
-	      if (y<(h-1)) *ptr=(val*RESIDUAL)>>8;
-	    }
+	  x=XFRepairRow(f,ff,pre,v,x0,x,x+__builtin_ctz(~ok)/4,w,residual);
+	  continue;
 	}
+      n=_mm_cmpgt_epi32(a,zero);
+      _mm_storeu_si128((__m128i *)(ff+x),_mm_or_si128(_mm_and_si128(n,a),
+		       _mm_andnot_si128(n,LOAD4(ff+x))));
+      _mm_storeu_si128((__m128i *)(f+x),
+		       _mm_add_epi32(HEAT4(a,kr),HALF4(LOAD4(v+x+1))));
+      x+=4;
     }
+  XFChainRow(v,pre,x,w);
+  XFSettleRow(f,ff,v,x>x0 ? x-1 : x0,w,residual);
+#undef HALF4
+#undef LOAD4
 }
 
-static void
-XFDrawFlameBLOK(struct globaldata *g,int *f, int w, int ws, int h, int *ctab)
+#define HEAT8(v,k) _mm256_srli_epi32(_mm256_mullo_epi32((v),(k)),8)
+
+static void __attribute__((target("avx2")))
+XFGatherRowAVX2(int *pre, int *f, int *v1, int *v2, int x, int w)
 {
-  /*This function copies & displays the flame image in one large block */
-  int x,y,*ptr,xx,yy,cl,cl1,cl2,cl3,cl4;
-  unsigned char *cptr,*im,*p;
+  __m256i kv=_mm256_set1_epi32(VSPREAD),kh=_mm256_set1_epi32(HSPREAD),a;
   
-  /* get pointer to the image data */
-  if ( SDL_LockSurface(g->screen) < 0 )
-    return;
+  for (;x+8<=w;x+=8)
+    {
+      a=_mm256_add_epi32(_mm256_loadu_si256((__m256i *)(f+x)),
+			 HEAT8(_mm256_loadu_si256((__m256i *)(v1+x)),kv));
+      a=_mm256_add_epi32(a,_mm256_srli_epi32(
+			 HEAT8(_mm256_loadu_si256((__m256i *)(v2+x)),kv),1));
+      a=_mm256_add_epi32(a,
+			 HEAT8(_mm256_loadu_si256((__m256i *)(v1+x-1)),kh));
+      a=_mm256_add_epi32(a,
+			 HEAT8(_mm256_loadu_si256((__m256i *)(v1+x+1)),kh));
+      _mm256_storeu_si256((__m256i *)(pre+x),a);
+    }
+  XFGatherRow(pre,f,v1,v2,x,w);
+}
 
-  /* copy the calculated flame array to the image buffer */
-  im=(unsigned char *)g->screen->pixels;
-  for (y=0;y<(h-1);y++)
+static void __attribute__((target("avx2")))
+XFSpreadRowAVX2(int *f, int *ff, int *pre, int *v, int x0, int w, int residual)
+{
+  /*See XFSpreadRowSSE2() */
+  __m256i kh=_mm256_set1_epi32(HSPREAD),kr=_mm256_set1_epi32(residual);
+  __m256i max=_mm256_set1_epi32(MAX),zero=_mm256_setzero_si256(),a,n;
+  unsigned ok;
+  int x;
+  
+#define HALF8(v) _mm256_srli_epi32(HEAT8((v),kh),1)
+#define LOAD8(p) _mm256_loadu_si256((__m256i *)(p))
+  for (x=x0;x+8<=w;x+=8)
+    {
+      a=_mm256_min_epi32(LOAD8(pre+x-3),max);
+      a=_mm256_min_epi32(_mm256_add_epi32(LOAD8(pre+x-2),HALF8(a)),max);
+      a=_mm256_min_epi32(_mm256_add_epi32(LOAD8(pre+x-1),HALF8(a)),max);
+      a=_mm256_min_epi32(_mm256_add_epi32(LOAD8(pre+x),HALF8(a)),max);
+      _mm256_storeu_si256((__m256i *)(v+x),a);
+    }
+  XFChainRow(v,pre,x,w);
+  x=x0;
+  while (x+8<=w)
     {
-      for (x=0;x<(w-1);x++)
+      a=LOAD8(v+x);
+      n=_mm256_min_epi32(_mm256_add_epi32(LOAD8(pre+x),HALF8(LOAD8(v+x-1))),
+			 max);
+      ok=(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi32(n,a));
+      if (ok!=0xffffffffu)
 	{
-	  xx=x<<1;
-	  yy=y<<1;
-	  ptr=f+(y<<ws)+x;
-	  cl1=cl=(int)*ptr;
-	  ptr=f+(y<<ws)+x+1;
-	  cl2=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x+1;
-	  cl3=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x;
-	  cl4=(int)*ptr;
-	  cptr=im+yy*g->screen->pitch+xx;
-	  *cptr=(unsigned char)ctab[cl%MAX];
-	  p=cptr+1;
-	  *p=(unsigned char)ctab[((cl1+cl2)>>1)%MAX];
-	  p=cptr+1+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl3)>>1)%MAX];
-	  p=cptr+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl4)>>1)%MAX];
+	  x=XFRepairRow(f,ff,pre,v,x0,x,x+__builtin_ctz(~ok)/4,w,residual);
+	  continue;
 	}
+      _mm256_storeu_si256((__m256i *)(ff+x),
+			  _mm256_blendv_epi8(LOAD8(ff+x),a,
+					     _mm256_cmpgt_epi32(a,zero)));
+      _mm256_storeu_si256((__m256i *)(f+x),
+			  _mm256_add_epi32(HEAT8(a,kr),HALF8(LOAD8(v+x+1))));
+      x+=8;
+    }
+  XFChainRow(v,pre,x,w);
+  XFSettleRow(f,ff,v,x>x0 ? x-1 : x0,w,residual);
+#undef HALF8
+#undef LOAD8
+}
+#endif
+
+/* the row kernels in use, picked by XFPickKernels() */
+static void (*gather_row)(int *, int *, int *, int *, int, int) = XFGatherRow;
+static void (*spread_row)(int *, int *, int *, int *, int, int, int) = XFSpreadRow;
+
+static void
+XFPickKernels(void)
+{
+  /*This function picks the fastest row kernels this processor can run */
+#ifdef XF_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    {
+      gather_row=XFGatherRowAVX2;
+      spread_row=XFSpreadRowAVX2;
+      Debug("Flame: using AVX2.\n");
+    }
+  else if (__builtin_cpu_supports("sse2"))
+    {
+      gather_row=XFGatherRowSSE2;
+      spread_row=XFSpreadRowSSE2;
+      Debug("Flame: using SSE2.\n");
+    }
+#endif
+}
+
+static void
+XFProcessFlame(int *f, int w, int ws, int h, int y0, int y1, int *ff,
+	       int *tmp, int *below, int *above)
+{
+  /*This function processes rows y0..y1-1 of the flame array. Rather than */
+  /*each cell pushing its heat out to its neighbours, each cell pulls in */
+  /*the heat that reaches it, so most of a row can be done at once; the */
+  /*result is the same, cell for cell. Heat rises from the two rows */
+  /*under y1-1, which below holds (NULL: there are none), and the heat */
+  /*of rows y0 and y0+1 is left in above for whoever does the rows */
+  /*over y0 (if above is not NULL). tmp holds four rows of scratch */
+  /*(after four zeros): the heat gathered into this row, and the heat of */
+  /*this row and the two below */
+  int y,*pre,*v,*v1,*v2,*t;
+  
+  pre=tmp+4;
+  v=pre+(1<<ws);
+  v1=pre+(2<<ws);
+  v2=pre+(3<<ws);
+  if (below)
+    memcpy(v1, below, (2<<ws)*sizeof(int));
+  else
+    memset(v1, 0, (2<<ws)*sizeof(int));
+  if (y0<2) y0=2;
+  for (y=(y1-1);y>=y0;y--)
+    {
+      gather_row(pre,f+(y<<ws),v1,v2,1,w-1);
+      spread_row(f+(y<<ws),ff+(y<<ws),pre,v,1,w-1,
+		 y<(h-1) ? RESIDUAL : 256);
+      t=v2; v2=v1; v1=v; v=t;
     }
-  SDL_UnlockSurface(g->screen);
+  if (above)
+    {
+      memcpy(above, v1, (1<<ws)*sizeof(int));
+      memcpy(above+(1<<ws), v2, (1<<ws)*sizeof(int));
+    }
+}
+
+/* write the pixel "c" (already in the surface's format) at "p" */
+#define PUT1(p,c) (*(Uint8 *)(p)=(Uint8)(c))
+#define PUT2(p,c) (*(Uint16 *)(p)=(Uint16)(c))
+#define PUT4(p,c) (*(Uint32 *)(p)=(Uint32)(c))
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define PUT3(p,c) ((p)[0]=(Uint8)(c),(p)[1]=(Uint8)((c)>>8),(p)[2]=(Uint8)((c)>>16))
+#else
+#define PUT3(p,c) ((p)[0]=(Uint8)((c)>>16),(p)[1]=(Uint8)((c)>>8),(p)[2]=(Uint8)(c))
+#endif
+
+/* each flame cell becomes a 2x2 block of pixels, "bpp" bytes apiece */
+#define FLAME_ROWS(bpp,PUT) \
+  for (y=y0;y<y1;y++) \
+    { \
+      r0=im+(y<<1)*pitch; \
+      r1=r0+pitch; \
+      ptr=f+(y<<ws); \
+      nxt=(y+1<y1) ? ptr+(1<<ws) : below; \
+      for (x=0;x<(w-1);x++) \
+	{ \
+	  cl=ptr[x]; \
+	  p=r0+(x<<1)*(bpp); \
+	  PUT(p,ctab[cl%MAX]); \
+	  PUT(p+(bpp),ctab[((cl+ptr[x+1])>>1)%MAX]); \
+	  p=r1+(x<<1)*(bpp); \
+	  PUT(p+(bpp),ctab[((cl+nxt[x+1])>>1)%MAX]); \
+	  PUT(p,ctab[((cl+nxt[x])>>1)%MAX]); \
+	} \
+    }
+
+static void
+XFRenderFlame(struct globaldata *g,int *f, int w, int ws, int y0, int y1,
+	      int *below, int *ctab)
+{
+  /*This function copies rows y0..y1-1 of the calculated flame array to */
+  /*the (locked) image buffer in the surface's own pixel format, so */
+  /*blitting it to the screen later needs no conversion. The last row is */
+  /*blended with below, the row under it */
+  int x,y,*ptr,*nxt,cl,pitch;
+  Uint8 *im,*r0,*r1,*p;
+  
+  im=(Uint8 *)g->screen->pixels;
+  pitch=g->screen->pitch;
+  switch (g->screen->format->BytesPerPixel)
+    {
+    case 1: FLAME_ROWS(1,PUT1); break;
+    case 2: FLAME_ROWS(2,PUT2); break;
+    case 3: FLAME_ROWS(3,PUT3); break;
+    default: FLAME_ROWS(4,PUT4); break;
+    }
+}
 
+static void
+XFDrawFlameBLOK(struct globaldata *g)
+{
+  /*This function displays the flame image in one large block */
   /* copy the image to the screen in one large chunk */
   SDL_Flip(g->screen);
 }
@@ -275,50 +540,17 @@ XFUpdate(struct globaldata *g)
 		SDL_BlitSurface(widget_layer, &g->rects[i],
 			screen, &g->rects[i]);
 	    }
-	    SDL_UpdateRects(screen, g->nrects, g->rects);
+	    atris_update_rects(screen, g->nrects, g->rects);
 	}
 }
 
 static void
-XFDrawFlameLACE(struct globaldata *g,int *f, int w, int ws, int h, int *ctab)
+XFDrawFlameLACE(struct globaldata *g, int w, int h)
 {
-  /*This function copies & displays the flame image in interlaced fashion */
-  /*that it, it first processes and copies the even lines to the screen, */
-  /* then is processes and copies the odd lines of the image to the screen */
-  int x,y,*ptr,xx,yy,cl,cl1,cl2,cl3,cl4;
-  unsigned char *cptr,*im,*p;
-  
-  /* get pointer to the image data */
-  if ( SDL_LockSurface(g->screen) < 0 )
-    return;
-
-  /* copy the calculated flame array to the image buffer */
-  im=(unsigned char *)g->screen->pixels;
-  for (y=0;y<(h-1);y++)
-    {
-      for (x=0;x<(w-1);x++)
-	{
-	  xx=x<<1;
-	  yy=y<<1;
-	  ptr=f+(y<<ws)+x;
-	  cl1=cl=(int)*ptr;
-	  ptr=f+(y<<ws)+x+1;
-	  cl2=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x+1;
-	  cl3=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x;
-	  cl4=(int)*ptr;
-	  cptr=im+yy*g->screen->pitch+xx;
-	  *cptr=(unsigned char)ctab[cl%MAX];
-	  p=cptr+1;
-	  *p=(unsigned char)ctab[((cl1+cl2)>>1)%MAX];
-	  p=cptr+1+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl3)>>1)%MAX];
-	  p=cptr+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl4)>>1)%MAX];
-	}
-    }
-  SDL_UnlockSurface(g->screen);
+  /*This function displays the flame image in interlaced fashion */
+  /*that it, it first copies the even lines to the screen, */
+  /* then it copies the odd lines of the image to the screen */
+  int y;
 
   /* copy the even lines to the screen */
   w <<= 1;
@@ -369,45 +601,12 @@ XFDrawFlameLACE(struct globaldata *g,int *f, int w, int ws, int h, int *ctab)
 }
 
 static void
-XFDrawFlame(struct globaldata *g,int *f, int w, int ws, int h, int *ctab)
+XFDrawFlame(struct globaldata *g, int w, int h)
 {
-  /*This function copies & displays the flame image in interlaced fashion */
-  /*that it, it first processes and copies the even lines to the screen, */
-  /* then is processes and copies the odd lines of the image to the screen */
-  int x,y,*ptr,xx,yy,cl,cl1,cl2,cl3,cl4;
-  unsigned char *cptr,*im,*p;
-  
-  /* get pointer to the image data */
-  if ( SDL_LockSurface(g->screen) < 0 )
-    return;
-
-  /* copy the calculated flame array to the image buffer */
-  im=(unsigned char *)g->screen->pixels;
-  for (y=0;y<(h-1);y++)
-    {
-      for (x=0;x<(w-1);x++)
-	{
-	  xx=x<<1;
-	  yy=y<<1;
-	  ptr=f+(y<<ws)+x;
-	  cl1=cl=(int)*ptr;
-	  ptr=f+(y<<ws)+x+1;
-	  cl2=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x+1;
-	  cl3=(int)*ptr;
-	  ptr=f+((y+1)<<ws)+x;
-	  cl4=(int)*ptr;
-	  cptr=im+yy*g->screen->pitch+xx;
-	  *cptr=(unsigned char)ctab[cl%MAX];
-	  p=cptr+1;
-	  *p=(unsigned char)ctab[((cl1+cl2)>>1)%MAX];
-	  p=cptr+1+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl3)>>1)%MAX];
-	  p=cptr+g->screen->pitch;
-	  *p=(unsigned char)ctab[((cl1+cl4)>>1)%MAX];
-	}
-    }
-  SDL_UnlockSurface(g->screen);
+  /*This function displays the flame image in interlaced fashion */
+  /*that it, it first copies the even lines to the screen, */
+  /* then it copies the odd lines of the image to the screen */
+  int y;
 
   /* copy the even lines to the screen */
   w <<= 1;
@@ -440,32 +639,219 @@ static int *flame,flamesize,ws,flamewidth,flameheight,*flame2;
 static struct globaldata *g;
 static int w, h, f, *ctab;
 
+/*The flame can be split into horizontal bands, each with a thread of its */
+/*own (the first band, at the bottom, is done by the caller). Heat rises */
+/*through the whole flame in one frame, so the bands can't all work on */
+/*the same frame: band k works on the frame before band k-1's, starting */
+/*from the heat band k-1 left on its top two rows (and drawing down to */
+/*its top row of flame2) one round earlier. These halo rows are kept */
+/*twice over, so one band can write this round's while the next reads */
+/*last round's */
+struct flameband
+{
+  int y0,y1;		/* the rows this band does */
+  int *tmp;		/* scratch rows for XFProcessFlame() */
+  int *halo[2];		/* heat of rows y0, y0+1 and flame2 row y0 */
+  SDL_sem *go;
+  SDL_Thread *thread;
+};
+static struct flameband *bands;
+static int nbands, flameround, flamedraw;
+static SDL_sem *banddone;
+
+static void
+XFRunBand(struct flameband *b)
+{
+  /*This function does one round of work on one band of the flame */
+  int k=b-bands,*below=NULL,*above=NULL,*next;
+  
+  if (k>0)
+    below=bands[k-1].halo[(flameround-1)&1];
+  if (k<(nbands-1))
+    above=b->halo[flameround&1];
+  XFProcessFlame(flame,flamewidth,ws,flameheight,b->y0,b->y1,flame2,
+		 b->tmp,below,above);
+  if (above)
+    memcpy(above+(2<<ws),flame2+(b->y0<<ws),(1<<ws)*sizeof(int));
+  if (!flamedraw)
+    return;
+  if (below)
+    XFRenderFlame(g,flame2,flamewidth,ws,b->y0,b->y1,below+(2<<ws),ctab);
+  else
+    {
+      next=flame2+((flameheight-1)<<ws);
+      XFRenderFlame(g,flame2,flamewidth,ws,b->y0,flameheight-1,next,ctab);
+    }
+}
+
+static int
+XFBandThread(void *data)
+{
+  /*This function is the life of a band's thread: wait to be told to go, */
+  /*do a round, say that it is done */
+  struct flameband *b=(struct flameband *)data;
+  
+  for (;;)
+    {
+      SDL_SemWait(b->go);
+      XFRunBand(b);
+      SDL_SemPost(banddone);
+    }
+  return 0;
+}
+
+static int
+XFSetupBands(int n)
+{
+  /*This function splits the flame into (at most) n bands and starts a */
+  /*thread for each but the first. If we can't get that many threads, */
+  /*we make do with fewer */
+  int k,i;
+  
+  if (n>(flameheight>>3)) n=flameheight>>3;
+  if (n<1) n=1;
+  bands=(struct flameband *)calloc(n,sizeof(struct flameband));
+  if (!bands) return 0;
+  if (n>1)
+    banddone=SDL_CreateSemaphore(0);
+  if (!banddone) n=1;
+  for (k=1;k<n;k++)
+    {
+      bands[k].go=SDL_CreateSemaphore(0);
+      if (bands[k].go)
+	bands[k].thread=SDL_CreateThread(XFBandThread,&bands[k]);
+      if (!bands[k].thread)
+	{
+	  Debug("Only %d flame threads: %s\n",k,SDL_GetError());
+	  n=k;
+	}
+    }
+  for (k=0;k<n;k++)
+    {
+      bands[k].y1=flameheight-(flameheight*k)/n;
+      bands[k].y0=flameheight-(flameheight*(k+1))/n;
+      bands[k].tmp=(int *)calloc(4+(4<<ws),sizeof(int));
+      if (!bands[k].tmp) return 0;
+      if (k<(n-1))
+	for (i=0;i<2;i++)
+	  {
+	    bands[k].halo[i]=(int *)calloc(3<<ws,sizeof(int));
+	    if (!bands[k].halo[i]) return 0;
+	  }
+    }
+  nbands=n;
+  return n;
+}
+
+/*The flame runs at Options.flame_fps. A frame may use up to half of the */
+/*time until the next one; if the flame takes longer than that (on */
+/*average) we run it half as often, and speed back up once it fits in */
+/*half of that budget again. flamecost is in 16ths of a millisecond */
+static Uint32 flamedue;
+static int flameperiod, flamecost;
+
+static void
+XFSchedule(Uint32 start, Uint32 end)
+{
+  /*This function notes how long a frame took and works out when the */
+  /*next one is due */
+  int period;
+  
+  if (Options.flame_fps <= 0)
+    return;
+  period=1000/Options.flame_fps;
+  if (period<1) period=1;
+  flamecost+=((int)((end-start)<<4)-flamecost)/8;
+  if (flameperiod<period) 
+    flameperiod=period;
+  if ((flamecost>(flameperiod<<3)) && (flameperiod<(1000/SLOWEST)))
+    {
+      flameperiod<<=1;
+      if (flameperiod>(1000/SLOWEST)) flameperiod=1000/SLOWEST;
+      Debug("Flame too slow (%d ms a frame): one every %d ms.\n",
+	    flamecost>>4,flameperiod);
+    }
+  else if ((flamecost<(flameperiod<<1)) && (flameperiod>period))
+    {
+      flameperiod>>=1;
+      if (flameperiod<period) flameperiod=period;
+    }
+  flamedue+=flameperiod;
+  /* don't try to catch up on frames we missed */
+  if ((Sint32)(end-flamedue)>0)
+    flamedue=end;
+}
+
 /***************************************************************************
+ *      atris_flame_wait()
+ * How many milliseconds until atris_run_flame() has something to do?
+ *********************************************************************PROTO*/
+Uint32
+atris_flame_wait(void)
+{
+    Uint32 now;
+
+    if (Options.flame_fps <= 0)
+	return 0;
+    if (!Options.flame_wanted || Options.video == VIDEO_NULL || !nbands)
+	return 1000 / Options.flame_fps;
+    now = SDL_GetTicks();
+    if ((Sint32)(flamedue - now) <= 0)
+	return 0;
+    return flamedue - now;
+}
+
+/***************************************************************************
+ *      atris_run_flame()
+ * Draws the next frame of the flame, if it is due.
  *********************************************************************PROTO*/
 void 
 atris_run_flame(void)
 {
-    if (!Options.flame_wanted) return;
+    int k;
+    Uint32 start;
+
+    if (!Options.flame_wanted || Options.video == VIDEO_NULL) return;
+    if (!nbands) return;
+    start = SDL_GetTicks();
+    if (Options.flame_fps > 0 && (Sint32)(flamedue - start) > 0) return;
 
+    PROFILE_BEGIN(PROF_FLAME);
     /* modify the bas of the flame */
     XFModifyFlameBase(flame,w>>1,ws,h>>1);
-    /* process the flame array, propagating the flames up the array */
-    XFProcessFlame(flame,w>>1,ws,h>>1,flame2);
+    /* process the flame array, propagating the flames up the array, and */
+    /* draw it: every band at once */
+    flamedraw=(SDL_LockSurface(g->screen) >= 0);
+    for (k=1;k<nbands;k++)
+	SDL_SemPost(bands[k].go);
+    XFRunBand(&bands[0]);
+    for (k=1;k<nbands;k++)
+	SDL_SemWait(banddone);
+    flameround++;
+    if (!flamedraw)
+    {
+	XFSchedule(start,SDL_GetTicks());
+	PROFILE_END(PROF_FLAME);
+	return;
+    }
+    SDL_UnlockSurface(g->screen);
     /* if the user selected BLOCK display method, then display the flame */
     /* all in one go, no fancy upating techniques involved */
     if (f&BLOK)
     {
-	XFDrawFlameBLOK(g,flame2,w>>1,ws,h>>1,ctab);
+	XFDrawFlameBLOK(g);
     }
     else if (f&LACE)
 	/* the default of displaying the flames INTERLACED */
     {
-	XFDrawFlameLACE(g,flame2,w>>1,ws,h>>1,ctab);
+	XFDrawFlameLACE(g,w>>1,h>>1);
     }
     else
     {
-	XFDrawFlame(g,flame2,w>>1,ws,h>>1,ctab);
+	XFDrawFlame(g,w>>1,h>>1);
     }
+    XFSchedule(start,SDL_GetTicks());
+    PROFILE_END(PROF_FLAME);
 }
 
 static int Xflame(struct globaldata *_g,int _w, int _h, int _f, int *_ctab)
@@ -491,6 +877,9 @@ static int Xflame(struct globaldata *_g,int _w, int _h, int _f, int *_ctab)
   /* if we didn't get the memory, return 0 */
   if (!flame2) return 0;
   memset(flame2, 0, flamesize);
+  XFPickKernels();
+  /* split it into bands, one per thread, each with its own scratch rows */
+  if (!XFSetupBands(Options.flame_threads)) return 0;
   if (f&BLOK)
     {
       g->rects = NULL;